@@ -36,6 +36,9 @@ typedef enum jf_cmd_parser_state {
 } jf_cmd_parser_state;
 
 #define JF_CMD_IS_FAIL(state)   ((state) < 0)
+
+// how many item types to fetch at a time when validating a range
+#define JF_CMD_TYPES_CHUNK 256
 ///////////////////////////////////
 
 
@@ -73,7 +76,9 @@ jf_cmd_parser_state yy_cmd_get_parser_state(const yycontext *ctx);
 
 static void yy_cmd_filters_start(yycontext *ctx);
 static void yy_cmd_digest_filter(yycontext *ctx, const enum jf_filter filter);
+static void yy_cmd_validate(yycontext *ctx, const jf_item_type item_type);
 static void yy_cmd_digest(yycontext *ctx, const size_t n);
+static void yy_cmd_validate_range(yycontext *ctx, size_t l, size_t r);
 static void yy_cmd_digest_range(yycontext *ctx, size_t l, size_t r);
 static void yy_cmd_finalize(yycontext *ctx, const bool parse_ok);
 /////////////////////////////////////////
@@ -362,7 +367,7 @@ YY_ACTION(void) yy_1_num(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_1_num\n"));
   {
-#line 116
+#line 122
    __ = strtoul(yytext, NULL, 10); ;
   }
 #undef yythunkpos
@@ -379,7 +384,7 @@ YY_ACTION(void) yy_2_Atom(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_2_Atom\n"));
   {
-#line 114
+#line 120
    yy_cmd_digest(yy, n); ;
   }
 #undef yythunkpos
@@ -399,7 +404,7 @@ YY_ACTION(void) yy_1_Atom(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_1_Atom\n"));
   {
-#line 113
+#line 119
    yy_cmd_digest_range(yy, l, r); ;
   }
 #undef yythunkpos
@@ -416,7 +421,7 @@ YY_ACTION(void) yy_1_Selector(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_1_Selector\n"));
   {
-#line 107
+#line 113
    yy_cmd_digest_range(yy, 1, jf_menu_child_count()); ;
   }
 #undef yythunkpos
@@ -430,7 +435,7 @@ YY_ACTION(void) yy_6_Filter(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_6_Filter\n"));
   {
-#line 105
+#line 111
    yy_cmd_digest_filter(yy, JF_FILTER_DISLIKES); ;
   }
 #undef yythunkpos
@@ -444,7 +449,7 @@ YY_ACTION(void) yy_5_Filter(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_5_Filter\n"));
   {
-#line 104
+#line 110
    yy_cmd_digest_filter(yy, JF_FILTER_LIKES); ;
   }
 #undef yythunkpos
@@ -458,7 +463,7 @@ YY_ACTION(void) yy_4_Filter(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_4_Filter\n"));
   {
-#line 103
+#line 109
    yy_cmd_digest_filter(yy, JF_FILTER_FAVORITE); ;
   }
 #undef yythunkpos
@@ -472,7 +477,7 @@ YY_ACTION(void) yy_3_Filter(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_3_Filter\n"));
   {
-#line 102
+#line 108
    yy_cmd_digest_filter(yy, JF_FILTER_RESUMABLE); ;
   }
 #undef yythunkpos
@@ -486,7 +491,7 @@ YY_ACTION(void) yy_2_Filter(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_2_Filter\n"));
   {
-#line 101
+#line 107
    yy_cmd_digest_filter(yy, JF_FILTER_IS_UNPLAYED); ;
   }
 #undef yythunkpos
@@ -500,13 +505,27 @@ YY_ACTION(void) yy_1_Filter(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_1_Filter\n"));
   {
-#line 100
+#line 106
    yy_cmd_digest_filter(yy, JF_FILTER_IS_PLAYED); ;
   }
 #undef yythunkpos
 #undef yypos
 #undef yy
 }
+YY_ACTION(void) yy_13_Start(yycontext *yy, char *yytext, int yyleng)
+{
+#define __ yy->__
+#define yypos yy->__pos
+#define yythunkpos yy->__thunkpos
+  yyprintf((stderr, "do yy_13_Start\n"));
+  {
+#line 101
+   yy_cmd_finalize(yy, true); ;
+  }
+#undef yythunkpos
+#undef yypos
+#undef yy
+}
 YY_ACTION(void) yy_12_Start(yycontext *yy, char *yytext, int yyleng)
 {
 #define __ yy->__
@@ -514,8 +533,8 @@ YY_ACTION(void) yy_12_Start(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_12_Start\n"));
   {
-#line 95
-   yy_cmd_finalize(yy, true); ;
+#line 98
+   yy->state = JF_CMD_MARK_UNPLAYED; ;
   }
 #undef yythunkpos
 #undef yypos
@@ -528,8 +547,8 @@ YY_ACTION(void) yy_11_Start(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_11_Start\n"));
   {
-#line 92
-   yy->state = JF_CMD_MARK_UNPLAYED; ;
+#line 97
+   yy->state = JF_CMD_MARK_PLAYED; ;
   }
 #undef yythunkpos
 #undef yypos
@@ -542,8 +561,8 @@ YY_ACTION(void) yy_10_Start(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_10_Start\n"));
   {
-#line 91
-   yy->state = JF_CMD_MARK_PLAYED; ;
+#line 96
+   yy->state = JF_CMD_MARK_UNFAVORITE; ;
   }
 #undef yythunkpos
 #undef yypos
@@ -556,8 +575,8 @@ YY_ACTION(void) yy_9_Start(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_9_Start\n"));
   {
-#line 90
-   yy->state = JF_CMD_MARK_UNFAVORITE; ;
+#line 95
+   yy->state = JF_CMD_MARK_FAVORITE; ;
   }
 #undef yythunkpos
 #undef yypos
@@ -570,8 +589,8 @@ YY_ACTION(void) yy_8_Start(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_8_Start\n"));
   {
-#line 89
-   yy->state = JF_CMD_MARK_FAVORITE; ;
+#line 93
+   yy_cmd_digest_filter(yy, JF_FILTER_NONE); ;
   }
 #undef yythunkpos
 #undef yypos
@@ -584,8 +603,8 @@ YY_ACTION(void) yy_7_Start(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_7_Start\n"));
   {
-#line 87
-   yy_cmd_digest_filter(yy, JF_FILTER_NONE); ;
+#line 92
+   yy_cmd_filters_start(yy); ;
   }
 #undef yythunkpos
 #undef yypos
@@ -598,8 +617,8 @@ YY_ACTION(void) yy_6_Start(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_6_Start\n"));
   {
-#line 86
-   yy_cmd_filters_start(yy); ;
+#line 91
+   yy->state = JF_CMD_SPECIAL; jf_menu_quit(); ;
   }
 #undef yythunkpos
 #undef yypos
@@ -612,8 +631,8 @@ YY_ACTION(void) yy_5_Start(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_5_Start\n"));
   {
-#line 85
-   yy->state = JF_CMD_SPECIAL; jf_menu_quit(); ;
+#line 90
+   yy->state = JF_CMD_SPECIAL; jf_menu_search(yytext); ;
   }
 #undef yythunkpos
 #undef yypos
@@ -626,8 +645,8 @@ YY_ACTION(void) yy_4_Start(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_4_Start\n"));
   {
-#line 84
-   yy->state = JF_CMD_SPECIAL; jf_menu_search(yytext); ;
+#line 87
+   yy->state = JF_CMD_SPECIAL; jf_menu_stats(); ;
   }
 #undef yythunkpos
 #undef yypos
@@ -640,7 +659,7 @@ YY_ACTION(void) yy_3_Start(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_3_Start\n"));
   {
-#line 81
+#line 86
    yy->state = JF_CMD_SPECIAL; jf_menu_clear(); ;
   }
 #undef yythunkpos
@@ -654,7 +673,7 @@ YY_ACTION(void) yy_2_Start(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_2_Start\n"));
   {
-#line 80
+#line 85
    yy->state = JF_CMD_SPECIAL; jf_menu_help(); ;
   }
 #undef yythunkpos
@@ -668,7 +687,7 @@ YY_ACTION(void) yy_1_Start(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_1_Start\n"));
   {
-#line 79
+#line 84
    yy->state = JF_CMD_SPECIAL; jf_menu_dotdot(); ;
   }
 #undef yythunkpos
@@ -813,7 +832,8 @@ YY_RULE(int) yy_Start(yycontext *yy)
   }
   l42:;	  yyDo(yy, yy_2_Start, yy->__begin, yy->__end);  goto l39;
   l41:;	  yy->__pos= yypos39; yy->__thunkpos= yythunkpos39;  if (!yymatchChar(yy, 'h')) goto l44;  yyDo(yy, yy_3_Start, yy->__begin, yy->__end);  goto l39;
-  l44:;	  yy->__pos= yypos39; yy->__thunkpos= yythunkpos39;  if (!yymatchChar(yy, 's')) goto l45;  if (!yy_ws(yy)) goto l45;
+  l44:;	  yy->__pos= yypos39; yy->__thunkpos= yythunkpos39;  if (!yymatchString(yy, "stats")) goto l68;  yyDo(yy, yy_4_Start, yy->__begin, yy->__end);  goto l39;
+  l68:;	  yy->__pos= yypos39; yy->__thunkpos= yythunkpos39;  if (!yymatchChar(yy, 's')) goto l45;  if (!yy_ws(yy)) goto l45;
   l46:;	
   {  int yypos47= yy->__pos, yythunkpos47= yy->__thunkpos;  if (!yy_ws(yy)) goto l47;  goto l46;
   l47:;	  yy->__pos= yypos47; yy->__thunkpos= yythunkpos47;
@@ -833,14 +853,14 @@ if (!(YY_BEGIN)) goto l45;
 if (!(YY_END)) goto l45;
 #undef yytext
 #undef yyleng
-  }  yyDo(yy, yy_4_Start, yy->__begin, yy->__end);  goto l39;
-  l45:;	  yy->__pos= yypos39; yy->__thunkpos= yythunkpos39;  if (!yymatchChar(yy, 'q')) goto l50;  yyDo(yy, yy_5_Start, yy->__begin, yy->__end);  goto l39;
-  l50:;	  yy->__pos= yypos39; yy->__thunkpos= yythunkpos39;  if (!yymatchChar(yy, 'f')) goto l51;  yyDo(yy, yy_6_Start, yy->__begin, yy->__end);  if (!yy_ws(yy)) goto l51;
+  }  yyDo(yy, yy_5_Start, yy->__begin, yy->__end);  goto l39;
+  l45:;	  yy->__pos= yypos39; yy->__thunkpos= yythunkpos39;  if (!yymatchChar(yy, 'q')) goto l50;  yyDo(yy, yy_6_Start, yy->__begin, yy->__end);  goto l39;
+  l50:;	  yy->__pos= yypos39; yy->__thunkpos= yythunkpos39;  if (!yymatchChar(yy, 'f')) goto l51;  yyDo(yy, yy_7_Start, yy->__begin, yy->__end);  if (!yy_ws(yy)) goto l51;
   l52:;	
   {  int yypos53= yy->__pos, yythunkpos53= yy->__thunkpos;  if (!yy_ws(yy)) goto l53;  goto l52;
   l53:;	  yy->__pos= yypos53; yy->__thunkpos= yythunkpos53;
   }
-  {  int yypos54= yy->__pos, yythunkpos54= yy->__thunkpos;  if (!yymatchChar(yy, 'c')) goto l55;  yyDo(yy, yy_7_Start, yy->__begin, yy->__end);  goto l54;
+  {  int yypos54= yy->__pos, yythunkpos54= yy->__thunkpos;  if (!yymatchChar(yy, 'c')) goto l55;  yyDo(yy, yy_8_Start, yy->__begin, yy->__end);  goto l54;
   l55:;	  yy->__pos= yypos54; yy->__thunkpos= yythunkpos54;  if (!yy_Filters(yy)) goto l51;
   }
   l54:;	  goto l39;
@@ -849,10 +869,10 @@ if (!(YY_END)) goto l45;
   {  int yypos58= yy->__pos, yythunkpos58= yy->__thunkpos;  if (!yy_ws(yy)) goto l58;  goto l57;
   l58:;	  yy->__pos= yypos58; yy->__thunkpos= yythunkpos58;
   }
-  {  int yypos59= yy->__pos, yythunkpos59= yy->__thunkpos;  if (!yymatchChar(yy, 'f')) goto l60;  yyDo(yy, yy_8_Start, yy->__begin, yy->__end);  goto l59;
-  l60:;	  yy->__pos= yypos59; yy->__thunkpos= yythunkpos59;  if (!yymatchString(yy, "uf")) goto l61;  yyDo(yy, yy_9_Start, yy->__begin, yy->__end);  goto l59;
-  l61:;	  yy->__pos= yypos59; yy->__thunkpos= yythunkpos59;  if (!yymatchChar(yy, 'p')) goto l62;  yyDo(yy, yy_10_Start, yy->__begin, yy->__end);  goto l59;
-  l62:;	  yy->__pos= yypos59; yy->__thunkpos= yythunkpos59;  if (!yymatchChar(yy, 'u')) goto l56;  yyDo(yy, yy_11_Start, yy->__begin, yy->__end);
+  {  int yypos59= yy->__pos, yythunkpos59= yy->__thunkpos;  if (!yymatchChar(yy, 'f')) goto l60;  yyDo(yy, yy_9_Start, yy->__begin, yy->__end);  goto l59;
+  l60:;	  yy->__pos= yypos59; yy->__thunkpos= yythunkpos59;  if (!yymatchString(yy, "uf")) goto l61;  yyDo(yy, yy_10_Start, yy->__begin, yy->__end);  goto l59;
+  l61:;	  yy->__pos= yypos59; yy->__thunkpos= yythunkpos59;  if (!yymatchChar(yy, 'p')) goto l62;  yyDo(yy, yy_11_Start, yy->__begin, yy->__end);  goto l59;
+  l62:;	  yy->__pos= yypos59; yy->__thunkpos= yythunkpos59;  if (!yymatchChar(yy, 'u')) goto l56;  yyDo(yy, yy_12_Start, yy->__begin, yy->__end);
   }
   l59:;	  if (!yy_ws(yy)) goto l56;
   l63:;	
@@ -876,7 +896,7 @@ if (!(YY_END)) goto l45;
 #undef yytext
 #undef yyleng
   }  goto l34;
-  l35:;	  yyDo(yy, yy_12_Start, yy->__begin, yy->__end);
+  l35:;	  yyDo(yy, yy_13_Start, yy->__begin, yy->__end);
   yyprintf((stderr, "  ok   %s @ %s\n", "Start", yy->__buf+yy->__pos));
   return 1;
   l34:;	  yy->__pos= yypos0; yy->__thunkpos= yythunkpos0;
@@ -931,7 +951,7 @@ YY_PARSE(yycontext *) YYRELEASE(yycontext *yyctx)
 }
 
 #endif
-#line 123 "src/cmd.leg"
+#line 129 "src/cmd.leg"
 
 jf_cmd_parser_state yy_cmd_get_parser_state(const yycontext *ctx)
 {
@@ -966,17 +986,10 @@ static void yy_cmd_digest_filter(yycontext *ctx, const enum jf_filter filter)
 }
 
 
-static void yy_cmd_digest(yycontext *ctx, size_t n)
+static void yy_cmd_validate(yycontext *ctx, const jf_item_type item_type)
 {
-    jf_item_type item_type;
-
-    // no-op on fail state
-    if (JF_CMD_IS_FAIL(ctx->state)) {
-        return;
-    }
-
     // no-op if item does not exist (out of bounds)
-    if ((item_type = jf_menu_child_get_type(n)) == JF_ITEM_TYPE_NONE) {
+    if (item_type == JF_ITEM_TYPE_NONE) {
         return;
     }
 
@@ -996,6 +1009,33 @@ static void yy_cmd_digest(yycontext *ctx, size_t n)
         case JF_CMD_VALIDATE_FOLDER:
             ctx->state = JF_CMD_FAIL_FOLDER;
             break;
+        default:
+            fprintf(stderr, "Error: yy_cmd_validate: unexpected state transition. This is a bug.\n"); 
+            break;
+    }
+}
+
+
+static void yy_cmd_digest(yycontext *ctx, size_t n)
+{
+    jf_item_type item_type;
+
+    // no-op on fail state
+    if (JF_CMD_IS_FAIL(ctx->state)) {
+        return;
+    }
+
+    // no-op if item does not exist (out of bounds)
+    if ((item_type = jf_menu_child_get_type(n)) == JF_ITEM_TYPE_NONE) {
+        return;
+    }
+
+    switch (ctx->state) {
+        case JF_CMD_VALIDATE_START:
+        case JF_CMD_VALIDATE_ATOMS:
+        case JF_CMD_VALIDATE_FOLDER:
+            yy_cmd_validate(ctx, item_type);
+            break;
         case JF_CMD_VALIDATE_OK:
             if (! jf_menu_child_dispatch(n)) {
                 ctx->state = JF_CMD_FAIL_DISPATCH;
@@ -1020,12 +1060,68 @@ static void yy_cmd_digest(yycontext *ctx, size_t n)
 }
 
 
+static void yy_cmd_validate_range(yycontext *ctx, size_t l, size_t r)
+{
+    jf_item_type types[JF_CMD_TYPES_CHUNK];
+    size_t last, i;
+
+    // validation does not care about the order of the items, so go bottom up
+    // and fetch the types in bulk
+    if (l > r) {
+        i = l;
+        l = r;
+        r = i;
+    }
+    while (true) {
+        last = r - l < JF_CMD_TYPES_CHUNK ? r : l + JF_CMD_TYPES_CHUNK - 1;
+        jf_menu_child_get_types(l, last, types);
+        for (i = 0; i <= last - l; i++) {
+            yy_cmd_validate(ctx, types[i]);
+            if (JF_CMD_IS_FAIL(ctx->state)) return;
+        }
+        if (last == r) break;
+        l = last + 1;
+    }
+}
+
+
 static void yy_cmd_digest_range(yycontext *ctx, size_t l, size_t r)
 {
     // and now for our next trick: unsigned arithmetic!
     size_t step = l <= r ? 1 : (size_t)-1;
     l = jf_clamp_zu(l, 0, jf_menu_child_count()+1);
     r = jf_clamp_zu(r, 0, jf_menu_child_count()+1);
+    switch (ctx->state) {
+        case JF_CMD_VALIDATE_START:
+        case JF_CMD_VALIDATE_ATOMS:
+        case JF_CMD_VALIDATE_FOLDER:
+            yy_cmd_validate_range(ctx, l, r);
+            return;
+        case JF_CMD_VALIDATE_OK:
+            // playlist order matters, so only ascending ranges go in bulk
+            if (l < r) {
+                if (! jf_menu_child_dispatch_range(l, r)) {
+                    ctx->state = JF_CMD_FAIL_DISPATCH;
+                }
+                return;
+            }
+            break;
+        // the order doesn't matter, the pipeline is better fed in bulk
+        case JF_CMD_MARK_PLAYED:
+            jf_menu_child_set_flag_range(l, r, JF_FLAG_TYPE_PLAYED, true);
+            return;
+        case JF_CMD_MARK_UNPLAYED:
+            jf_menu_child_set_flag_range(l, r, JF_FLAG_TYPE_PLAYED, false);
+            return;
+        case JF_CMD_MARK_FAVORITE:
+            jf_menu_child_set_flag_range(l, r, JF_FLAG_TYPE_FAVORITE, true);
+            return;
+        case JF_CMD_MARK_UNFAVORITE:
+            jf_menu_child_set_flag_range(l, r, JF_FLAG_TYPE_FAVORITE, false);
+            return;
+        default:
+            break;
+    }
     while (true) {
         yy_cmd_digest(ctx, l);
         if (l == r) break;
@@ -58,6 +58,13 @@ void jf_options_init(void)
     // during config file parsing
     g_options.ssl_verifyhost = JF_CONFIG_SSL_VERIFYHOST_DEFAULT;
     g_options.check_updates = JF_CONFIG_CHECK_UPDATES_DEFAULT;
+    g_options.cache_memory_mb = JF_CONFIG_CACHE_MEMORY_MB_DEFAULT;
+    g_options.persistent_playlist = JF_CONFIG_PERSISTENT_PLAYLIST_DEFAULT;
+    g_options.http_cache_mb = JF_CONFIG_HTTP_CACHE_MB_DEFAULT;
+    g_options.http_cache_persist = JF_CONFIG_HTTP_CACHE_PERSIST_DEFAULT;
+    g_options.page_size = JF_CONFIG_PAGE_SIZE_DEFAULT;
+    g_options.net_stats_dump = JF_CONFIG_NET_STATS_DUMP_DEFAULT;
+    g_options.flag_requests = JF_CONFIG_FLAG_REQUESTS_DEFAULT;
     jf_options_complete_with_defaults();
 }
 
@@ -146,6 +153,20 @@ void jf_config_read(const char *config_path)
                         "Warning: unrecognized value for config option \"try_local_files\": %s",
                         value);
             }
+        } else if (JF_CONFIG_KEY_IS("cache_memory_mb")) {
+            JF_CONFIG_FILL_VALUE_ZU(cache_memory_mb);
+        } else if (JF_CONFIG_KEY_IS("persistent_playlist")) {
+            JF_CONFIG_FILL_VALUE_BOOL(persistent_playlist);
+        } else if (JF_CONFIG_KEY_IS("http_cache_mb")) {
+            JF_CONFIG_FILL_VALUE_ZU(http_cache_mb);
+        } else if (JF_CONFIG_KEY_IS("http_cache_persist")) {
+            JF_CONFIG_FILL_VALUE_BOOL(http_cache_persist);
+        } else if (JF_CONFIG_KEY_IS("page_size")) {
+            JF_CONFIG_FILL_VALUE_ZU(page_size);
+        } else if (JF_CONFIG_KEY_IS("net_stats_dump")) {
+            JF_CONFIG_FILL_VALUE_BOOL(net_stats_dump);
+        } else if (JF_CONFIG_KEY_IS("flag_requests")) {
+            JF_CONFIG_FILL_VALUE_ZU(flag_requests);
         } else {
             // option key was not recognized; print a warning and go on
             fprintf(stderr,
@@ -207,6 +228,16 @@ bool jf_config_write(const char *config_path)
     }
     fprintf(tmp_file, "try_local_files=%s\n",
         jf_strong_bool_to_str(g_options.try_local_files_config));
+    fprintf(tmp_file, "cache_memory_mb=%zu\n", g_options.cache_memory_mb);
+    fprintf(tmp_file, "persistent_playlist=%s\n",
+            g_options.persistent_playlist ? "true" : "false");
+    fprintf(tmp_file, "http_cache_mb=%zu\n", g_options.http_cache_mb);
+    fprintf(tmp_file, "http_cache_persist=%s\n",
+            g_options.http_cache_persist ? "true" : "false");
+    fprintf(tmp_file, "page_size=%zu\n", g_options.page_size);
+    fprintf(tmp_file, "net_stats_dump=%s\n",
+            g_options.net_stats_dump ? "true" : "false");
+    fprintf(tmp_file, "flag_requests=%zu\n", g_options.flag_requests);
     // NB don't write check_updates, we want it set manually
 
     if (fclose(tmp_file) != 0) {
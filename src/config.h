@@ -30,9 +30,35 @@ do {                                                        \
 do {                                                                \
     if (strncmp(value, "false", JF_STATIC_STRLEN("false")) == 0) {  \
         g_options._key= false;                                      \
+    } else if (strncmp(value, "true", JF_STATIC_STRLEN("true")) == 0) { \
+        g_options._key = true;                                      \
     }                                                               \
 } while (false)
 
+// strtoull alone would take "-1" for ULLONG_MAX and "64MB" for 64
+#define JF_CONFIG_FILL_VALUE_ZU(_key)                                              \
+do {                                                                               \
+    const char *_start = value;                                                    \
+    char *_endptr;                                                                 \
+    unsigned long long _value;                                                     \
+    bool _valid;                                                                   \
+    while (*_start == ' ' || *_start == '\t') _start++;                            \
+    errno = 0;                                                                     \
+    _value = strtoull(_start, &_endptr, 10);                                       \
+    _valid = *_start != '-' && _endptr != _start && errno != ERANGE;               \
+    while (*_endptr == ' ' || *_endptr == '\t'                                     \
+            || *_endptr == '\r' || *_endptr == '\n') {                             \
+        _endptr++;                                                                 \
+    }                                                                              \
+    if (! _valid || *_endptr != '\0') {                                            \
+        fprintf(stderr,                                                            \
+                "Warning: unrecognized value for config option \"" #_key "\": %s", \
+                value);                                                            \
+    } else {                                                                       \
+        g_options._key = (size_t)_value;                                           \
+    }                                                                              \
+} while (false)
+
 #define JF_CONFIG_WRITE_VALUE(key) fprintf(tmp_file, #key "=%s\n", g_options.key)
 /////////////////////////////////
 
@@ -47,6 +73,13 @@ do {                                                                \
 #define JF_CONFIG_VERSION_DEFAULT           JF_VERSION
 #define JF_CONFIG_MPV_PROFILE_DEFAULT       "jftui"
 #define JF_CONFIG_CHECK_UPDATES_DEFAULT     true
+#define JF_CONFIG_CACHE_MEMORY_MB_DEFAULT   64
+#define JF_CONFIG_PERSISTENT_PLAYLIST_DEFAULT false
+#define JF_CONFIG_HTTP_CACHE_MB_DEFAULT     32
+#define JF_CONFIG_HTTP_CACHE_PERSIST_DEFAULT false
+#define JF_CONFIG_PAGE_SIZE_DEFAULT         1000
+#define JF_CONFIG_NET_STATS_DUMP_DEFAULT    false
+#define JF_CONFIG_FLAG_REQUESTS_DEFAULT     32
 
 
 typedef struct jf_options {
@@ -63,6 +96,21 @@ typedef struct jf_options {
     bool check_updates;
     bool try_local_files;
     jf_strong_bool try_local_files_config;
+    // per cache file, 0 means always use files in TMPDIR
+    size_t cache_memory_mb;
+    // keep a journal of the playlist in the config dir to resume it at startup
+    bool persistent_playlist;
+    // bound on the cache of GET responses, 0 disables it
+    size_t http_cache_mb;
+    // save the cache above in the config dir at exit and load it at startup
+    bool http_cache_persist;
+    // items per request for big listings, the rest are fetched in the
+    // background; 0 means whole listings at once
+    size_t page_size;
+    // write the network statistics to the config dir at exit
+    bool net_stats_dump;
+    // flag changes in flight at once for "m" commands over many items
+    size_t flag_requests;
 } jf_options;
 
 
@@ -1,81 +1,456 @@
+// memfd_create
+#define _GNU_SOURCE
+
 #include "disk.h"
 #include "shared.h"
+#include "config.h"
 #include "menu.h"
 
 #include <stdlib.h> // malloc, getenv
-#include <stdio.h> // fwrite etc.
-#include <unistd.h> // unlink
+#include <stdio.h> // snprintf etc.
+#include <unistd.h> // unlink, ftruncate
+#include <fcntl.h> // open, posix_fallocate
 #include <sys/stat.h> //mkdir
+#include <sys/mman.h> // mmap, memfd_create
+#include <sys/uio.h> // writev
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
 
 
 ////////// GLOBALS //////////
 extern jf_global_state g_state;
+extern jf_options g_options;
 /////////////////////////////
 
 
 ////////// STATIC VARIABLES //////////
-static jf_growing_buffer s_buffer;
 static char *s_file_prefix = NULL;
+static bool s_memory_backend = true;
 static jf_file_cache s_payload = (jf_file_cache){ 0 };
 static jf_file_cache s_playlist = (jf_file_cache){ 0 };
+static int s_journal_fd = -1;
+static bool s_journal_stale = false;
+// bytes appended to the journal since it was last started over
+static size_t s_journal_size = 0;
+// last position recorded, for when the journal is rewritten
+static size_t s_journal_position = 0;
+// names scratch caches apart
+static size_t s_scratch_serial = 0;
 //////////////////////////////////////
 
 
 ////////// STATIC FUNCTIONS ///////////
-static inline void jf_disk_align_to(jf_file_cache *cache, const size_t n);
+static inline bool jf_disk_memory_backend_usable(void);
+static bool jf_disk_map_open_memory(jf_file_map *map);
+static int jf_disk_map_open_file(const jf_file_map *map);
+static void jf_disk_map_open(jf_file_map *map);
+static void jf_disk_map_spill(jf_file_map *map);
+static void jf_disk_map_reset(jf_file_map *map);
+static void jf_disk_map_close(jf_file_map *map);
+static void jf_disk_map_resize(jf_file_map *map, const size_t size);
+static inline void jf_disk_map_reserve(jf_file_map *map, const size_t length);
+static inline void jf_disk_map_append(jf_file_map *map,
+        const void *data,
+        const size_t length);
+static inline jf_disk_header_record *jf_disk_header_entry(const jf_file_cache *cache,
+        const size_t n);
+static inline void jf_disk_add_header_record(jf_file_cache *cache,
+        const jf_item_type type);
 static inline void jf_disk_open(jf_file_cache *cache);
+static inline void jf_disk_clear(jf_file_cache *cache);
+static size_t jf_disk_record_end(const jf_file_cache *cache, const size_t offset);
+
+// Like jf_disk_record_end, but for records read back from a file that can't
+// be trusted: every field is checked to fit in the data before it is looked
+// at, and nesting and children_count are capped.
+//
+// Returns:
+//  the offset right past the record starting at offset, children included, or
+//  0 if the record is not well-formed within length bytes.
+// CAN'T FAIL.
+static size_t jf_disk_record_end_checked(const char *data,
+        const size_t length,
+        size_t offset,
+        const size_t depth);
+static void jf_disk_compact(jf_file_cache *cache);
+static void jf_disk_add_record(jf_file_cache *cache,
+        const jf_item_type type,
+        const char *id,
+        const size_t id_len,
+        const char *name,
+        const char *path,
+        const long long runtime_ticks,
+        const long long playback_ticks,
+        const size_t children_count);
 static void jf_disk_add_next(jf_file_cache *cache, const jf_menu_item *item);
 static void jf_disk_add_item(jf_file_cache *cache, const jf_menu_item *item);
-static jf_menu_item *jf_disk_get_next(jf_file_cache *cache);
-static jf_menu_item *jf_disk_get_item(jf_file_cache *cache, const size_t n);
-static void jf_disk_read_to_null_to_buffer(jf_growing_buffer buffer,
-        jf_file_cache *cache);
+static size_t jf_disk_read_view(const jf_file_cache *cache,
+        const size_t offset,
+        jf_disk_item_view *view);
+static bool jf_disk_get_view(const jf_file_cache *cache,
+        const size_t n,
+        jf_disk_item_view *view);
+static jf_menu_item *jf_disk_get_next(const jf_file_cache *cache,
+        size_t *offset);
+static jf_menu_item *jf_disk_get_item(const jf_file_cache *cache,
+        const size_t n);
+static void jf_disk_journal_close(void);
+static void jf_disk_journal_append(const jf_disk_journal_op op,
+        const struct iovec *payload,
+        const int payload_count);
+static inline void jf_disk_journal_record(const jf_disk_journal_op op,
+        const size_t index,
+        const size_t offset);
+static void jf_disk_journal_rewrite(void);
+static inline void jf_disk_journal_maybe_rewrite(void);
+static bool jf_disk_journal_replay_add(const char *data, const size_t length);
+static bool jf_disk_journal_replay_entry(const jf_disk_journal_op op,
+        const char *data,
+        const size_t length,
+        size_t *position);
+static char *jf_disk_journal_read(const char *path, size_t *size);
 ///////////////////////////////////////
 
 
+////////// FILE MAPPINGS //////////
+static inline bool jf_disk_memory_backend_usable(void)
+{
+    return s_memory_backend && g_options.cache_memory_mb > 0;
+}
+
+
+static bool jf_disk_map_open_memory(jf_file_map *map)
+{
+#ifdef MFD_CLOEXEC
+    const char *name = strrchr(map->path, '/');
+
+    if ((map->fd = memfd_create(name == NULL ? map->path : name + 1,
+                    MFD_CLOEXEC)) != -1) {
+        return true;
+    }
+    if (errno == ENOSYS) {
+        // kernel too old, don't bother trying again
+        s_memory_backend = false;
+    }
+    return false;
+#else
+    (void)map;
+    s_memory_backend = false;
+    return false;
+#endif
+}
+
+
+static int jf_disk_map_open_file(const jf_file_map *map)
+{
+    int fd;
+
+    assert((fd = open(map->path,
+                    O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    S_IRUSR | S_IWUSR)) != -1);
+    // no error checking, nothing to do if it fails
+    // at worst we pollute the temp dir, which is not the end of the world
+    unlink(map->path);
+    return fd;
+}
+
+
+static void jf_disk_map_open(jf_file_map *map)
+{
+    if (jf_disk_memory_backend_usable() && jf_disk_map_open_memory(map)) {
+        map->in_memory = true;
+    } else {
+        map->fd = jf_disk_map_open_file(map);
+        map->in_memory = false;
+    }
+    map->addr = NULL;
+    map->size = 0;
+    map->used = 0;
+    jf_disk_map_resize(map, JF_DISK_MAP_INITIAL_SIZE);
+}
+
+
+static void jf_disk_map_spill(jf_file_map *map)
+{
+    int fd = jf_disk_map_open_file(map);
+    size_t written = 0;
+    ssize_t ret;
+
+    while (written < map->used) {
+        ret = write(fd, map->addr + written, map->used - written);
+        if (ret == -1 && errno == EINTR) continue;
+        assert(ret > 0);
+        written += (size_t)ret;
+    }
+    // the old mapping keeps the memfd alive until jf_disk_map_resize drops it
+    close(map->fd);
+    map->fd = fd;
+    map->in_memory = false;
+}
+
+
+static void jf_disk_map_reset(jf_file_map *map)
+{
+    // a big listing made us spill to disk: go back to memory
+    if (! map->in_memory && jf_disk_memory_backend_usable()) {
+        assert(munmap(map->addr, map->size) == 0);
+        close(map->fd);
+        jf_disk_map_open(map);
+        return;
+    }
+
+    map->used = 0;
+    // give back whatever a huge listing made us allocate
+    if (map->size > JF_DISK_MAP_INITIAL_SIZE) {
+        assert(munmap(map->addr, map->size) == 0);
+        map->addr = NULL;
+        map->size = 0;
+        assert(ftruncate(map->fd, 0) == 0);
+        jf_disk_map_resize(map, JF_DISK_MAP_INITIAL_SIZE);
+    }
+}
+
+
+static void jf_disk_map_close(jf_file_map *map)
+{
+    assert(munmap(map->addr, map->size) == 0);
+    close(map->fd);
+    free(map->path);
+    *map = (jf_file_map){ .fd = -1 };
+}
+
+
+static void jf_disk_map_resize(jf_file_map *map, const size_t size)
+{
+    char *addr;
+
+    if (map->in_memory && size > g_options.cache_memory_mb * 1024 * 1024) {
+        jf_disk_map_spill(map);
+    }
+
+    // actually reserve the blocks: writing past a hole the filesystem (or
+    // shmem) can't fill would get us a SIGBUS instead of a clean failure
+    assert(posix_fallocate(map->fd, 0, (off_t)size) == 0);
+    assert((addr = mmap(NULL,
+                    size,
+                    PROT_READ | PROT_WRITE,
+                    MAP_SHARED,
+                    map->fd,
+                    0)) != MAP_FAILED);
+    if (map->addr != NULL) {
+        assert(munmap(map->addr, map->size) == 0);
+    }
+    map->addr = addr;
+    map->size = size;
+}
+
+
+static inline void jf_disk_map_reserve(jf_file_map *map, const size_t length)
+{
+    size_t size;
+
+    if (map->used + length <= map->size) return;
+
+    size = map->size;
+    while (size < map->used + length) {
+        size *= 2;
+    }
+    jf_disk_map_resize(map, size);
+}
+
+
+static inline void jf_disk_map_append(jf_file_map *map,
+        const void *data,
+        const size_t length)
+{
+    jf_disk_map_reserve(map, length);
+    memcpy(map->addr + map->used, data, length);
+    map->used += length;
+}
+///////////////////////////////////
+
+
+static inline jf_disk_header_record *jf_disk_header_entry(const jf_file_cache *cache,
+        const size_t n)
+{
+    return (jf_disk_header_record *)cache->header.addr + (n - 1);
+}
+
+
+// Must be called right before appending the corresponding record to the body.
+static inline void jf_disk_add_header_record(jf_file_cache *cache,
+        const jf_item_type type)
+{
+    jf_disk_header_record record = { .offset = cache->body.used, .type = type };
+
+    jf_disk_map_append(&cache->header, &record, sizeof(jf_disk_header_record));
+    cache->count++;
+}
+
+
 static inline void jf_disk_open(jf_file_cache *cache)
 {
-    assert((cache->header = fopen(cache->header_path, "w+")) != NULL);
-    assert((cache->body = fopen(cache->body_path, "w+")) != NULL);
+    jf_disk_map_open(&cache->header);
+    jf_disk_map_open(&cache->body);
     cache->count = 0;
-    // no error checking on these two, nothing to do if they fail
-    // at worst we pollute the temp dir, which is not the end of the world
-    unlink(cache->header_path);
-    unlink(cache->body_path);
+    cache->garbage = 0;
 }
 
 
-static inline void
-jf_disk_align_to(jf_file_cache *cache, const size_t n)
+static inline void jf_disk_clear(jf_file_cache *cache)
 {
-    long body_offset;
-    assert(fseek(cache->header, (long)((n - 1) * sizeof(long)), SEEK_SET) == 0);
-    assert(fread(&body_offset, sizeof(long), 1, cache->header) == 1);
-    assert(fseek(cache->body, body_offset, SEEK_SET) == 0);
+    jf_disk_map_reset(&cache->header);
+    jf_disk_map_reset(&cache->body);
+    cache->count = 0;
+    cache->garbage = 0;
 }
 
 
-static void jf_disk_add_next(jf_file_cache *cache, const jf_menu_item *item)
+// Returns the offset right past the record starting at offset, children
+// included.
+static size_t jf_disk_record_end(const jf_file_cache *cache, const size_t offset)
+{
+    jf_disk_item_view view;
+    size_t end = jf_disk_read_view(cache, offset, &view);
+    size_t i;
+
+    for (i = 0; i < view.children_count; i++) {
+        end = jf_disk_record_end(cache, end);
+    }
+    return end;
+}
+
+
+static size_t jf_disk_record_end_checked(const char *data,
+        const size_t length,
+        size_t offset,
+        const size_t depth)
+{
+    const char *string_end;
+    size_t children_count, i;
+
+    if (depth > JF_DISK_JOURNAL_MAX_DEPTH) return 0;
+
+    // type and id, which is always \0-terminated
+    if (offset > length || length - offset < sizeof(jf_item_type) + JF_ID_LENGTH + 1) return 0;
+    offset += sizeof(jf_item_type) + JF_ID_LENGTH + 1;
+    if (data[offset - 1] != '\0') return 0;
+
+    // name and path
+    for (i = 0; i < 2; i++) {
+        if ((string_end = memchr(data + offset, '\0', length - offset)) == NULL) return 0;
+        offset = (size_t)(string_end - data) + 1;
+    }
+
+    // ticks and children_count
+    if (length - offset < 2 * sizeof(long long) + sizeof(size_t)) return 0;
+    offset += 2 * sizeof(long long);
+    memcpy(&children_count, data + offset, sizeof(size_t));
+    offset += sizeof(size_t);
+
+    if (children_count > (length - offset) / JF_DISK_RECORD_MIN_SIZE) return 0;
+    for (i = 0; i < children_count; i++) {
+        if ((offset = jf_disk_record_end_checked(data, length, offset, depth + 1)) == 0) {
+            return 0;
+        }
+    }
+    return offset;
+}
+
+
+// Rewrites the body keeping only the records referenced by the header, in
+// header order, and points the header at their new locations.
+static void jf_disk_compact(jf_file_cache *cache)
 {
-    size_t name_length, path_length, i;
+    jf_file_cache old = { .body = cache->body };
+    jf_disk_header_record *record;
+    size_t i, length;
+
+    jf_disk_map_open(&cache->body);
+    jf_disk_map_reserve(&cache->body, old.body.used - cache->garbage);
+    for (i = 1; i <= cache->count; i++) {
+        record = jf_disk_header_entry(cache, i);
+        length = jf_disk_record_end(&old, record->offset) - record->offset;
+        jf_disk_map_append(&cache->body, old.body.addr + record->offset, length);
+        record->offset = cache->body.used - length;
+    }
+    cache->garbage = 0;
+
+    assert(munmap(old.body.addr, old.body.size) == 0);
+    close(old.body.fd);
+}
+
 
-    assert(fwrite(&(item->type), sizeof(jf_item_type), 1, cache->body) == 1);
-    assert(fwrite(item->id, 1, sizeof(item->id), cache->body) == sizeof(item->id));
-    if ((name_length = jf_strlen(item->name)) == 0) {
-        assert(fwrite(&"\0", 1, 1, cache->body) == 1);
+// Serializes a record in one go: the room for it is reserved up front, then
+// all fields are copied in sequence straight into the mapping.
+static void jf_disk_add_record(jf_file_cache *cache,
+        const jf_item_type type,
+        const char *id,
+        const size_t id_len,
+        const char *name,
+        const char *path,
+        const long long runtime_ticks,
+        const long long playback_ticks,
+        const size_t children_count)
+{
+    size_t name_length = jf_strlen(name);
+    size_t path_length = jf_strlen(path);
+    char *cursor;
+
+    // empty strings still take their \0
+    if (name_length == 0) name_length = 1;
+    if (path_length == 0) path_length = 1;
+
+    jf_disk_map_reserve(&cache->body, sizeof(jf_item_type)
+            + JF_ID_LENGTH + 1
+            + name_length
+            + path_length
+            + 2 * sizeof(long long)
+            + sizeof(size_t));
+    cursor = cache->body.addr + cache->body.used;
+
+    memcpy(cursor, &type, sizeof(jf_item_type));
+    cursor += sizeof(jf_item_type);
+    memset(cursor, 0, JF_ID_LENGTH + 1);
+    memcpy(cursor, id, id_len < JF_ID_LENGTH ? id_len : JF_ID_LENGTH);
+    cursor += JF_ID_LENGTH + 1;
+    if (name == NULL) {
+        *cursor = '\0';
     } else {
-        assert(fwrite(item->name, 1, name_length, cache->body) == name_length);
+        memcpy(cursor, name, name_length);
     }
-    if ((path_length = jf_strlen(item->path)) == 0) {
-        assert(fwrite(&"\0", 1, 1, cache->body) == 1);
+    cursor += name_length;
+    if (path == NULL) {
+        *cursor = '\0';
     } else {
-        assert(fwrite(item->path, 1, path_length, cache->body) == path_length);
+        memcpy(cursor, path, path_length);
     }
-    assert(fwrite(&(item->runtime_ticks), sizeof(long long), 1, cache->body) == 1);
-    assert(fwrite(&(item->playback_ticks), sizeof(long long), 1, cache->body) == 1);
-    assert(fwrite(&(item->children_count), sizeof(size_t), 1, cache->body) == 1);
+    cursor += path_length;
+    memcpy(cursor, &runtime_ticks, sizeof(long long));
+    cursor += sizeof(long long);
+    memcpy(cursor, &playback_ticks, sizeof(long long));
+    cursor += sizeof(long long);
+    memcpy(cursor, &children_count, sizeof(size_t));
+    cursor += sizeof(size_t);
+
+    cache->body.used = (size_t)(cursor - cache->body.addr);
+}
+
+
+static void jf_disk_add_next(jf_file_cache *cache, const jf_menu_item *item)
+{
+    size_t i;
+
+    jf_disk_add_record(cache,
+            item->type,
+            item->id,
+            JF_ID_LENGTH,
+            item->name,
+            item->path,
+            item->runtime_ticks,
+            item->playback_ticks,
+            item->children_count);
     for (i = 0; i < item->children_count; i++) {
         jf_disk_add_next(cache, item->children[i]);
     }
@@ -84,79 +459,84 @@ static void jf_disk_add_next(jf_file_cache *cache, const jf_menu_item *item)
 
 static void jf_disk_add_item(jf_file_cache *cache, const jf_menu_item *item)
 {
-    long starting_body_offset;
-
     assert(item != NULL);
 
-    assert(fseek(cache->header, 0, SEEK_END) == 0);
-    assert(fseek(cache->body, 0, SEEK_END) == 0);
-    assert((starting_body_offset = ftell(cache->body)) != -1);
-    assert(fwrite(&starting_body_offset, sizeof(long), 1, cache->header) == 1);
-
+    jf_disk_add_header_record(cache, item->type);
     jf_disk_add_next(cache, item);
-    cache->count++;
 }
 
 
-static jf_menu_item *jf_disk_get_next(jf_file_cache *cache)
+static size_t jf_disk_read_view(const jf_file_cache *cache,
+        const size_t offset,
+        jf_disk_item_view *view)
 {
-    jf_menu_item tmp_item, *item;
-    size_t path_offset, i;
-    jf_growing_buffer buffer = jf_growing_buffer_new(256);
+    const char *record = cache->body.addr + offset;
+
+    memcpy(&(view->type), record, sizeof(jf_item_type));
+    record += sizeof(jf_item_type);
+    view->id = record;
+    record += JF_ID_LENGTH + 1;
+    view->name = *record == '\0' ? NULL : record;
+    record += strlen(record) + 1;
+    view->path = *record == '\0' ? NULL : record;
+    record += strlen(record) + 1;
+    memcpy(&(view->runtime_ticks), record, sizeof(long long));
+    record += sizeof(long long);
+    memcpy(&(view->playback_ticks), record, sizeof(long long));
+    record += sizeof(long long);
+    memcpy(&(view->children_count), record, sizeof(size_t));
+    record += sizeof(size_t);
+
+    return (size_t)(record - cache->body.addr);
+}
 
-    assert(fread(&(tmp_item.type), sizeof(jf_item_type), 1, cache->body) == 1);
-    assert(fread(tmp_item.id, 1, sizeof(tmp_item.id), cache->body) == sizeof(tmp_item.id));
-    jf_disk_read_to_null_to_buffer(buffer, cache);
-    tmp_item.name = buffer->buf[0] == '\0' ? NULL : buffer->buf;
-    path_offset = buffer->used;
-    jf_disk_read_to_null_to_buffer(buffer, cache);
-    tmp_item.path = buffer->buf[path_offset] == '\0' ? NULL : (buffer->buf + path_offset);
-    assert(fread(&(tmp_item.runtime_ticks), sizeof(long long), 1, cache->body) == 1);
-    assert(fread(&(tmp_item.playback_ticks), sizeof(long long), 1, cache->body) == 1);
-    assert(fread(&(tmp_item.children_count), sizeof(size_t), 1, cache->body) == 1);
-    if (tmp_item.children_count > 0) {
-        assert((tmp_item.children = malloc(tmp_item.children_count * sizeof(jf_menu_item *))) != NULL);
-        for (i = 0; i < tmp_item.children_count; i++) {
-            tmp_item.children[i] = jf_disk_get_next(cache);
-        }
-    } else {
-        tmp_item.children = NULL;
-    }
 
-    item = jf_menu_item_new(tmp_item.type,
-            tmp_item.children,
-            tmp_item.children_count,
-            tmp_item.id,
-            tmp_item.name,
-            tmp_item.path,
-            tmp_item.runtime_ticks,
-            tmp_item.playback_ticks);
-    
-    jf_growing_buffer_free(buffer);
+static bool jf_disk_get_view(const jf_file_cache *cache,
+        const size_t n,
+        jf_disk_item_view *view)
+{
+    if (n == 0 || n > cache->count) return false;
 
-    return item;
+    jf_disk_read_view(cache, jf_disk_header_entry(cache, n)->offset, view);
+    return true;
 }
 
 
-static jf_menu_item *jf_disk_get_item(jf_file_cache *cache, const size_t n)
+static jf_menu_item *jf_disk_get_next(const jf_file_cache *cache,
+        size_t *offset)
 {
-    if (n == 0 || n > cache->count) return NULL;
+    jf_disk_item_view view;
+    jf_menu_item **children = NULL;
+    size_t i;
+
+    *offset = jf_disk_read_view(cache, *offset, &view);
+    if (view.children_count > 0) {
+        assert((children = malloc(view.children_count * sizeof(jf_menu_item *))) != NULL);
+        for (i = 0; i < view.children_count; i++) {
+            children[i] = jf_disk_get_next(cache, offset);
+        }
+    }
 
-    jf_disk_align_to(cache, n);
-    return jf_disk_get_next(cache);
+    return jf_menu_item_new(view.type,
+            children,
+            view.children_count,
+            view.id,
+            view.name,
+            view.path,
+            view.runtime_ticks,
+            view.playback_ticks);
 }
 
 
-static void jf_disk_read_to_null_to_buffer(jf_growing_buffer buffer,
-        jf_file_cache *cache)
+static jf_menu_item *jf_disk_get_item(const jf_file_cache *cache,
+        const size_t n)
 {
-    char tmp;
+    size_t offset;
 
-    while (true) {
-        assert(fread(&tmp, 1, 1, cache->body) == 1);
-        jf_growing_buffer_append(buffer, &tmp, 1);
-        if (tmp == '\0') break;
-    }
+    if (n == 0 || n > cache->count) return NULL;
+
+    offset = jf_disk_header_entry(cache, n)->offset;
+    return jf_disk_get_next(cache, &offset);
 }
 
 
@@ -180,12 +560,10 @@ void jf_disk_init(void)
     sprintf(s_file_prefix, "%s/jftui_%d_%s", tmp_dir, getpid(), rand_id);
     free(rand_id);
 
-    s_buffer = jf_growing_buffer_new(512);
-
-    assert((s_payload.header_path = jf_concat(2, s_file_prefix, "_s_payload_header")) != NULL);
-    assert((s_payload.body_path = jf_concat(2, s_file_prefix, "_s_payload_body")) != NULL);
-    assert((s_playlist.header_path = jf_concat(2, s_file_prefix, "_s_playlist_header")) != NULL);
-    assert((s_playlist.body_path = jf_concat(2, s_file_prefix, "_s_playlist_body")) != NULL);
+    assert((s_payload.header.path = jf_concat(2, s_file_prefix, "_s_payload_header")) != NULL);
+    assert((s_payload.body.path = jf_concat(2, s_file_prefix, "_s_payload_body")) != NULL);
+    assert((s_playlist.header.path = jf_concat(2, s_file_prefix, "_s_playlist_header")) != NULL);
+    assert((s_playlist.body.path = jf_concat(2, s_file_prefix, "_s_playlist_body")) != NULL);
 
     jf_disk_open(&s_payload);
     jf_disk_open(&s_playlist);
@@ -194,20 +572,31 @@ void jf_disk_init(void)
 
 void jf_disk_refresh(void)
 {
-    assert(fclose(s_payload.header) == 0);
-    assert(fclose(s_payload.body) == 0);
-    jf_disk_open(&s_payload);
-    assert(fclose(s_playlist.header) == 0);
-    assert(fclose(s_playlist.body) == 0);
-    jf_disk_open(&s_playlist);
+    jf_disk_clear(&s_payload);
+    jf_disk_clear(&s_playlist);
+    s_journal_stale = true;
 }
 
 
 ////////// PAYLOAD ///////////
-void jf_disk_payload_add_item(const jf_menu_item *item)
+void jf_disk_payload_add_record(const jf_item_type type,
+        const char *id,
+        const size_t id_len,
+        const char *name,
+        const char *path,
+        const long long runtime_ticks,
+        const long long playback_ticks)
 {
-    if (item == NULL) return;
-    jf_disk_add_item(&s_payload, item);
+    jf_disk_add_header_record(&s_payload, type);
+    jf_disk_add_record(&s_payload,
+            type,
+            id,
+            id_len,
+            name,
+            path,
+            runtime_ticks,
+            playback_ticks,
+            0);
 }
 
 
@@ -219,18 +608,27 @@ jf_menu_item *jf_disk_payload_get_item(const size_t n)
 
 jf_item_type jf_disk_payload_get_type(const size_t n)
 {
-    jf_item_type item_type;
-
     if (n == 0 || n > s_payload.count) {
         return JF_ITEM_TYPE_NONE;
     }
 
-    jf_disk_align_to(&s_payload, n);
-    if (fread(&(item_type), sizeof(jf_item_type), 1, s_payload.body) != 1) {
-        fprintf(stderr, "Warning: jf_payload_get_type: could not read type for item %zu in s_payload.body.\n", n);
-        return JF_ITEM_TYPE_NONE;
+    return jf_disk_header_entry(&s_payload, n)->type;
+}
+
+
+void jf_disk_payload_get_types(const size_t first,
+        const size_t last,
+        jf_item_type *types)
+{
+    size_t i;
+
+    assert(first <= last);
+
+    for (i = first; i <= last; i++) {
+        *types++ = i == 0 || i > s_payload.count ?
+            JF_ITEM_TYPE_NONE : jf_disk_header_entry(&s_payload, i)->type;
+        if (i == last) break; // last may well be SIZE_MAX
     }
-    return item_type;
 }
 
 
@@ -238,14 +636,139 @@ size_t jf_disk_payload_item_count(void)
 {
     return s_payload.count;
 }
+
+
+bool jf_disk_payload_get_view(const size_t n, jf_disk_item_view *view)
+{
+    return jf_disk_get_view(&s_payload, n, view);
+}
+
+
+size_t jf_disk_payload_splice_scratch(const jf_file_cache *scratch)
+{
+    const jf_disk_header_record *record;
+    size_t base = s_payload.body.used;
+    size_t i;
+
+    if (scratch == NULL || scratch->count == 0) return 0;
+
+    jf_disk_map_reserve(&s_payload.header, scratch->count * sizeof(jf_disk_header_record));
+    for (i = 1; i <= scratch->count; i++) {
+        record = jf_disk_header_entry(scratch, i);
+        jf_disk_map_append(&s_payload.header,
+                &(jf_disk_header_record){
+                    .offset = base + record->offset,
+                    .type = record->type
+                },
+                sizeof(jf_disk_header_record));
+    }
+    s_payload.count += scratch->count;
+    jf_disk_map_append(&s_payload.body, scratch->body.addr, scratch->body.used);
+
+    return scratch->count;
+}
+//////////////////////////////
+
+
+////////// SCRATCH ///////////
+jf_file_cache *jf_disk_scratch_new(void)
+{
+    jf_file_cache *scratch;
+    char serial[24];
+
+    assert((scratch = malloc(sizeof(jf_file_cache))) != NULL);
+    snprintf(serial, sizeof(serial), "%zu",
+            __atomic_fetch_add(&s_scratch_serial, 1, __ATOMIC_RELAXED));
+    assert((scratch->header.path = jf_concat(4,
+                    s_file_prefix, "_scratch_", serial, "_header")) != NULL);
+    assert((scratch->body.path = jf_concat(4,
+                    s_file_prefix, "_scratch_", serial, "_body")) != NULL);
+    jf_disk_open(scratch);
+    return scratch;
+}
+
+
+void jf_disk_scratch_free(jf_file_cache *scratch)
+{
+    if (scratch == NULL) return;
+    jf_disk_map_close(&scratch->header);
+    jf_disk_map_close(&scratch->body);
+    free(scratch);
+}
+
+
+void jf_disk_scratch_clear(jf_file_cache *scratch)
+{
+    jf_disk_clear(scratch);
+}
+
+
+void jf_disk_scratch_add_record(jf_file_cache *scratch,
+        const jf_item_type type,
+        const char *id,
+        const size_t id_len,
+        const char *name,
+        const char *path,
+        const long long runtime_ticks,
+        const long long playback_ticks)
+{
+    jf_disk_add_header_record(scratch, type);
+    jf_disk_add_record(scratch,
+            type,
+            id,
+            id_len,
+            name,
+            path,
+            runtime_ticks,
+            playback_ticks,
+            0);
+}
 //////////////////////////////
 
 
 ////////// PLAYLIST ///////////
 void jf_disk_playlist_add_item(const jf_menu_item *item)
 {
+    size_t offset = s_playlist.body.used;
+
     if (item == NULL || JF_ITEM_TYPE_IS_FOLDER(item->type)) return;
     jf_disk_add_item(&s_playlist, item);
+    jf_disk_journal_record(JF_DISK_JOURNAL_ADD, 0, offset);
+}
+
+
+size_t jf_disk_playlist_splice(const size_t first, const size_t last)
+{
+    const jf_disk_header_record *record;
+    size_t start, end, base, n, i;
+
+    // find where the run of atoms starting at first ends
+    for (n = first; n > 0 && n <= last && n <= s_payload.count; n++) {
+        if (JF_ITEM_TYPE_IS_FOLDER(jf_disk_header_entry(&s_payload, n)->type)) break;
+    }
+    if (n == first) return 0;
+
+    // the payload is append-only, so the records of the run are contiguous
+    start = jf_disk_header_entry(&s_payload, first)->offset;
+    end = n > s_payload.count ? s_payload.body.used
+        : jf_disk_header_entry(&s_payload, n)->offset;
+    base = s_playlist.body.used;
+
+    jf_disk_map_reserve(&s_playlist.header, (n - first) * sizeof(jf_disk_header_record));
+    for (i = first; i < n; i++) {
+        record = jf_disk_header_entry(&s_payload, i);
+        jf_disk_map_append(&s_playlist.header,
+                &(jf_disk_header_record){
+                    .offset = base + record->offset - start,
+                    .type = record->type
+                },
+                sizeof(jf_disk_header_record));
+    }
+    s_playlist.count += n - first;
+    jf_disk_map_append(&s_playlist.body, s_payload.body.addr + start, end - start);
+    jf_disk_journal_record(JF_DISK_JOURNAL_ADD, 0, base);
+
+    return n - first;
 }
 
 
@@ -261,55 +784,54 @@ const char *jf_disk_playlist_get_item_name(const size_t n)
         return "Warning: requesting item out of bounds. This is a bug.";
     }
 
-    jf_disk_align_to(&s_playlist, n);
-    assert(fseek(s_playlist.body,
+    return s_playlist.body.addr + jf_disk_header_entry(&s_playlist, n)->offset
         // let him who hath understanding reckon the number of the beast!
-        sizeof(jf_item_type) + sizeof(((jf_menu_item *)666)->id),
-        SEEK_CUR) == 0);
-
-    jf_growing_buffer_empty(s_buffer);
-    jf_disk_read_to_null_to_buffer(s_buffer, &s_playlist);
-
-    return (const char *)s_buffer->buf;
+        + sizeof(jf_item_type) + sizeof(((jf_menu_item *)666)->id);
 }
 
 
 void jf_disk_playlist_swap_items(const size_t a, const size_t b)
 {
-    long old_a_value;
-    long old_b_value;
+    jf_disk_header_record old_a_value;
 
-    if (a > s_playlist.count || b > s_playlist.count || a == b) return;
+    if (a == 0 || b == 0 || a > s_playlist.count || b > s_playlist.count || a == b) return;
 
-    // read offset a
-    assert(fseek(s_playlist.header, (long)((a - 1) * sizeof(long)), SEEK_SET) == 0);
-    assert(fread(&old_a_value, sizeof(long), 1, s_playlist.header) == 1);
-    // read offset b
-    assert(fseek(s_playlist.header, (long)((b - 1) * sizeof(long)), SEEK_SET) == 0);
-    assert(fread(&old_b_value, sizeof(long), 1, s_playlist.header) == 1);
-    // overwrite b
-    assert(fseek(s_playlist.header, (long)((b - 1) * sizeof(long)), SEEK_SET) == 0);
-    assert(fwrite(&old_a_value, sizeof(long), 1, s_playlist.header) == 1);
-    // overwrite a
-    assert(fseek(s_playlist.header, (long)((a - 1) * sizeof(long)), SEEK_SET) == 0);
-    assert(fwrite(&old_b_value, sizeof(long), 1, s_playlist.header) == 1);
+    old_a_value = *jf_disk_header_entry(&s_playlist, a);
+    *jf_disk_header_entry(&s_playlist, a) = *jf_disk_header_entry(&s_playlist, b);
+    *jf_disk_header_entry(&s_playlist, b) = old_a_value;
+
+    jf_disk_journal_append(JF_DISK_JOURNAL_SWAP,
+            (struct iovec[]){
+                { .iov_base = (void *)&a, .iov_len = sizeof(size_t) },
+                { .iov_base = (void *)&b, .iov_len = sizeof(size_t) }
+            },
+            2);
+    jf_disk_journal_maybe_rewrite();
 }
 
 
 void jf_disk_playlist_replace_item(const size_t n, const jf_menu_item *item)
 {
-    long starting_body_offset;
+    jf_disk_header_record *record;
 
     assert(item != NULL);
+    assert(n > 0 && n <= s_playlist.count);
 
-    // overwrite old offset in header
-    assert(fseek(s_playlist.header, (long)((n - 1) * sizeof(long)), SEEK_SET) == 0);
-    assert(fseek(s_playlist.body, 0, SEEK_END) == 0);
-    assert((starting_body_offset = ftell(s_playlist.body)) != -1);
-    assert(fwrite(&starting_body_offset, sizeof(long), 1, s_playlist.header) == 1);
+    // the old record becomes garbage
+    record = jf_disk_header_entry(&s_playlist, n);
+    s_playlist.garbage += jf_disk_record_end(&s_playlist, record->offset) - record->offset;
 
-    // add replacement to tail
+    // overwrite old header record and add replacement to tail
+    record->offset = s_playlist.body.used;
+    record->type = item->type;
     jf_disk_add_next(&s_playlist, item);
+    jf_disk_journal_record(JF_DISK_JOURNAL_REPLACE, n, record->offset);
+
+    if (s_playlist.garbage >= JF_DISK_COMPACT_MIN_GARBAGE
+            && s_playlist.garbage >= s_playlist.body.used / 2) {
+        jf_disk_compact(&s_playlist);
+    }
+    jf_disk_journal_maybe_rewrite();
 }
 
 
@@ -317,9 +839,305 @@ size_t jf_disk_playlist_item_count(void)
 {
     return s_playlist.count;
 }
+
+
+void jf_disk_playlist_save_position(const size_t position)
+{
+    s_journal_position = position;
+    jf_disk_journal_append(JF_DISK_JOURNAL_POSITION,
+            &(struct iovec){ .iov_base = (void *)&position, .iov_len = sizeof(size_t) },
+            1);
+    jf_disk_journal_maybe_rewrite();
+}
 ///////////////////////////////
 
 
+////////// PLAYLIST JOURNAL //////////
+static void jf_disk_journal_close(void)
+{
+    close(s_journal_fd);
+    s_journal_fd = -1;
+}
+
+
+static void jf_disk_journal_append(const jf_disk_journal_op op,
+        const struct iovec *payload,
+        const int payload_count)
+{
+    struct iovec iov[4];
+    uint8_t op_byte = (uint8_t)op;
+    size_t length = 0;
+    ssize_t ret;
+    int i;
+
+    if (s_journal_fd == -1) return;
+
+    assert(payload_count <= 2);
+
+    if (s_journal_stale) {
+        // the playlist was cleared since the last entry: this is a new one
+        if (ftruncate(s_journal_fd, 0) == -1) {
+            fprintf(stderr,
+                    "Warning: could not truncate playlist journal: %s. The playlist won't be saved.\n",
+                    strerror(errno));
+            jf_disk_journal_close();
+            return;
+        }
+        s_journal_stale = false;
+        s_journal_size = 0;
+    }
+
+    iov[0] = (struct iovec){ .iov_base = &op_byte, .iov_len = 1 };
+    iov[1] = (struct iovec){ .iov_base = &length, .iov_len = sizeof(size_t) };
+    for (i = 0; i < payload_count; i++) {
+        iov[i + 2] = payload[i];
+        length += payload[i].iov_len;
+    }
+
+    // one writev per entry: on O_APPEND this never interleaves, and a crash
+    // can at worst cut the entry short, which the replay takes care of
+    while ((ret = writev(s_journal_fd, iov, payload_count + 2)) == -1
+            && errno == EINTR);
+    if (ret != (ssize_t)(1 + sizeof(size_t) + length)) {
+        fprintf(stderr,
+                "Warning: could not write to playlist journal: %s. The playlist won't be saved.\n",
+                ret == -1 ? strerror(errno) : "short write");
+        jf_disk_journal_close();
+        return;
+    }
+    s_journal_size += (size_t)ret;
+}
+
+
+// Journals the record that starts at offset in the playlist body and runs to
+// its end, i.e. the one that was just appended.
+static inline void jf_disk_journal_record(const jf_disk_journal_op op,
+        const size_t index,
+        const size_t offset)
+{
+    struct iovec payload[2] = {
+        { .iov_base = (void *)&index, .iov_len = sizeof(size_t) },
+        { .iov_base = s_playlist.body.addr + offset,
+            .iov_len = s_playlist.body.used - offset }
+    };
+
+    if (op == JF_DISK_JOURNAL_REPLACE) {
+        jf_disk_journal_append(op, payload, 2);
+    } else {
+        jf_disk_journal_append(op, payload + 1, 1);
+    }
+}
+
+
+static bool jf_disk_journal_replay_add(const char *data, const size_t length)
+{
+    jf_item_type type;
+    size_t offset = 0;
+    size_t end;
+
+    while (offset < length) {
+        if ((end = jf_disk_record_end_checked(data, length, offset, 0)) == 0) return false;
+        memcpy(&type, data + offset, sizeof(jf_item_type));
+        jf_disk_add_header_record(&s_playlist, type);
+        jf_disk_map_append(&s_playlist.body, data + offset, end - offset);
+        offset = end;
+    }
+    return true;
+}
+
+
+static bool jf_disk_journal_replay_entry(const jf_disk_journal_op op,
+        const char *data,
+        const size_t length,
+        size_t *position)
+{
+    jf_disk_header_record *record;
+    size_t indexes[2];
+
+    switch (op) {
+        case JF_DISK_JOURNAL_ADD:
+            return jf_disk_journal_replay_add(data, length);
+        case JF_DISK_JOURNAL_REPLACE:
+            if (length <= sizeof(size_t)) return false;
+            memcpy(indexes, data, sizeof(size_t));
+            if (indexes[0] == 0 || indexes[0] > s_playlist.count) return false;
+            if (jf_disk_record_end_checked(data + sizeof(size_t),
+                        length - sizeof(size_t),
+                        0,
+                        0) != length - sizeof(size_t)) {
+                return false;
+            }
+            // same as jf_disk_playlist_replace_item, garbage is dropped later
+            record = jf_disk_header_entry(&s_playlist, indexes[0]);
+            s_playlist.garbage += jf_disk_record_end(&s_playlist, record->offset) - record->offset;
+            record->offset = s_playlist.body.used;
+            memcpy(&(record->type), data + sizeof(size_t), sizeof(jf_item_type));
+            jf_disk_map_append(&s_playlist.body,
+                    data + sizeof(size_t),
+                    length - sizeof(size_t));
+            return true;
+        case JF_DISK_JOURNAL_SWAP:
+            if (length != 2 * sizeof(size_t)) return false;
+            memcpy(indexes, data, 2 * sizeof(size_t));
+            jf_disk_playlist_swap_items(indexes[0], indexes[1]);
+            return true;
+        case JF_DISK_JOURNAL_POSITION:
+            if (length != sizeof(size_t)) return false;
+            memcpy(position, data, sizeof(size_t));
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+// Returns the whole content of the file at path, NULL if there is none.
+static char *jf_disk_journal_read(const char *path, size_t *size)
+{
+    struct stat st;
+    char *buffer;
+    size_t done = 0;
+    ssize_t ret;
+    int fd;
+
+    *size = 0;
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        if (errno != ENOENT) {
+            fprintf(stderr,
+                    "Warning: could not open playlist journal (%s): %s.\n",
+                    path,
+                    strerror(errno));
+        }
+        return NULL;
+    }
+    assert(fstat(fd, &st) == 0);
+    assert((buffer = malloc((size_t)st.st_size + 1)) != NULL);
+    while (done < (size_t)st.st_size) {
+        ret = read(fd, buffer + done, (size_t)st.st_size - done);
+        if (ret == -1 && errno == EINTR) continue;
+        if (ret <= 0) break;
+        done += (size_t)ret;
+    }
+    close(fd);
+    // keeps a corrupted name or path from running off the end
+    buffer[done] = '\0';
+    *size = done;
+    return buffer;
+}
+
+
+// The playlist goes into a fresh journal that atomically takes the place of
+// the old one and stays open for appending.
+static void jf_disk_journal_rewrite(void)
+{
+    char *path, *tmp_path;
+
+    assert((path = jf_concat(2, g_state.config_dir, "/playlist")) != NULL);
+    assert((tmp_path = jf_concat(2, g_state.config_dir, "/playlist.tmp")) != NULL);
+
+    if (s_journal_fd != -1) {
+        jf_disk_journal_close();
+    }
+    if (s_playlist.garbage > 0) {
+        jf_disk_compact(&s_playlist);
+    }
+    if ((s_journal_fd = open(tmp_path,
+                    O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                    S_IRUSR | S_IWUSR)) == -1) {
+        fprintf(stderr,
+                "Warning: could not open playlist journal (%s): %s. The playlist won't be saved.\n",
+                tmp_path,
+                strerror(errno));
+    } else {
+        s_journal_stale = false;
+        s_journal_size = 0;
+        if (s_playlist.count > 0) {
+            jf_disk_journal_record(JF_DISK_JOURNAL_ADD, 0, 0);
+            jf_disk_journal_append(JF_DISK_JOURNAL_POSITION,
+                    &(struct iovec){ .iov_base = (void *)&s_journal_position, .iov_len = sizeof(size_t) },
+                    1);
+        }
+        if (s_journal_fd != -1
+                && (fsync(s_journal_fd) == -1 || rename(tmp_path, path) == -1)) {
+            fprintf(stderr,
+                    "Warning: could not replace playlist journal (%s): %s. The playlist won't be saved.\n",
+                    path,
+                    strerror(errno));
+            jf_disk_journal_close();
+        }
+        if (s_journal_fd == -1) {
+            unlink(tmp_path);
+        }
+    }
+
+    free(path);
+    free(tmp_path);
+}
+
+
+// Once superseded entries make up most of the journal, starts it over.
+static inline void jf_disk_journal_maybe_rewrite(void)
+{
+    // what a rewrite would leave: one ADD with the live records and a POSITION
+    size_t live = s_playlist.body.used - s_playlist.garbage
+        + 2 * (1 + sizeof(size_t)) + sizeof(size_t);
+
+    if (s_journal_fd == -1 || s_journal_size <= live) return;
+    if (s_journal_size - live >= JF_DISK_COMPACT_MIN_GARBAGE
+            && s_journal_size - live >= s_journal_size / 2) {
+        jf_disk_journal_rewrite();
+    }
+}
+
+
+size_t jf_disk_playlist_journal_open(size_t *position)
+{
+    char *path;
+    char *buffer;
+    size_t size, offset, length;
+    uint8_t op;
+
+    assert(position != NULL);
+    *position = 0;
+
+    assert((path = jf_concat(2, g_state.config_dir, "/playlist")) != NULL);
+
+    // REPLAY
+    if ((buffer = jf_disk_journal_read(path, &size)) != NULL) {
+        offset = 0;
+        while (size - offset >= 1 + sizeof(size_t)) {
+            op = (uint8_t)buffer[offset];
+            memcpy(&length, buffer + offset + 1, sizeof(size_t));
+            offset += 1 + sizeof(size_t);
+            if (length > size - offset) break; // cut short by a crash
+            if (! jf_disk_journal_replay_entry((jf_disk_journal_op)op,
+                        buffer + offset,
+                        length,
+                        position)) {
+                fprintf(stderr,
+                        "Warning: playlist journal is corrupted, restoring only its beginning.\n");
+                break;
+            }
+            offset += length;
+        }
+        free(buffer);
+    }
+    if (*position > s_playlist.count) {
+        *position = s_playlist.count;
+    } else if (*position == 0 && s_playlist.count > 0) {
+        *position = 1;
+    }
+
+    // REWRITE
+    s_journal_position = *position;
+    jf_disk_journal_rewrite();
+
+    free(path);
+    return s_playlist.count;
+}
+//////////////////////////////////////
+
+
 ////////// MISC BULLSHIT //////////
 bool jf_disk_is_file_accessible(const char *path)
 {
@@ -8,40 +8,223 @@
 
 
 ////////// CONSTANTS //////////
-#define JF_DISK_BUFFER_SIZE 1024
+// initial size of the mappings backing cache files, they grow geometrically
+#define JF_DISK_MAP_INITIAL_SIZE 65536
+// a cache body is compacted once it has at least this many dead bytes and they
+// make up at least half of it
+#define JF_DISK_COMPACT_MIN_GARBAGE 262144
+// deepest nesting of the items replayed from the playlist journal
+#define JF_DISK_JOURNAL_MAX_DEPTH 8
+// a record with empty name and path, which every serialized item takes at least
+#define JF_DISK_RECORD_MIN_SIZE (sizeof(jf_item_type) + JF_ID_LENGTH + 1 + 2 \
+        + 2 * sizeof(long long) + sizeof(size_t))
 ///////////////////////////////
 
 
 ////////// FILE CACHE //////////
+// A temporary file accessed through a shared memory mapping. The file is
+// unlinked right after creation, so it only lives as long as the mapping.
+// `size` is the length of both the file and the mapping, `used` is the amount
+// of bytes actually written, starting from the beginning.
+// Where available, the file is anonymous memory (memfd) that only spills to
+// an actual file in TMPDIR when it outgrows the cache_memory_mb option.
+typedef struct jf_file_map {
+    int fd;
+    bool in_memory;
+    char *path;
+    char *addr;
+    size_t size;
+    size_t used;
+} jf_file_map;
+
+
+// One per item in the header of a cache. The type is duplicated from the body
+// so that type queries never need to touch the body.
+typedef struct jf_disk_header_record {
+    size_t offset;
+    jf_item_type type;
+} jf_disk_header_record;
+
+
+// The header holds one jf_disk_header_record per item, the body holds the
+// serialized items themselves. Items are 1-indexed.
+// `garbage` counts the body bytes taken by records no longer referenced by the
+// header (e.g. replaced playlist items).
 typedef struct jf_file_cache {
-    FILE *header;
-    char *header_path;
-    FILE *body;
-    char *body_path;
+    jf_file_map header;
+    jf_file_map body;
     size_t count;
+    size_t garbage;
 } jf_file_cache;
 ///////////////////////////////
 
 
+////////// PLAYLIST JOURNAL //////////
+// With the persistent_playlist option, every change to the playlist is also
+// appended to a journal file in the config directory, so that the queue
+// survives quitting (or crashing).
+// Each entry is a one-byte op, followed by a size_t payload length, followed
+// by the payload:
+//  - ADD: one or more serialized items, exactly as in a cache body;
+//  - REPLACE: the size_t index of the item, then the serialized replacement;
+//  - SWAP: the size_t indexes of the two items;
+//  - POSITION: the size_t playlist position.
+// An entry cut short by a crash is ignored on replay, and so is everything
+// from an entry that doesn't make sense on. Once superseded entries (replaced
+// items, old positions) make up most of it, the journal is rewritten from the
+// playlist, with the same threshold as for compacting cache bodies.
+typedef enum jf_disk_journal_op {
+    JF_DISK_JOURNAL_ADD = 1,
+    JF_DISK_JOURNAL_REPLACE = 2,
+    JF_DISK_JOURNAL_SWAP = 3,
+    JF_DISK_JOURNAL_POSITION = 4
+} jf_disk_journal_op;
+//////////////////////////////////////
+
+
+////////// ITEM VIEWS //////////
+// A borrowed, read-only look at an item stored in a cache. All pointers point
+// straight into the memory mapping of the cache: there is nothing to
+// deallocate, but they are only valid until the next write to the same cache.
+// id is \0-terminated; name and path are NULL if empty.
+typedef struct jf_disk_item_view {
+    jf_item_type type;
+    const char *id;
+    const char *name;
+    const char *path;
+    long long runtime_ticks;
+    long long playback_ticks;
+    size_t children_count;
+} jf_disk_item_view;
+////////////////////////////////
+
+
 ////////// FUNCTION STUBS //////////
 void jf_disk_init(void);
 void jf_disk_refresh(void);
 
 
-void jf_disk_payload_add_item(const jf_menu_item *item);
+// Appends a childless item to the payload straight from its fields, without
+// building a jf_menu_item first. Meant for the JSON parser to stream listings
+// to the cache.
+//
+// Parameters:
+//  - id: need not be \0-terminated; only the first id_len characters (at most
+//      JF_ID_LENGTH) are copied.
+//  - name, path: \0-terminated, may be NULL.
+// CAN FATAL.
+void jf_disk_payload_add_record(const jf_item_type type,
+        const char *id,
+        const size_t id_len,
+        const char *name,
+        const char *path,
+        const long long runtime_ticks,
+        const long long playback_ticks);
 jf_menu_item *jf_disk_payload_get_item(const size_t n);
 jf_item_type jf_disk_payload_get_type(const size_t n);
+
+
+// Fills types[0 .. last - first] with the types of payload items first through
+// last, in a single pass over the cache header. Items out of bounds get
+// JF_ITEM_TYPE_NONE.
+// REQUIRES: first <= last, types has room for last - first + 1 entries.
+// CAN'T FAIL.
+void jf_disk_payload_get_types(const size_t first,
+        const size_t last,
+        jf_item_type *types);
 size_t jf_disk_payload_item_count(void);
 
 
+// Fills view with a borrowed look at the n-th item of the payload, without
+// any heap allocation (see jf_disk_item_view for the lifetime).
+//
+// Returns:
+//  - true on success;
+//  - false if n is out of bounds, in which case view is left untouched.
+// CAN'T FAIL.
+bool jf_disk_payload_get_view(const size_t n, jf_disk_item_view *view);
+
+
+// Appends all the items of a scratch cache to the payload, copying the body
+// over with a single memcpy and rebasing the header records.
+//
+// Returns:
+//  the number of items appended.
+// CAN FATAL.
+size_t jf_disk_payload_splice_scratch(const jf_file_cache *scratch);
+
+
+// Scratch caches hold listings parsed in the background, away from the
+// payload, until they're spliced into it. Unlike the payload and the
+// playlist, they may be created, filled and freed on any thread, as long as
+// each is only touched by one at a time.
+// CAN FATAL.
+jf_file_cache *jf_disk_scratch_new(void);
+void jf_disk_scratch_free(jf_file_cache *scratch);
+void jf_disk_scratch_clear(jf_file_cache *scratch);
+
+
+// Same as jf_disk_payload_add_record, into a scratch cache.
+// CAN FATAL.
+void jf_disk_scratch_add_record(jf_file_cache *scratch,
+        const jf_item_type type,
+        const char *id,
+        const size_t id_len,
+        const char *name,
+        const char *path,
+        const long long runtime_ticks,
+        const long long playback_ticks);
+
+
 void jf_disk_playlist_add_item(const jf_menu_item *item);
+
+
+// Appends to the playlist the run of atoms among payload items first through
+// last that starts at first, stopping at the first folder. The records are
+// copied over verbatim with a single memcpy between the two mappings and only
+// the playlist header is built item by item: nothing gets deserialized.
+//
+// Returns:
+//  the number of items appended, 0 if first is a folder or out of bounds.
+// CAN FATAL.
+size_t jf_disk_playlist_splice(const size_t first, const size_t last);
 void jf_disk_playlist_replace_item(const size_t n, const jf_menu_item *item);
 void jf_disk_playlist_swap_items(const size_t a, const size_t b);
 jf_menu_item *jf_disk_playlist_get_item(const size_t n);
+
+
+// Returns a pointer to the name of the n-th playlist item. It points straight
+// into the memory mapping of the playlist, so it is only valid until the next
+// write to the playlist.
+// CAN'T FAIL.
 const char *jf_disk_playlist_get_item_name(const size_t n);
 size_t jf_disk_playlist_item_count(void);
 
 
+// Reads the playlist journal in the config directory in one go and replays
+// it into the (empty) playlist, then rewrites it compacted and keeps it open
+// to record all further playlist changes. Until this is called, the playlist
+// is not journaled at all.
+// A journal that can't be read or written only gets a warning.
+//
+// Parameters:
+//  - position: filled with the last playlist position recorded in the
+//      journal, clamped to the restored item count.
+//
+// Returns:
+//  the number of items restored into the playlist.
+// CAN FATAL.
+size_t jf_disk_playlist_journal_open(size_t *position);
+
+
+// Records the playlist position to the journal, if open. Clearing the playlist
+// doesn't discard the journal right away: it is only started over by the first
+// change to the next playlist, so that the last one is still there at the next
+// startup.
+// CAN'T FAIL.
+void jf_disk_playlist_save_position(const size_t position);
+
+
 bool jf_disk_is_file_accessible(const char *path);
 ////////////////////////////////////
 #endif
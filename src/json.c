@@ -9,6 +9,10 @@
 #include <string.h>
 #include <pthread.h>
 #include <assert.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <yajl/yajl_parse.h>
 #include <yajl/yajl_tree.h>
 #include <yajl/yajl_gen.h>
@@ -26,6 +30,32 @@ static char s_error_buffer[JF_PARSER_ERROR_BUFFER_SIZE];
 
 
 ////////// STATIC FUNCTIONS //////////
+static inline bool jf_sax_prescan_is_special(const char c,
+        const bool in_string,
+        const bool skipping);
+
+// Returns the index of the first byte from i on that the pre-scanner must look
+// at, or len if none: quotes and backslashes in a string; quotes and brackets
+// outside, plus commas and colons unless skipping.
+static inline size_t jf_sax_prescan_find(const char *data,
+        size_t i,
+        const size_t len,
+        const bool in_string,
+        const bool skipping);
+
+static inline bool jf_sax_prescan_in_map(const jf_sax_prescan *p);
+static inline bool jf_sax_prescan_is_droppable(const jf_sax_prescan *p);
+static inline void jf_sax_prescan_key_append(jf_sax_prescan *p,
+        const char *bytes,
+        const size_t length);
+
+// Drops the ignorable subtrees from a chunk, in place.
+//
+// Returns:
+//  the length of what is left of the chunk.
+// CAN'T FAIL.
+static size_t jf_sax_prescan_chunk(jf_sax_prescan *p, char *data, const size_t len);
+
 static int jf_sax_items_start_map(void *ctx);
 static int jf_sax_items_end_map(void *ctx);
 static int jf_sax_items_map_key(void *ctx, const unsigned char *key, size_t key_len);
@@ -34,6 +64,20 @@ static int jf_sax_items_end_array(void *ctx);
 static int jf_sax_items_string(void *ctx, const unsigned char *string, size_t strins_len);
 static int jf_sax_items_number(void *ctx, const char *string, size_t strins_len);
 
+// Keys and type strings are told apart by a switch on their length, then on a
+// byte that sets them apart, and confirmed with a single memcmp: most keys of
+// an item are of no interest and get turned down after a comparison or two.
+//
+// Returns:
+//  - the state to parse the value of an item map key in, or
+//      JF_SAX_NO_STATE if it is to be ignored;
+//  - the item type matching a Type or CollectionType string, or
+//      JF_ITEM_TYPE_NONE if unknown.
+// CAN'T FAIL.
+static jf_sax_parser_state jf_sax_item_key_state(const unsigned char *key, const size_t key_len);
+static jf_item_type jf_sax_item_type_from_string(const unsigned char *string, const size_t string_len);
+static jf_item_type jf_sax_collection_type_from_string(const unsigned char *string, const size_t string_len);
+
 // Allocates a new yajl parser instance, registering callbacks and context and
 // setting yajl_allow_multiple_values to let it digest multiple JSON messages
 // in a row.
@@ -51,6 +95,7 @@ static inline bool jf_sax_current_item_is_valid(const jf_sax_context *context);
 static inline void jf_sax_current_item_make_and_print_name(jf_sax_context *context);
 static inline void jf_sax_context_init(jf_sax_context *context, jf_thread_buffer *tb);
 static inline void jf_sax_context_current_item_clear(jf_sax_context *context);
+static inline void jf_sax_context_reset(jf_sax_context *context);
 
 // DO NOT USE THIS! Call the macro with the same name sans leading __
 static inline yajl_val __jf_yajl_tree_get_assert(const int lineno,
@@ -58,7 +103,437 @@ static inline yajl_val __jf_yajl_tree_get_assert(const int lineno,
         const char **path,
         yajl_type type);
 
-static jf_menu_item *jf_json_parse_versions(const jf_menu_item *item, const yajl_val media_sources);
+static int jf_sax_video_start_map(void *ctx);
+static int jf_sax_video_end_map(void *ctx);
+static int jf_sax_video_map_key(void *ctx, const unsigned char *key, size_t key_len);
+static int jf_sax_video_start_array(void *ctx);
+static int jf_sax_video_end_array(void *ctx);
+static int jf_sax_video_null(void *ctx);
+static int jf_sax_video_boolean(void *ctx, int bool_val);
+static int jf_sax_video_string(void *ctx, const unsigned char *string, size_t string_len);
+static int jf_sax_video_number(void *ctx, const char *string, size_t string_len);
+
+// Returns:
+//  the map state a value state goes back to once the value is parsed, or the
+//  state itself if it is not a value state.
+// CAN'T FAIL.
+static inline jf_sax_video_state jf_sax_video_state_after_value(const jf_sax_video_state state);
+
+// Starts ignoring a map or array that is of no interest, to go back to the
+// state it was found in (or the map holding it, for a value state) after.
+// CAN'T FAIL.
+static inline void jf_sax_video_ignore(jf_sax_video_context *context, const bool is_map);
+
+// Appends a \0-terminated copy of the string to the strings of the context.
+//
+// Returns:
+//  the offset of the copy.
+// CAN FATAL.
+static inline size_t jf_sax_video_store(jf_sax_video_context *context,
+        const void *string,
+        const size_t string_len);
+
+// Feeds the whole of a payload to a new parser.
+// Parse errors are fatal.
+// CAN FATAL.
+static void jf_sax_video_parse(jf_sax_video_context *context,
+        const char *payload,
+        const size_t payload_size);
+
+static inline const char *jf_sax_video_string_assert(const jf_sax_video_context *context,
+        const size_t offset,
+        const char *name);
+
+static jf_menu_item *jf_json_parse_versions(const jf_menu_item *item,
+        const jf_sax_video_context *context,
+        const size_t part);
+//////////////////////////////////////
+
+
+////////// SAX PRE-SCANNER //////////
+#ifndef __SSE2__
+#define JF_SAX_SWAR_ONES 0x0101010101010101ULL
+#define JF_SAX_SWAR_HIGHS 0x8080808080808080ULL
+// high bit set in every byte of x equal to c (and maybe in some past the
+// first one that is, but never before it)
+#define JF_SAX_SWAR_EQ(x, c)                            \
+    ((((x) ^ (JF_SAX_SWAR_ONES * (c))) - JF_SAX_SWAR_ONES)  \
+     & ~((x) ^ (JF_SAX_SWAR_ONES * (c)))                \
+     & JF_SAX_SWAR_HIGHS)
+#endif
+
+
+static inline bool jf_sax_prescan_is_special(const char c,
+        const bool in_string,
+        const bool skipping)
+{
+    if (in_string) return c == '"' || c == '\\';
+    switch (c) {
+        case '"':
+        case '{':
+        case '}':
+        case '[':
+        case ']':
+            return true;
+        case ',':
+        case ':':
+            return ! skipping;
+        default:
+            return false;
+    }
+}
+
+
+static inline size_t jf_sax_prescan_find(const char *data,
+        size_t i,
+        const size_t len,
+        const bool in_string,
+        const bool skipping)
+{
+#ifdef __SSE2__
+    // '[' and '{', ']' and '}' only differ by 0x20
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i open = _mm_set1_epi8('{');
+    const __m128i close = _mm_set1_epi8('}');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i fold = _mm_set1_epi8(0x20);
+    __m128i v, folded, hits;
+    int mask;
+
+    for (; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((const __m128i *)(data + i));
+        hits = _mm_cmpeq_epi8(v, quote);
+        if (in_string) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, backslash));
+        } else {
+            folded = _mm_or_si128(v, fold);
+            hits = _mm_or_si128(hits, _mm_or_si128(_mm_cmpeq_epi8(folded, open),
+                        _mm_cmpeq_epi8(folded, close)));
+            if (! skipping) {
+                hits = _mm_or_si128(hits, _mm_or_si128(_mm_cmpeq_epi8(v, comma),
+                            _mm_cmpeq_epi8(v, colon)));
+            }
+        }
+        if ((mask = _mm_movemask_epi8(hits)) != 0) {
+            return i + (size_t)__builtin_ctz((unsigned)mask);
+        }
+    }
+#else
+    uint64_t x, folded, hits;
+
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&x, data + i, 8);
+        hits = JF_SAX_SWAR_EQ(x, '"');
+        if (in_string) {
+            hits |= JF_SAX_SWAR_EQ(x, '\\');
+        } else {
+            folded = x | (JF_SAX_SWAR_ONES * 0x20);
+            hits |= JF_SAX_SWAR_EQ(folded, '{') | JF_SAX_SWAR_EQ(folded, '}');
+            if (! skipping) {
+                hits |= JF_SAX_SWAR_EQ(x, ',') | JF_SAX_SWAR_EQ(x, ':');
+            }
+        }
+        // the byte by byte loop below pins it down
+        if (hits != 0) break;
+    }
+#endif
+    for (; i < len; i++) {
+        if (jf_sax_prescan_is_special(data[i], in_string, skipping)) return i;
+    }
+    return len;
+}
+
+
+static inline bool jf_sax_prescan_in_map(const jf_sax_prescan *p)
+{
+    return p->depth > 0
+        && p->depth <= JF_SAX_PRESCAN_MAX_DEPTH
+        && (p->maps & (1ULL << (p->depth - 1))) != 0;
+}
+
+
+static inline bool jf_sax_prescan_is_droppable(const jf_sax_prescan *p)
+{
+    if (! jf_sax_prescan_in_map(p) || p->expect_key) return false;
+    if (p->key_len == JF_STATIC_STRLEN("Items")
+            && JF_SAX_BYTES_ARE(p->key, "Items")) {
+        return false;
+    }
+    if (p->key_len == JF_STATIC_STRLEN("UserData")
+            && JF_SAX_BYTES_ARE(p->key, "UserData")) {
+        return false;
+    }
+    return true;
+}
+
+
+static inline void jf_sax_prescan_key_append(jf_sax_prescan *p,
+        const char *bytes,
+        const size_t length)
+{
+    size_t room;
+
+    if (p->key_len < JF_SAX_PRESCAN_KEY_SIZE) {
+        room = JF_SAX_PRESCAN_KEY_SIZE - p->key_len;
+        memcpy(p->key + p->key_len, bytes, length < room ? length : room);
+    }
+    p->key_len += length;
+}
+
+
+static size_t jf_sax_prescan_chunk(jf_sax_prescan *p, char *data, const size_t len)
+{
+    size_t i = 0, out = 0, run_start = 0, key_from = 0;
+    char c;
+
+    if (len == 0) return 0;
+    if (p->escaped) {
+        p->escaped = false;
+        i = 1;
+    }
+
+    while ((i = jf_sax_prescan_find(data, i, len, p->in_string, p->skip_depth > 0)) < len) {
+        c = data[i];
+        if (p->in_string) {
+            if (c == '\\') {
+                if (i + 1 == len) {
+                    p->escaped = true;
+                    break;
+                }
+                i += 2;
+                continue;
+            }
+            p->in_string = false;
+            if (p->in_key) {
+                jf_sax_prescan_key_append(p, data + key_from, i - key_from);
+                p->in_key = false;
+            }
+            i++;
+            continue;
+        }
+        switch (c) {
+            case '"':
+                p->in_string = true;
+                if (p->skip_depth == 0 && p->expect_key) {
+                    p->in_key = true;
+                    p->key_len = 0;
+                    key_from = i + 1;
+                }
+                break;
+            case '{':
+            case '[':
+                if (p->skip_depth == 0 && jf_sax_prescan_is_droppable(p)) {
+                    // keep what came before, the subtree becomes a 0
+                    memmove(data + out, data + run_start, i - run_start);
+                    out += i - run_start;
+                    data[out++] = '0';
+                    p->skip_depth = p->depth + 1;
+                }
+                p->depth++;
+                if (p->skip_depth == 0 && p->depth <= JF_SAX_PRESCAN_MAX_DEPTH) {
+                    if (c == '{') {
+                        p->maps |= 1ULL << (p->depth - 1);
+                    } else {
+                        p->maps &= ~(1ULL << (p->depth - 1));
+                    }
+                }
+                p->expect_key = c == '{' && p->skip_depth == 0;
+                break;
+            case '}':
+            case ']':
+                if (p->skip_depth > 0 && p->depth == p->skip_depth) {
+                    p->skip_depth = 0;
+                    run_start = i + 1;
+                }
+                if (p->depth > 0) p->depth--;
+                p->expect_key = false;
+                break;
+            case ',':
+                p->expect_key = jf_sax_prescan_in_map(p);
+                break;
+            case ':':
+                p->expect_key = false;
+                break;
+        }
+        i++;
+    }
+
+    // a key cut in two by the chunk boundary
+    if (p->in_key) {
+        jf_sax_prescan_key_append(p, data + key_from, len - key_from);
+    }
+    if (p->skip_depth == 0) {
+        memmove(data + out, data + run_start, len - run_start);
+        out += len - run_start;
+    }
+    return out;
+}
+//////////////////////////////////////
+
+
+////////// SAX KEY DISPATCH //////////
+static jf_sax_parser_state jf_sax_item_key_state(const unsigned char *key, const size_t key_len)
+{
+    switch (key_len) {
+        case 2:
+            if (JF_SAX_BYTES_ARE(key, "Id")) return JF_SAX_IN_ITEM_ID_VALUE;
+            break;
+        case 4:
+            switch (key[0]) {
+                case 'N':
+                    if (JF_SAX_BYTES_ARE(key, "Name")) return JF_SAX_IN_ITEM_NAME_VALUE;
+                    break;
+                case 'T':
+                    if (JF_SAX_BYTES_ARE(key, "Type")) return JF_SAX_IN_ITEM_TYPE_VALUE;
+                    break;
+                case 'P':
+                    if (JF_SAX_BYTES_ARE(key, "Path") && g_options.try_local_files) {
+                        return JF_SAX_IN_ITEM_PATH_VALUE;
+                    }
+                    break;
+            }
+            break;
+        case 5:
+            if (JF_SAX_BYTES_ARE(key, "Album")) return JF_SAX_IN_ITEM_ALBUM_VALUE;
+            break;
+        case 8:
+            if (JF_SAX_BYTES_ARE(key, "UserData")) return JF_SAX_IN_USERDATA_VALUE;
+            break;
+        case 10:
+            if (JF_SAX_BYTES_ARE(key, "SeriesName")) return JF_SAX_IN_ITEM_SERIES_VALUE;
+            break;
+        case 11:
+            switch (key[0]) {
+                case 'A':
+                    if (JF_SAX_BYTES_ARE(key, "AlbumArtist")) return JF_SAX_IN_ITEM_ALBUMARTIST_VALUE;
+                    break;
+                case 'I':
+                    if (JF_SAX_BYTES_ARE(key, "IndexNumber")) return JF_SAX_IN_ITEM_INDEX_VALUE;
+                    break;
+            }
+            break;
+        case 12:
+            if (JF_SAX_BYTES_ARE(key, "RunTimeTicks")) return JF_SAX_IN_ITEM_RUNTIME_TICKS_VALUE;
+            break;
+        case 14:
+            switch (key[0]) {
+                case 'C':
+                    if (JF_SAX_BYTES_ARE(key, "CollectionType")) return JF_SAX_IN_ITEM_COLLECTION_TYPE_VALUE;
+                    break;
+                case 'P':
+                    if (JF_SAX_BYTES_ARE(key, "ProductionYear")) return JF_SAX_IN_ITEM_YEAR_VALUE;
+                    break;
+            }
+            break;
+        case 17:
+            if (JF_SAX_BYTES_ARE(key, "ParentIndexNumber")) return JF_SAX_IN_ITEM_PARENT_INDEX_VALUE;
+            break;
+    }
+    return JF_SAX_NO_STATE;
+}
+
+
+static jf_item_type jf_sax_item_type_from_string(const unsigned char *string, const size_t string_len)
+{
+    switch (string_len) {
+        case 5:
+            switch (string[0]) {
+                case 'A':
+                    if (JF_SAX_BYTES_ARE(string, "Audio")) return JF_ITEM_TYPE_AUDIO;
+                    break;
+                case 'M':
+                    if (JF_SAX_BYTES_ARE(string, "Movie")) return JF_ITEM_TYPE_MOVIE;
+                    break;
+            }
+            break;
+        case 6:
+            switch (string[0]) {
+                case 'A':
+                    if (JF_SAX_BYTES_ARE(string, "Artist")) return JF_ITEM_TYPE_ARTIST;
+                    break;
+                case 'F':
+                    if (JF_SAX_BYTES_ARE(string, "Folder")) return JF_ITEM_TYPE_FOLDER;
+                    break;
+                case 'S':
+                    if (JF_SAX_BYTES_ARE(string, "Season")) return JF_ITEM_TYPE_SEASON;
+                    if (JF_SAX_BYTES_ARE(string, "Series")) return JF_ITEM_TYPE_SERIES;
+                    break;
+            }
+            break;
+        case 7:
+            if (JF_SAX_BYTES_ARE(string, "Episode")) return JF_ITEM_TYPE_EPISODE;
+            break;
+        case 8:
+            switch (string[0]) {
+                case 'P':
+                    if (JF_SAX_BYTES_ARE(string, "Playlist")) return JF_ITEM_TYPE_PLAYLIST;
+                    break;
+                case 'U':
+                    if (JF_SAX_BYTES_ARE(string, "UserView")) return JF_ITEM_TYPE_FOLDER;
+                    break;
+            }
+            break;
+        case 9:
+            if (JF_SAX_BYTES_ARE(string, "AudioBook")) return JF_ITEM_TYPE_AUDIOBOOK;
+            break;
+        case 10:
+            // MusicAlbum, MusicVideo, SeriesName
+            switch (string[5]) {
+                case 'A':
+                    if (JF_SAX_BYTES_ARE(string, "MusicAlbum")) return JF_ITEM_TYPE_ALBUM;
+                    break;
+                case 'V':
+                    if (JF_SAX_BYTES_ARE(string, "MusicVideo")) return JF_ITEM_TYPE_MUSIC_VIDEO;
+                    break;
+                case 's':
+                    if (JF_SAX_BYTES_ARE(string, "SeriesName")) return JF_ITEM_TYPE_SERIES;
+                    break;
+            }
+            break;
+        case 11:
+            if (JF_SAX_BYTES_ARE(string, "MusicArtist")) return JF_ITEM_TYPE_ARTIST;
+            break;
+        case 15:
+            if (JF_SAX_BYTES_ARE(string, "PlaylistsFolder")) return JF_ITEM_TYPE_FOLDER;
+            break;
+        case 16:
+            if (JF_SAX_BYTES_ARE(string, "CollectionFolder")) return JF_ITEM_TYPE_COLLECTION;
+            break;
+    }
+    return JF_ITEM_TYPE_NONE;
+}
+
+
+static jf_item_type jf_sax_collection_type_from_string(const unsigned char *string, const size_t string_len)
+{
+    switch (string_len) {
+        case 5:
+            if (JF_SAX_BYTES_ARE(string, "music")) return JF_ITEM_TYPE_COLLECTION_MUSIC;
+            break;
+        case 6:
+            if (JF_SAX_BYTES_ARE(string, "movies")) return JF_ITEM_TYPE_COLLECTION_MOVIES;
+            break;
+        case 7:
+            switch (string[0]) {
+                case 't':
+                    if (JF_SAX_BYTES_ARE(string, "tvshows")) return JF_ITEM_TYPE_COLLECTION_SERIES;
+                    break;
+                case 'f':
+                    if (JF_SAX_BYTES_ARE(string, "folders")) return JF_ITEM_TYPE_FOLDER;
+                    break;
+            }
+            break;
+        case 10:
+            if (JF_SAX_BYTES_ARE(string, "homevideos")) return JF_ITEM_TYPE_COLLECTION_MOVIES;
+            break;
+        case 11:
+            if (JF_SAX_BYTES_ARE(string, "musicvideos")) return JF_ITEM_TYPE_COLLECTION_MUSIC_VIDEOS;
+            break;
+    }
+    return JF_ITEM_TYPE_NONE;
+}
 //////////////////////////////////////
 
 
@@ -68,9 +543,16 @@ static int jf_sax_items_start_map(void *ctx)
     jf_sax_context *context = (jf_sax_context *)(ctx);
     switch (context->parser_state) {
         case JF_SAX_IDLE:
-            context->tb->item_count = 0;
+            context->tb->total_record_count = 0;
             jf_sax_context_current_item_clear(context);
-            jf_disk_refresh();
+            if (! context->tb->append) {
+                context->tb->item_count = 0;
+                if (context->tb->destination == NULL) {
+                    jf_disk_refresh();
+                } else {
+                    jf_disk_scratch_clear(context->tb->destination);
+                }
+            }
             context->parser_state = JF_SAX_IN_QUERYRESULT_MAP;
             break;
         case JF_SAX_IN_LATEST_ARRAY:
@@ -116,16 +598,24 @@ static int jf_sax_items_end_map(void *ctx)
                 context->tb->item_count++;
                 jf_sax_current_item_make_and_print_name(context);
 
-                jf_menu_item *item = jf_menu_item_new(context->current_item_type,
-                        NULL, 0,
-                        (const char*)(context->parsed_content->buf
-                            + context->id_start),
-                        context->current_item_display_name->buf,
-                        context->current_item_path->used > 0 ? context->current_item_path->buf : 0,
-                        context->runtime_ticks,
-                        context->playback_ticks);
-                jf_disk_payload_add_item(item);
-                jf_menu_item_free(item);
+                if (context->tb->destination == NULL) {
+                    jf_disk_payload_add_record(context->current_item_type,
+                            context->parsed_content->buf + context->id_start,
+                            context->id_len,
+                            context->current_item_display_name->buf,
+                            context->current_item_path->used > 0 ? context->current_item_path->buf : NULL,
+                            context->runtime_ticks,
+                            context->playback_ticks);
+                } else {
+                    jf_disk_scratch_add_record(context->tb->destination,
+                            context->current_item_type,
+                            context->parsed_content->buf + context->id_start,
+                            context->id_len,
+                            context->current_item_display_name->buf,
+                            context->current_item_path->used > 0 ? context->current_item_path->buf : NULL,
+                            context->runtime_ticks,
+                            context->playback_ticks);
+                }
             }
             jf_sax_context_current_item_clear(context);
 
@@ -152,39 +642,18 @@ static int jf_sax_items_end_map(void *ctx)
 static int jf_sax_items_map_key(void *ctx, const unsigned char *key, size_t key_len)
 {
     jf_sax_context *context = (jf_sax_context *)(ctx);
+    jf_sax_parser_state state;
     switch (context->parser_state) {
         case JF_SAX_IN_QUERYRESULT_MAP:
             if (JF_SAX_KEY_IS("Items")) {
                 context->parser_state = JF_SAX_IN_ITEMS_VALUE;
+            } else if (JF_SAX_KEY_IS("TotalRecordCount")) {
+                context->parser_state = JF_SAX_IN_TOTAL_RECORD_COUNT_VALUE;
             }
             break;
         case JF_SAX_IN_ITEM_MAP:
-            if (JF_SAX_KEY_IS("Name")) {
-                context->parser_state = JF_SAX_IN_ITEM_NAME_VALUE;
-            } else if (JF_SAX_KEY_IS("Type")) {
-                context->parser_state = JF_SAX_IN_ITEM_TYPE_VALUE;
-            } else if (JF_SAX_KEY_IS("CollectionType")) {
-                context->parser_state = JF_SAX_IN_ITEM_COLLECTION_TYPE_VALUE;
-            } else if (JF_SAX_KEY_IS("Id")) {
-                context->parser_state = JF_SAX_IN_ITEM_ID_VALUE;
-            } else if (JF_SAX_KEY_IS("AlbumArtist")) {
-                context->parser_state = JF_SAX_IN_ITEM_ALBUMARTIST_VALUE;
-            } else if (JF_SAX_KEY_IS("Album")) {
-                context->parser_state = JF_SAX_IN_ITEM_ALBUM_VALUE;
-            } else if (JF_SAX_KEY_IS("SeriesName")) {
-                context->parser_state = JF_SAX_IN_ITEM_SERIES_VALUE;
-            } else if (JF_SAX_KEY_IS("ProductionYear")) {
-                context->parser_state = JF_SAX_IN_ITEM_YEAR_VALUE;
-            } else if (JF_SAX_KEY_IS("IndexNumber")) {
-                context->parser_state = JF_SAX_IN_ITEM_INDEX_VALUE;
-            } else if (JF_SAX_KEY_IS("ParentIndexNumber")) {
-                context->parser_state = JF_SAX_IN_ITEM_PARENT_INDEX_VALUE;
-            } else if (JF_SAX_KEY_IS("RunTimeTicks")) {
-                context->parser_state = JF_SAX_IN_ITEM_RUNTIME_TICKS_VALUE;
-            } else if (JF_SAX_KEY_IS("UserData")) {
-                context->parser_state = JF_SAX_IN_USERDATA_VALUE;
-            } else if (JF_SAX_KEY_IS("Path") && g_options.try_local_files) {
-                context->parser_state = JF_SAX_IN_ITEM_PATH_VALUE;
+            if ((state = jf_sax_item_key_state(key, key_len)) != JF_SAX_NO_STATE) {
+                context->parser_state = state;
             }
             break;
         case JF_SAX_IN_USERDATA_MAP:
@@ -203,7 +672,10 @@ static int jf_sax_items_start_array(void *ctx)
     switch (context->parser_state) {
         case JF_SAX_IDLE:
             context->parser_state = JF_SAX_IN_LATEST_ARRAY;
-            context->tb->item_count = 0;
+            context->tb->total_record_count = 0;
+            if (! context->tb->append) {
+                context->tb->item_count = 0;
+            }
             jf_sax_context_current_item_clear(context);
             break;
         case JF_SAX_IN_ITEMS_VALUE:
@@ -251,56 +723,25 @@ static int jf_sax_items_end_array(void *ctx)
 static int jf_sax_items_string(void *ctx, const unsigned char *string, size_t string_len)
 {
     jf_sax_context *context = (jf_sax_context *)(ctx);
+    jf_item_type type;
     switch (context->parser_state) {
         case JF_SAX_IN_ITEM_NAME_VALUE:
             JF_SAX_ITEM_FILL(name);
             context->parser_state = JF_SAX_IN_ITEM_MAP;
             break;
         case JF_SAX_IN_ITEM_TYPE_VALUE:
-            if (JF_SAX_STRING_IS("CollectionFolder")
-                    && context->current_item_type == JF_ITEM_TYPE_NONE) {
-                // don't overwrite if we already got more specific information
-                context->current_item_type = JF_ITEM_TYPE_COLLECTION;
-            } else if (JF_SAX_STRING_IS("Folder")
-                    || JF_SAX_STRING_IS("UserView")
-                    || JF_SAX_STRING_IS("PlaylistsFolder")) {
-                context->current_item_type = JF_ITEM_TYPE_FOLDER;
-            } else if (JF_SAX_STRING_IS("Playlist")) {
-                context->current_item_type = JF_ITEM_TYPE_PLAYLIST;
-            } else if (JF_SAX_STRING_IS("Audio")) {
-                context->current_item_type = JF_ITEM_TYPE_AUDIO;
-            } else if (JF_SAX_STRING_IS("Artist")
-                    || JF_SAX_STRING_IS("MusicArtist")) {
-                context->current_item_type = JF_ITEM_TYPE_ARTIST;
-            } else if (JF_SAX_STRING_IS("MusicAlbum")) {
-                context->current_item_type = JF_ITEM_TYPE_ALBUM;
-            } else if (JF_SAX_STRING_IS("Episode")) {
-                context->current_item_type = JF_ITEM_TYPE_EPISODE;
-            } else if (JF_SAX_STRING_IS("Season")) {
-                context->current_item_type = JF_ITEM_TYPE_SEASON;
-            } else if (JF_SAX_STRING_IS("SeriesName")
-                    || JF_SAX_STRING_IS("Series")) {
-                context->current_item_type = JF_ITEM_TYPE_SERIES;
-            } else if (JF_SAX_STRING_IS("Movie")) {
-                context->current_item_type = JF_ITEM_TYPE_MOVIE;
-            } else if (JF_SAX_STRING_IS("MusicVideo")) {
-                context->current_item_type = JF_ITEM_TYPE_MUSIC_VIDEO;
-            } else if (JF_SAX_STRING_IS("AudioBook")) {
-                context->current_item_type = JF_ITEM_TYPE_AUDIOBOOK;
+            type = jf_sax_item_type_from_string(string, string_len);
+            // don't overwrite if we already got more specific information
+            if (type != JF_ITEM_TYPE_NONE
+                    && (type != JF_ITEM_TYPE_COLLECTION
+                        || context->current_item_type == JF_ITEM_TYPE_NONE)) {
+                context->current_item_type = type;
             }
             context->parser_state = JF_SAX_IN_ITEM_MAP;
             break;
         case JF_SAX_IN_ITEM_COLLECTION_TYPE_VALUE:
-            if (JF_SAX_STRING_IS("music")) {
-                context->current_item_type = JF_ITEM_TYPE_COLLECTION_MUSIC;
-            } else if (JF_SAX_STRING_IS("tvshows")) {
-                context->current_item_type = JF_ITEM_TYPE_COLLECTION_SERIES;
-            } else if (JF_SAX_STRING_IS("movies") || JF_SAX_STRING_IS("homevideos")) {
-                context->current_item_type = JF_ITEM_TYPE_COLLECTION_MOVIES;
-            } else if (JF_SAX_STRING_IS("musicvideos")) {
-                context->current_item_type = JF_ITEM_TYPE_COLLECTION_MUSIC_VIDEOS;
-            } else if (JF_SAX_STRING_IS("folders")) {
-                context->current_item_type = JF_ITEM_TYPE_FOLDER;
+            if ((type = jf_sax_collection_type_from_string(string, string_len)) != JF_ITEM_TYPE_NONE) {
+                context->current_item_type = type;
             }
             context->parser_state = JF_SAX_IN_ITEM_MAP;
             break;
@@ -356,6 +797,10 @@ static int jf_sax_items_number(void *ctx, const char *string, size_t string_len)
             JF_SAX_ITEM_FILL(parent_index);
             context->parser_state = JF_SAX_IN_ITEM_MAP;
             break;
+        case JF_SAX_IN_TOTAL_RECORD_COUNT_VALUE:
+            context->tb->total_record_count = strtoull(string, NULL, 10);
+            context->parser_state = JF_SAX_IN_QUERYRESULT_MAP;
+            break;
         default:
             // ignore everything else
             break;
@@ -453,7 +898,9 @@ static inline void jf_sax_current_item_make_and_print_name(jf_sax_context *conte
     }
 
     jf_growing_buffer_append(context->current_item_display_name, "", 1);
-    printf("%s\n", context->current_item_display_name->buf);
+    if (! context->tb->quiet) {
+        printf("%s\n", context->current_item_display_name->buf);
+    }
 }
 
 
@@ -499,6 +946,19 @@ static inline void jf_sax_context_current_item_clear(jf_sax_context *context)
 }
 
 
+// Gets ready for a new document after the last one was left halfway through.
+static inline void jf_sax_context_reset(jf_sax_context *context)
+{
+    context->parser_state = JF_SAX_IDLE;
+    context->state_to_resume = JF_SAX_NO_STATE;
+    context->maps_ignoring = 0;
+    context->arrays_ignoring = 0;
+    context->latest_array = false;
+    context->prescan = (jf_sax_prescan){ 0 };
+    jf_sax_context_current_item_clear(context);
+}
+
+
 void *jf_json_sax_thread(void *arg)
 {
     jf_sax_context context;
@@ -518,77 +978,500 @@ void *jf_json_sax_thread(void *arg)
         .yajl_end_array = jf_sax_items_end_array
     };
     unsigned char *error_str;
+    jf_thread_buffer *tb = (jf_thread_buffer *)arg;
+    jf_thread_buffer_slot *slot;
+    size_t head, used;
 
-    jf_sax_context_init(&context, (jf_thread_buffer *)arg);
+    jf_sax_context_init(&context, tb);
 
     assert((parser = jf_sax_yajl_parser_new(&callbacks, &context)) != NULL);
 
-    pthread_mutex_lock(&context.tb->mut);
     while (true) {
-        while (context.tb->state != JF_THREAD_BUFFER_STATE_PENDING_DATA) {
-            pthread_cond_wait(&context.tb->cv_no_data, &context.tb->mut);
+        // sleep only on an empty ring
+        head = tb->head;
+        if (head == __atomic_load_n(&tb->tail, __ATOMIC_ACQUIRE)) {
+            pthread_mutex_lock(&tb->mut);
+            // the producer checks the flag after advancing tail
+            __atomic_store_n(&tb->parser_sleeping, true, __ATOMIC_SEQ_CST);
+            while (head == __atomic_load_n(&tb->tail, __ATOMIC_SEQ_CST)
+                    && tb->state != JF_THREAD_BUFFER_STATE_RESET) {
+                pthread_cond_wait(&tb->cv_no_data, &tb->mut);
+            }
+            __atomic_store_n(&tb->parser_sleeping, false, __ATOMIC_RELAXED);
+            if (tb->state == JF_THREAD_BUFFER_STATE_RESET) {
+                // yajl can't be told to drop a document halfway through either
+                yajl_free(parser);
+                assert((parser = jf_sax_yajl_parser_new(&callbacks, &context)) != NULL);
+                jf_sax_context_reset(&context);
+                __atomic_store_n(&tb->state, JF_THREAD_BUFFER_STATE_CLEAR, __ATOMIC_RELEASE);
+                pthread_cond_broadcast(&tb->cv_has_data);
+                pthread_mutex_unlock(&tb->mut);
+                continue;
+            }
+            pthread_mutex_unlock(&tb->mut);
         }
-        if ((status = yajl_parse(parser, (unsigned char*)context.tb->data, context.tb->used)) != yajl_status_ok) {
-            error_str = yajl_get_error(parser, 1, (unsigned char*)context.tb->data, context.tb->used);
-            strcpy(context.tb->data, "yajl_parse error: ");
-            strncat(context.tb->data, (char *)error_str, JF_PARSER_ERROR_BUFFER_SIZE - strlen(context.tb->data));
-            context.tb->state = JF_THREAD_BUFFER_STATE_PARSER_ERROR;
-            pthread_mutex_unlock(&context.tb->mut);
+
+        slot = tb->slots + head % JF_THREAD_BUFFER_SLOTS;
+        if (__atomic_load_n(&tb->state, __ATOMIC_ACQUIRE) == JF_THREAD_BUFFER_STATE_PARSER_ERROR) {
+            // what's left of the document that failed: skip it
+        } else if ((status = yajl_parse(parser,
+                        (unsigned char*)slot->data,
+                        (used = jf_sax_prescan_chunk(&context.prescan, slot->data, slot->used))))
+                != yajl_status_ok) {
+            error_str = yajl_get_error(parser, 1, (unsigned char*)slot->data, used);
+            strcpy(tb->error, "yajl_parse error: ");
+            strncat(tb->error, (char *)error_str, sizeof(tb->error) - strlen(tb->error) - 1);
             yajl_free_error(parser, error_str);
             // the parser never recovers after an error; we must free and reallocate it
             yajl_free(parser);
-            parser = jf_sax_yajl_parser_new(&callbacks, &context);
+            assert((parser = jf_sax_yajl_parser_new(&callbacks, &context)) != NULL);
+            jf_sax_context_reset(&context);
+            __atomic_store_n(&tb->state, JF_THREAD_BUFFER_STATE_PARSER_ERROR, __ATOMIC_RELEASE);
         } else if (context.parser_state == JF_SAX_IDLE) {
             // JSON fully parsed
             yajl_complete_parse(parser);
-            context.tb->state = JF_THREAD_BUFFER_STATE_CLEAR;
+            __atomic_store_n(&tb->state, JF_THREAD_BUFFER_STATE_CLEAR, __ATOMIC_RELEASE);
         } else {
             // we've still more to go
-            context.tb->state = JF_THREAD_BUFFER_STATE_AWAITING_DATA;
+            __atomic_store_n(&tb->state, JF_THREAD_BUFFER_STATE_AWAITING_DATA, __ATOMIC_RELEASE);
+        }
+
+        // hand the slot back
+        __atomic_store_n(&tb->head, head + 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&tb->producer_sleeping, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_lock(&tb->mut);
+            pthread_cond_broadcast(&tb->cv_has_data);
+            pthread_mutex_unlock(&tb->mut);
+            if (tb->producer_wakeup != NULL) {
+                tb->producer_wakeup();
+            }
         }
-        
-        context.tb->used = 0;
-        pthread_cond_signal(&context.tb->cv_has_data);
     }
 }
 ////////////////////////////////
 
 
 ////////// VIDEO PARSING //////////
-static jf_menu_item *jf_json_parse_versions(const jf_menu_item *item, const yajl_val media_sources)
+static int jf_sax_video_start_map(void *ctx)
+{
+    jf_sax_video_context *context = (jf_sax_video_context *)(ctx);
+    switch (context->parser_state) {
+        case JF_SAX_VIDEO_IDLE:
+            context->parser_state = context->additional_parts ?
+                JF_SAX_VIDEO_IN_QUERYRESULT_MAP : JF_SAX_VIDEO_IN_ITEM_MAP;
+            break;
+        case JF_SAX_VIDEO_IN_ITEMS_ARRAY:
+            context->parser_state = JF_SAX_VIDEO_IN_ITEM_MAP;
+            break;
+        case JF_SAX_VIDEO_IN_SOURCES_ARRAY:
+            assert((context->sources = realloc(context->sources,
+                            ++context->sources_count * sizeof(jf_sax_video_source))) != NULL);
+            context->sources[context->sources_count - 1] = (jf_sax_video_source){
+                .part = context->parts,
+                .id = JF_SAX_VIDEO_NO_STRING,
+                .name = JF_SAX_VIDEO_NO_STRING,
+                .path = JF_SAX_VIDEO_NO_STRING,
+                .runtime_ticks = 0
+            };
+            context->parser_state = JF_SAX_VIDEO_IN_SOURCE_MAP;
+            break;
+        case JF_SAX_VIDEO_IN_STREAMS_ARRAY:
+            assert((context->streams = realloc(context->streams,
+                            ++context->streams_count * sizeof(jf_sax_video_stream))) != NULL);
+            context->streams[context->streams_count - 1] = (jf_sax_video_stream){
+                .source = context->sources_count - 1,
+                .display_title = JF_SAX_VIDEO_NO_STRING,
+                .codec = JF_SAX_VIDEO_NO_STRING,
+                .index = JF_SAX_VIDEO_NO_STRING,
+                .path = JF_SAX_VIDEO_NO_STRING,
+                .language = JF_SAX_VIDEO_NO_STRING,
+                .is_subtitle = false,
+                .is_external = false
+            };
+            context->parser_state = JF_SAX_VIDEO_IN_STREAM_MAP;
+            break;
+        case JF_SAX_VIDEO_IGNORE:
+            context->maps_ignoring++;
+            break;
+        default:
+            // the value of a key of no interest, or a map where there should
+            // have been something else
+            jf_sax_video_ignore(context, true);
+    }
+    return 1;
+}
+
+
+static int jf_sax_video_end_map(void *ctx)
+{
+    jf_sax_video_context *context = (jf_sax_video_context *)(ctx);
+    switch (context->parser_state) {
+        case JF_SAX_VIDEO_IN_QUERYRESULT_MAP:
+            context->parser_state = JF_SAX_VIDEO_IDLE;
+            break;
+        case JF_SAX_VIDEO_IN_ITEM_MAP:
+            context->parts++;
+            context->parser_state = context->additional_parts ?
+                JF_SAX_VIDEO_IN_ITEMS_ARRAY : JF_SAX_VIDEO_IDLE;
+            break;
+        case JF_SAX_VIDEO_IN_SOURCE_MAP:
+            context->parser_state = JF_SAX_VIDEO_IN_SOURCES_ARRAY;
+            break;
+        case JF_SAX_VIDEO_IN_STREAM_MAP:
+            context->parser_state = JF_SAX_VIDEO_IN_STREAMS_ARRAY;
+            break;
+        case JF_SAX_VIDEO_IGNORE:
+            context->maps_ignoring--;
+            if (context->maps_ignoring == 0 && context->arrays_ignoring == 0) {
+                context->parser_state = context->state_to_resume;
+                context->state_to_resume = JF_SAX_VIDEO_NO_STATE;
+            }
+            break;
+        default:
+            JF_SAX_BAD_STATE();
+    }
+    return 1;
+}
+
+
+static int jf_sax_video_map_key(void *ctx, const unsigned char *key, size_t key_len)
+{
+    jf_sax_video_context *context = (jf_sax_video_context *)(ctx);
+    switch (context->parser_state) {
+        case JF_SAX_VIDEO_IN_QUERYRESULT_MAP:
+            if (JF_SAX_KEY_IS("Items")) {
+                context->parser_state = JF_SAX_VIDEO_IN_ITEMS_VALUE;
+            }
+            break;
+        case JF_SAX_VIDEO_IN_ITEM_MAP:
+            if (JF_SAX_KEY_IS("MediaSources")) {
+                context->parser_state = JF_SAX_VIDEO_IN_SOURCES_VALUE;
+            } else if (JF_SAX_KEY_IS("PartCount")) {
+                context->parser_state = JF_SAX_VIDEO_IN_PART_COUNT_VALUE;
+            }
+            break;
+        case JF_SAX_VIDEO_IN_SOURCE_MAP:
+            if (JF_SAX_KEY_IS("Id")) {
+                context->parser_state = JF_SAX_VIDEO_IN_SOURCE_ID_VALUE;
+            } else if (JF_SAX_KEY_IS("Name")) {
+                context->parser_state = JF_SAX_VIDEO_IN_SOURCE_NAME_VALUE;
+            } else if (JF_SAX_KEY_IS("Path")) {
+                context->parser_state = JF_SAX_VIDEO_IN_SOURCE_PATH_VALUE;
+            } else if (JF_SAX_KEY_IS("RunTimeTicks")) {
+                context->parser_state = JF_SAX_VIDEO_IN_SOURCE_RUNTIME_TICKS_VALUE;
+            } else if (JF_SAX_KEY_IS("MediaStreams")) {
+                context->parser_state = JF_SAX_VIDEO_IN_STREAMS_VALUE;
+            }
+            break;
+        case JF_SAX_VIDEO_IN_STREAM_MAP:
+            if (JF_SAX_KEY_IS("Type")) {
+                context->parser_state = JF_SAX_VIDEO_IN_STREAM_TYPE_VALUE;
+            } else if (JF_SAX_KEY_IS("Codec")) {
+                context->parser_state = JF_SAX_VIDEO_IN_STREAM_CODEC_VALUE;
+            } else if (JF_SAX_KEY_IS("IsExternal")) {
+                context->parser_state = JF_SAX_VIDEO_IN_STREAM_IS_EXTERNAL_VALUE;
+            } else if (JF_SAX_KEY_IS("Index")) {
+                context->parser_state = JF_SAX_VIDEO_IN_STREAM_INDEX_VALUE;
+            } else if (JF_SAX_KEY_IS("Path")) {
+                context->parser_state = JF_SAX_VIDEO_IN_STREAM_PATH_VALUE;
+            } else if (JF_SAX_KEY_IS("Language")) {
+                context->parser_state = JF_SAX_VIDEO_IN_STREAM_LANGUAGE_VALUE;
+            } else if (JF_SAX_KEY_IS("DisplayTitle")) {
+                context->parser_state = JF_SAX_VIDEO_IN_STREAM_DISPLAY_TITLE_VALUE;
+            }
+            break;
+        default:
+            break;
+    }
+    return 1;
+}
+
+
+static int jf_sax_video_start_array(void *ctx)
+{
+    jf_sax_video_context *context = (jf_sax_video_context *)(ctx);
+    switch (context->parser_state) {
+        case JF_SAX_VIDEO_IN_ITEMS_VALUE:
+            context->parser_state = JF_SAX_VIDEO_IN_ITEMS_ARRAY;
+            break;
+        case JF_SAX_VIDEO_IN_SOURCES_VALUE:
+            context->parser_state = JF_SAX_VIDEO_IN_SOURCES_ARRAY;
+            break;
+        case JF_SAX_VIDEO_IN_STREAMS_VALUE:
+            context->parser_state = JF_SAX_VIDEO_IN_STREAMS_ARRAY;
+            break;
+        case JF_SAX_VIDEO_IGNORE:
+            context->arrays_ignoring++;
+            break;
+        default:
+            jf_sax_video_ignore(context, false);
+    }
+    return 1;
+}
+
+
+static int jf_sax_video_end_array(void *ctx)
+{
+    jf_sax_video_context *context = (jf_sax_video_context *)(ctx);
+    switch (context->parser_state) {
+        case JF_SAX_VIDEO_IN_ITEMS_ARRAY:
+            context->parser_state = JF_SAX_VIDEO_IN_QUERYRESULT_MAP;
+            break;
+        case JF_SAX_VIDEO_IN_SOURCES_ARRAY:
+            context->parser_state = JF_SAX_VIDEO_IN_ITEM_MAP;
+            break;
+        case JF_SAX_VIDEO_IN_STREAMS_ARRAY:
+            context->parser_state = JF_SAX_VIDEO_IN_SOURCE_MAP;
+            break;
+        case JF_SAX_VIDEO_IGNORE:
+            context->arrays_ignoring--;
+            if (context->arrays_ignoring == 0 && context->maps_ignoring == 0) {
+                context->parser_state = context->state_to_resume;
+                context->state_to_resume = JF_SAX_VIDEO_NO_STATE;
+            }
+            break;
+        default:
+            JF_SAX_BAD_STATE();
+    }
+    return 1;
+}
+
+
+static int jf_sax_video_null(void *ctx)
+{
+    jf_sax_video_context *context = (jf_sax_video_context *)(ctx);
+    context->parser_state = jf_sax_video_state_after_value(context->parser_state);
+    return 1;
+}
+
+
+static int jf_sax_video_boolean(void *ctx, int bool_val)
+{
+    jf_sax_video_context *context = (jf_sax_video_context *)(ctx);
+    if (context->parser_state == JF_SAX_VIDEO_IN_STREAM_IS_EXTERNAL_VALUE) {
+        context->streams[context->streams_count - 1].is_external = bool_val != 0;
+    }
+    context->parser_state = jf_sax_video_state_after_value(context->parser_state);
+    return 1;
+}
+
+
+static int jf_sax_video_string(void *ctx, const unsigned char *string, size_t string_len)
+{
+    jf_sax_video_context *context = (jf_sax_video_context *)(ctx);
+    // value states are only ever entered in the map of the last one
+    jf_sax_video_source *source = context->sources_count > 0 ?
+        context->sources + context->sources_count - 1 : NULL;
+    jf_sax_video_stream *stream = context->streams_count > 0 ?
+        context->streams + context->streams_count - 1 : NULL;
+    switch (context->parser_state) {
+        case JF_SAX_VIDEO_IN_SOURCE_ID_VALUE:
+            source->id = jf_sax_video_store(context, string, string_len);
+            break;
+        case JF_SAX_VIDEO_IN_SOURCE_NAME_VALUE:
+            source->name = jf_sax_video_store(context, string, string_len);
+            break;
+        case JF_SAX_VIDEO_IN_SOURCE_PATH_VALUE:
+            source->path = jf_sax_video_store(context, string, string_len);
+            break;
+        case JF_SAX_VIDEO_IN_STREAM_TYPE_VALUE:
+            stream->is_subtitle = string_len == JF_STATIC_STRLEN("Subtitle")
+                && JF_SAX_BYTES_ARE(string, "Subtitle");
+            break;
+        case JF_SAX_VIDEO_IN_STREAM_CODEC_VALUE:
+            stream->codec = jf_sax_video_store(context, string, string_len);
+            break;
+        case JF_SAX_VIDEO_IN_STREAM_PATH_VALUE:
+            stream->path = jf_sax_video_store(context, string, string_len);
+            break;
+        case JF_SAX_VIDEO_IN_STREAM_LANGUAGE_VALUE:
+            stream->language = jf_sax_video_store(context, string, string_len);
+            break;
+        case JF_SAX_VIDEO_IN_STREAM_DISPLAY_TITLE_VALUE:
+            stream->display_title = jf_sax_video_store(context, string, string_len);
+            break;
+        default:
+            break;
+    }
+    context->parser_state = jf_sax_video_state_after_value(context->parser_state);
+    return 1;
+}
+
+
+static int jf_sax_video_number(void *ctx, const char *string, size_t string_len)
+{
+    jf_sax_video_context *context = (jf_sax_video_context *)(ctx);
+    switch (context->parser_state) {
+        case JF_SAX_VIDEO_IN_PART_COUNT_VALUE:
+            context->part_count = strtoll(string, NULL, 10);
+            break;
+        case JF_SAX_VIDEO_IN_SOURCE_RUNTIME_TICKS_VALUE:
+            context->sources[context->sources_count - 1].runtime_ticks = strtoll(string, NULL, 10);
+            break;
+        case JF_SAX_VIDEO_IN_STREAM_INDEX_VALUE:
+            // only ever pasted into a URL
+            context->streams[context->streams_count - 1].index = jf_sax_video_store(context,
+                    string,
+                    string_len);
+            break;
+        default:
+            break;
+    }
+    context->parser_state = jf_sax_video_state_after_value(context->parser_state);
+    return 1;
+}
+
+
+static inline jf_sax_video_state jf_sax_video_state_after_value(const jf_sax_video_state state)
+{
+    switch (state) {
+        case JF_SAX_VIDEO_IN_ITEMS_VALUE:
+            return JF_SAX_VIDEO_IN_QUERYRESULT_MAP;
+        case JF_SAX_VIDEO_IN_PART_COUNT_VALUE:
+        case JF_SAX_VIDEO_IN_SOURCES_VALUE:
+            return JF_SAX_VIDEO_IN_ITEM_MAP;
+        case JF_SAX_VIDEO_IN_SOURCE_ID_VALUE:
+        case JF_SAX_VIDEO_IN_SOURCE_NAME_VALUE:
+        case JF_SAX_VIDEO_IN_SOURCE_PATH_VALUE:
+        case JF_SAX_VIDEO_IN_SOURCE_RUNTIME_TICKS_VALUE:
+        case JF_SAX_VIDEO_IN_STREAMS_VALUE:
+            return JF_SAX_VIDEO_IN_SOURCE_MAP;
+        case JF_SAX_VIDEO_IN_STREAM_TYPE_VALUE:
+        case JF_SAX_VIDEO_IN_STREAM_CODEC_VALUE:
+        case JF_SAX_VIDEO_IN_STREAM_IS_EXTERNAL_VALUE:
+        case JF_SAX_VIDEO_IN_STREAM_INDEX_VALUE:
+        case JF_SAX_VIDEO_IN_STREAM_PATH_VALUE:
+        case JF_SAX_VIDEO_IN_STREAM_LANGUAGE_VALUE:
+        case JF_SAX_VIDEO_IN_STREAM_DISPLAY_TITLE_VALUE:
+            return JF_SAX_VIDEO_IN_STREAM_MAP;
+        default:
+            return state;
+    }
+}
+
+
+static inline void jf_sax_video_ignore(jf_sax_video_context *context, const bool is_map)
+{
+    context->state_to_resume = jf_sax_video_state_after_value(context->parser_state);
+    context->parser_state = JF_SAX_VIDEO_IGNORE;
+    context->maps_ignoring = is_map ? 1 : 0;
+    context->arrays_ignoring = is_map ? 0 : 1;
+}
+
+
+static inline size_t jf_sax_video_store(jf_sax_video_context *context,
+        const void *string,
+        const size_t string_len)
+{
+    size_t offset = context->strings->used;
+    jf_growing_buffer_append(context->strings, string, string_len);
+    jf_growing_buffer_append(context->strings, "", 1);
+    return offset;
+}
+
+
+static void jf_sax_video_parse(jf_sax_video_context *context,
+        const char *payload,
+        const size_t payload_size)
+{
+    yajl_handle parser;
+    yajl_status status;
+    yajl_callbacks callbacks = {
+        .yajl_null = jf_sax_video_null,
+        .yajl_boolean = jf_sax_video_boolean,
+        .yajl_integer = NULL,
+        .yajl_double = NULL,
+        .yajl_number = jf_sax_video_number,
+        .yajl_string = jf_sax_video_string,
+        .yajl_start_map = jf_sax_video_start_map,
+        .yajl_map_key = jf_sax_video_map_key,
+        .yajl_end_map = jf_sax_video_end_map,
+        .yajl_start_array = jf_sax_video_start_array,
+        .yajl_end_array = jf_sax_video_end_array
+    };
+    unsigned char *error_str;
+
+    context->parser_state = JF_SAX_VIDEO_IDLE;
+    context->state_to_resume = JF_SAX_VIDEO_NO_STATE;
+    context->maps_ignoring = 0;
+    context->arrays_ignoring = 0;
+
+    assert((parser = yajl_alloc(&callbacks, NULL, (void *)(context))) != NULL);
+    if ((status = yajl_parse(parser, (const unsigned char *)payload, payload_size)) == yajl_status_ok) {
+        status = yajl_complete_parse(parser);
+    }
+    if (status != yajl_status_ok) {
+        error_str = yajl_get_error(parser, 1, (const unsigned char *)payload, payload_size);
+        fprintf(stderr, "FATAL: jf_json_parse_video: yajl_parse error: %s\n", (char *)error_str);
+        yajl_free_error(parser, error_str);
+        yajl_free(parser);
+        jf_exit(JF_EXIT_FAILURE);
+    }
+    yajl_free(parser);
+}
+
+
+static inline const char *jf_sax_video_string_assert(const jf_sax_video_context *context,
+        const size_t offset,
+        const char *name)
+{
+    if (offset == JF_SAX_VIDEO_NO_STRING) {
+        fprintf(stderr, "FATAL: jf_json_parse_video: couldn't find JSON element \"%s\".\n", name);
+        jf_exit(JF_EXIT_FAILURE);
+    }
+    return context->strings->buf + offset;
+}
+
+
+static jf_menu_item *jf_json_parse_versions(const jf_menu_item *item,
+        const jf_sax_video_context *context,
+        const size_t part)
 {
     jf_menu_item **subs = NULL;
     size_t subs_count = 0;
+    size_t first = 0, count = 0;
     size_t i, j;
     char *tmp;
-    yajl_val media_streams, source, stream;
+    const char *id, *codec;
+    char source_id[JF_ID_LENGTH + 1];
+    const jf_sax_video_source *source;
+    const jf_sax_video_stream *stream;
     jf_growing_buffer buf;
 
-    if (YAJL_GET_ARRAY(media_sources)->len > 1) {
+    // the sources of a part come one after the other
+    while (first < context->sources_count && context->sources[first].part != part) {
+        first++;
+    }
+    while (first + count < context->sources_count && context->sources[first + count].part == part) {
+        count++;
+    }
+    if (count == 0) {
+        fprintf(stderr, "FATAL: jf_json_parse_video: no MediaSources for part %zu of %s.\n",
+                part + 1, item->name);
+        jf_exit(JF_EXIT_FAILURE);
+    }
+
+    if (count > 1) {
         buf = jf_growing_buffer_new(512);
         
         jf_growing_buffer_sprintf(buf, 0, "\nThere are multiple versions available of %s.\n", item->name);
         jf_growing_buffer_sprintf(buf, 0, "Please choose one:\n");
-        for (i = 0; i < YAJL_GET_ARRAY(media_sources)->len; i++) {
-            assert((source = YAJL_GET_ARRAY(media_sources)->values[i]) != NULL);
+        for (i = 0; i < count; i++) {
             jf_growing_buffer_sprintf(buf, 0, "%zu: %s (",
                     i + 1,
-                    YAJL_GET_STRING(jf_yajl_tree_get_assert(source,
-                            ((const char *[]){ "Name", NULL }),
-                            yajl_t_string)));
-            media_streams = jf_yajl_tree_get_assert(source,
-                    ((const char *[]){ "MediaStreams", NULL }),
-                    yajl_t_array);
-            for (j = 0; j < YAJL_GET_ARRAY(media_streams)->len; j++) {
-                assert((stream = YAJL_GET_ARRAY(media_streams)->values[j]) != NULL);
-                jf_growing_buffer_sprintf(buf, 0, " %s",
-                        YAJL_GET_STRING(jf_yajl_tree_get_assert(stream,
-                                ((const char *[]){ "DisplayTitle", NULL }),
-                                yajl_t_string)));
+                    jf_sax_video_string_assert(context,
+                        context->sources[first + i].name,
+                        "MediaSources.Name"));
+            for (j = 0; j < context->streams_count; j++) {
+                stream = context->streams + j;
+                if (stream->source == first + i && stream->display_title != JF_SAX_VIDEO_NO_STRING) {
+                    jf_growing_buffer_sprintf(buf, 0, " %s",
+                            context->strings->buf + stream->display_title);
+                }
             }
             jf_growing_buffer_sprintf(buf, 0, ")\n");
         }
-        i = jf_menu_user_ask_selection(buf->buf, 1, YAJL_GET_ARRAY(media_sources)->len);
+        i = jf_menu_user_ask_selection(buf->buf, 1, count);
         i--;
 
         jf_growing_buffer_free(buf);
@@ -597,110 +1480,92 @@ static jf_menu_item *jf_json_parse_versions(const jf_menu_item *item, const yajl
     }
 
     // external subtitles
-    assert((source = YAJL_GET_ARRAY(media_sources)->values[i]) != NULL);
-    media_streams = jf_yajl_tree_get_assert(source,
-            ((const char *[]){ "MediaStreams", NULL }),
-            yajl_t_array);
-    for (j = 0; j < YAJL_GET_ARRAY(media_streams)->len; j++) {
-        assert((stream = YAJL_GET_ARRAY(media_streams)->values[j]) != NULL);
-        char *codec = YAJL_GET_STRING(jf_yajl_tree_get_assert(stream,
-                    ((const char*[]){ "Codec", NULL}),
-                    yajl_t_string));
-        if (strcmp(YAJL_GET_STRING(jf_yajl_tree_get_assert(stream,
-                            ((const char *[]){ "Type", NULL }),
-                            yajl_t_string)),
-                    "Subtitle") == 0
-                && YAJL_IS_TRUE(jf_yajl_tree_get_assert(stream,
-                        ((const char *[]){ "IsExternal", NULL }),
-                        yajl_t_any))
-                && strcmp(codec, "sub") != 0) {
-            char *id = YAJL_GET_STRING(jf_yajl_tree_get_assert(source, ((const char *[]){ "Id", NULL }), yajl_t_string));
-            tmp = jf_concat(8,
-                    "/videos/",
-                    id,
-                    "/",
-                    id,
-                    "/subtitles/",
-                    YAJL_GET_NUMBER(jf_yajl_tree_get_assert(stream, ((const char *[]){ "Index", NULL }), yajl_t_number)),
-                    // 10.7.2 added routeStartPositionTicks
-                    g_state.server_version >= JF_SERVER_VERSION_MAKE(10,7,2) ?
-                    	"/0/stream." : "/stream",
-                    codec);
-            assert((subs = realloc(subs, ++subs_count * sizeof(jf_menu_item *))) != NULL);
-            subs[subs_count - 1] = jf_menu_item_new(JF_ITEM_TYPE_VIDEO_SUB,
-                    NULL, 0, // children, children_count
-                    NULL, // id
-                    tmp,
-                    YAJL_GET_STRING(jf_yajl_tree_get_assert(stream, ((const char *[]){ "Path", NULL }), yajl_t_string)),
-                    0, 0); // ticks
-            free(tmp);
-            if ((tmp = YAJL_GET_STRING(yajl_tree_get(stream, ((const char *[]){ "Language", NULL }), yajl_t_string))) == NULL) {
-                subs[subs_count - 1]->id[0] = '\0';
-            } else {
-                strncpy(subs[subs_count - 1]->id, tmp, 3);
-            }
-            strncpy(subs[subs_count - 1]->id + 3,
-                    YAJL_GET_STRING(jf_yajl_tree_get_assert(stream, ((const char *[]){ "DisplayTitle", NULL }), yajl_t_string)),
-                    JF_ID_LENGTH - 3);
-            subs[subs_count - 1]->id[JF_ID_LENGTH] = '\0';
+    source = context->sources + first + i;
+    id = jf_sax_video_string_assert(context, source->id, "MediaSources.Id");
+    for (j = 0; j < context->streams_count; j++) {
+        stream = context->streams + j;
+        if (stream->source != first + i
+                || ! stream->is_subtitle
+                || ! stream->is_external
+                || stream->codec == JF_SAX_VIDEO_NO_STRING) {
+            continue;
+        }
+        codec = context->strings->buf + stream->codec;
+        if (strcmp(codec, "sub") == 0) continue;
+        tmp = jf_concat(8,
+                "/videos/",
+                id,
+                "/",
+                id,
+                "/subtitles/",
+                jf_sax_video_string_assert(context, stream->index, "MediaStreams.Index"),
+                // 10.7.2 added routeStartPositionTicks
+                g_state.server_version >= JF_SERVER_VERSION_MAKE(10,7,2) ?
+                	"/0/stream." : "/stream",
+                codec);
+        assert((subs = realloc(subs, ++subs_count * sizeof(jf_menu_item *))) != NULL);
+        subs[subs_count - 1] = jf_menu_item_new(JF_ITEM_TYPE_VIDEO_SUB,
+                NULL, 0, // children, children_count
+                NULL, // id
+                tmp,
+                jf_sax_video_string_assert(context, stream->path, "MediaStreams.Path"),
+                0, 0); // ticks
+        free(tmp);
+        if (stream->language == JF_SAX_VIDEO_NO_STRING) {
+            subs[subs_count - 1]->id[0] = '\0';
+        } else {
+            strncpy(subs[subs_count - 1]->id, context->strings->buf + stream->language, 3);
         }
+        strncpy(subs[subs_count - 1]->id + 3,
+                jf_sax_video_string_assert(context, stream->display_title, "MediaStreams.DisplayTitle"),
+                JF_ID_LENGTH - 3);
+        subs[subs_count - 1]->id[JF_ID_LENGTH] = '\0';
     }
 
+    // jf_menu_item_new copies JF_ID_LENGTH bytes no matter what
+    strncpy(source_id, id, JF_ID_LENGTH);
+    source_id[JF_ID_LENGTH] = '\0';
     return jf_menu_item_new(JF_ITEM_TYPE_VIDEO_SOURCE,
             subs, subs_count,
-            YAJL_GET_STRING(jf_yajl_tree_get_assert(source, ((const char *[]){ "Id", NULL }), yajl_t_string)),
+            source_id,
             NULL,
-            YAJL_GET_STRING(jf_yajl_tree_get_assert(source, ((const char *[]){ "Path", NULL }), yajl_t_string)),
-            YAJL_GET_INTEGER(jf_yajl_tree_get_assert(source, ((const char *[]){ "RunTimeTicks", NULL }), yajl_t_number)), // RT ticks
+            jf_sax_video_string_assert(context, source->path, "MediaSources.Path"),
+            source->runtime_ticks, // RT ticks
             0);
 }
 
 
-void jf_json_parse_video(jf_menu_item *item, const char *video, const char *additional_parts)
+void jf_json_parse_video(jf_menu_item *item,
+        const char *video,
+        const size_t video_size,
+        const char *additional_parts,
+        const size_t additional_parts_size)
 {
-    yajl_val parsed, part_count, part_item;
+    jf_sax_video_context context = { 0 };
     size_t i;
 
-    JF_JSON_TREE_PARSE_ASSERT(
-        (parsed = yajl_tree_parse(video,
-            s_error_buffer,
-            JF_PARSER_ERROR_BUFFER_SIZE)) != NULL
-    );
+    context.strings = jf_growing_buffer_new(1024);
+
+    jf_sax_video_parse(&context, video, video_size);
     // PartCount is not defined when it is == 1
-    if ((part_count =  yajl_tree_get(parsed, (const char *[]){ "PartCount", NULL }, yajl_t_number)) == NULL) {
-        item->children_count = 1;
-    } else {
-        item->children_count = (size_t)YAJL_GET_INTEGER(part_count);
-    }
-    assert((item->children = malloc(item->children_count * sizeof(jf_menu_item *))) != NULL);
-    item->children[0] = jf_json_parse_versions(item,
-            jf_yajl_tree_get_assert(parsed,
-                ((const char *[]){ "MediaSources", NULL }),
-                yajl_t_array));
-    yajl_tree_free(parsed);
+    item->children_count = context.part_count > 1 ? (size_t)context.part_count : 1;
 
     // check for additional parts
     if (item->children_count > 1) {
-        s_error_buffer[0] = '\0';
-        if ((parsed = yajl_tree_parse(additional_parts,
-                        s_error_buffer,
-                        JF_PARSER_ERROR_BUFFER_SIZE)) == NULL) {
-            fprintf(stderr, "FATAL: jf_json_parse_additional_parts: %s\n",
-                    s_error_buffer[0] == '\0' ? "yajl_tree_parse unknown error" : s_error_buffer);
-            jf_exit(JF_EXIT_FAILURE);
-        }
-        for (i = 1; i < item->children_count; i++) {
-            part_item = YAJL_GET_ARRAY(jf_yajl_tree_get_assert(parsed,
-                        ((const char *[]){ "Items", NULL }),
-                        yajl_t_array))->values[i - 1];
-            item->children[i] = jf_json_parse_versions(item,
-                    jf_yajl_tree_get_assert(part_item,
-                        ((const char *[]){ "MediaSources", NULL }),
-                        yajl_t_array));
-        }
-        yajl_tree_free(parsed);
+        context.additional_parts = true;
+        context.parts = 1;
+        jf_sax_video_parse(&context, additional_parts, additional_parts_size);
     }
 
+    assert((item->children = malloc(item->children_count * sizeof(jf_menu_item *))) != NULL);
+    for (i = 0; i < item->children_count; i++) {
+        item->children[i] = jf_json_parse_versions(item, &context, i);
+    }
+
+    free(context.sources);
+    free(context.streams);
+    jf_growing_buffer_free(context.strings);
+
     // the parent item refers the same part as the first child. for the sake
     // of the resume interface, copy playback_ticks from parent to firstborn
     item->children[0]->playback_ticks = item->playback_ticks;
@@ -37,9 +37,15 @@ do {                                                                       \
 
 #define JF_SAX_KEY_IS(name) (JF_STATIC_STRLEN(name) == key_len && strncmp((const char *)key, name, JF_STATIC_STRLEN(name)) == 0)
 
-#define JF_SAX_STRING_IS(name) (JF_STATIC_STRLEN(name) == string_len && strncmp((const char *)string, name, JF_STATIC_STRLEN(name)) == 0)
+// for when the length is already known to match, e.g. in a switch on it
+#define JF_SAX_BYTES_ARE(_s, name) (memcmp((_s), name, JF_STATIC_STRLEN(name)) == 0)
 
-#define JF_SAX_PRINT_LEADER(tag) printf(tag " %zu: ", context->tb->item_count)
+#define JF_SAX_PRINT_LEADER(tag)                                    \
+do {                                                                \
+    if (! context->tb->quiet) {                                     \
+        printf(tag " %zu: ", context->tb->item_count);              \
+    }                                                               \
+} while (false)
 
 
 // NB THIS WILL NOT BE NULL-TERMINATED ON ITS OWN!!!
@@ -97,11 +103,42 @@ typedef enum jf_sax_parser_state {
     JF_SAX_IN_USERDATA_MAP = 19,
     JF_SAX_IN_USERDATA_VALUE = 20,
     JF_SAX_IN_USERDATA_TICKS_VALUE = 21,
+    JF_SAX_IN_TOTAL_RECORD_COUNT_VALUE = 22,
     JF_SAX_IGNORE = 127
 } jf_sax_parser_state;
 
 
 #define JF_PARSER_ERROR_BUFFER_SIZE 1024
+// nesting the pre-scanner keeps track of: past it, nothing gets dropped
+#define JF_SAX_PRESCAN_MAX_DEPTH 64
+// long enough for the longest key whose compound value we keep
+#define JF_SAX_PRESCAN_KEY_SIZE 8
+
+
+// Before yajl gets to see them, chunks go through a pre-scanner that drops
+// the maps and arrays the parser would only ignore, i.e. all compound values
+// in maps except for the "Items" of a query result and the "UserData" of an
+// item (think People, MediaStreams, ImageTags...). Each is replaced by a 0,
+// so that yajl still sees a value for the key. Only quotes, escapes and
+// brackets are looked at, with SIMD where available: the JSON is not
+// validated, which yajl still does on what's left.
+typedef struct jf_sax_prescan {
+    // nesting of the innermost open map or array, 0 outside of any
+    size_t depth;
+    // bit i set if the container at depth i + 1 is a map
+    unsigned long long maps;
+    // depth of the subtree being dropped, 0 if none
+    size_t skip_depth;
+    bool in_string;
+    // the last byte of the previous chunk was a backslash in a string
+    bool escaped;
+    // in a map, before the colon
+    bool expect_key;
+    bool in_key;
+    // the last key, truncated to its first bytes
+    char key[JF_SAX_PRESCAN_KEY_SIZE];
+    size_t key_len;
+} jf_sax_prescan;
 
 
 typedef struct jf_sax_context {
@@ -125,6 +162,7 @@ typedef struct jf_sax_context {
     size_t parent_index_start;  size_t parent_index_len;
     long long runtime_ticks;
     long long playback_ticks;
+    jf_sax_prescan prescan;
 } jf_sax_context;
 
 
@@ -133,7 +171,105 @@ void *jf_json_sax_thread(void *arg);
 
 
 ////////// VIDEO PARSING //////////
-void jf_json_parse_video(jf_menu_item *item, const char *video, const char *additional_parts);
+typedef enum jf_sax_video_state {
+    JF_SAX_VIDEO_NO_STATE = 0,
+    JF_SAX_VIDEO_IDLE = 1,
+    JF_SAX_VIDEO_IN_QUERYRESULT_MAP = 2,
+    JF_SAX_VIDEO_IN_ITEMS_VALUE = 3,
+    JF_SAX_VIDEO_IN_ITEMS_ARRAY = 4,
+    JF_SAX_VIDEO_IN_ITEM_MAP = 5,
+    JF_SAX_VIDEO_IN_PART_COUNT_VALUE = 6,
+    JF_SAX_VIDEO_IN_SOURCES_VALUE = 7,
+    JF_SAX_VIDEO_IN_SOURCES_ARRAY = 8,
+    JF_SAX_VIDEO_IN_SOURCE_MAP = 9,
+    JF_SAX_VIDEO_IN_SOURCE_ID_VALUE = 10,
+    JF_SAX_VIDEO_IN_SOURCE_NAME_VALUE = 11,
+    JF_SAX_VIDEO_IN_SOURCE_PATH_VALUE = 12,
+    JF_SAX_VIDEO_IN_SOURCE_RUNTIME_TICKS_VALUE = 13,
+    JF_SAX_VIDEO_IN_STREAMS_VALUE = 14,
+    JF_SAX_VIDEO_IN_STREAMS_ARRAY = 15,
+    JF_SAX_VIDEO_IN_STREAM_MAP = 16,
+    JF_SAX_VIDEO_IN_STREAM_TYPE_VALUE = 17,
+    JF_SAX_VIDEO_IN_STREAM_CODEC_VALUE = 18,
+    JF_SAX_VIDEO_IN_STREAM_IS_EXTERNAL_VALUE = 19,
+    JF_SAX_VIDEO_IN_STREAM_INDEX_VALUE = 20,
+    JF_SAX_VIDEO_IN_STREAM_PATH_VALUE = 21,
+    JF_SAX_VIDEO_IN_STREAM_LANGUAGE_VALUE = 22,
+    JF_SAX_VIDEO_IN_STREAM_DISPLAY_TITLE_VALUE = 23,
+    JF_SAX_VIDEO_IGNORE = 127
+} jf_sax_video_state;
+
+
+// offset of a string that was not in the JSON
+#define JF_SAX_VIDEO_NO_STRING ((size_t)-1)
+
+
+// Strings are offsets into the `strings` buffer of the context, each
+// \0-terminated, or JF_SAX_VIDEO_NO_STRING.
+typedef struct jf_sax_video_source {
+    // 0 for the item itself, i for the i-th of its additional parts
+    size_t part;
+    size_t id;
+    size_t name;
+    size_t path;
+    long long runtime_ticks;
+} jf_sax_video_source;
+
+
+typedef struct jf_sax_video_stream {
+    // index of the media source it belongs to
+    size_t source;
+    size_t display_title;
+    size_t codec;
+    size_t index;
+    size_t path;
+    size_t language;
+    bool is_subtitle;
+    bool is_external;
+} jf_sax_video_stream;
+
+
+// Only what goes into the jf_menu_item tree is kept: the ids, names, paths and
+// runtimes of the media sources, plus the display titles of their streams
+// and what it takes to request the external subtitles.
+typedef struct jf_sax_video_context {
+    jf_sax_video_state parser_state;
+    jf_sax_video_state state_to_resume;
+    size_t maps_ignoring;
+    size_t arrays_ignoring;
+    // whether the document is an /additionalparts query result
+    bool additional_parts;
+    // item maps parsed so far, i.e. the part the next sources belong to
+    size_t parts;
+    long long part_count;
+    jf_growing_buffer strings;
+    jf_sax_video_source *sources;
+    size_t sources_count;
+    jf_sax_video_stream *streams;
+    size_t streams_count;
+} jf_sax_video_context;
+
+
+// Parses the /users/{id}/items/{id} reply to a video and, if it has more than
+// one part, the /videos/{id}/additionalparts one into the children of the
+// item: a JF_ITEM_TYPE_VIDEO_SOURCE per part, with the external subtitles as
+// its children. The user is asked to pick one if a part comes in multiple
+// versions.
+// Both replies are streamed through yajl straight from their buffers, without
+// building a tree of either.
+//
+// Parameters:
+//  - item: the video item, whose children and children_count are set.
+//  - video: the payload of the item reply.
+//  - video_size: its length.
+//  - additional_parts: the payload of the /additionalparts reply.
+//  - additional_parts_size: its length.
+// CAN FATAL.
+void jf_json_parse_video(jf_menu_item *item,
+        const char *video,
+        const size_t video_size,
+        const char *additional_parts,
+        const size_t additional_parts_size);
 void jf_json_parse_playback_ticks(jf_menu_item *item, const char *payload);
 ///////////////////////////////////
 
@@ -30,6 +30,7 @@ mpv_handle *g_mpv_ctx = NULL;
 ////////// STATIC FUNCTIONS //////////
 static void jf_print_usage(void);
 static inline void jf_missing_arg(const char *arg);
+static void jf_sigint_handler(int sig);
 static inline void jf_mpv_event_dispatch(const mpv_event *event);
 //////////////////////////////////////
 
@@ -48,6 +49,16 @@ void jf_exit(int sig)
     mpv_terminate_destroy(g_mpv_ctx);
     _exit(sig == JF_EXIT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
 }
+
+
+// Ctrl-C gives up on whatever we're waiting for from the server, if anything,
+// instead of quitting.
+static void jf_sigint_handler(int sig)
+{
+    if (! jf_net_cancel_sync()) {
+        jf_exit(sig);
+    }
+}
 /////////////////////////////////////////
 
 
@@ -253,6 +264,7 @@ int main(int argc, char *argv[])
         sa.sa_flags = 0;
         sa.sa_sigaction = NULL;
         assert(sigaction(SIGABRT, &sa, NULL) == 0);
+        sa.sa_handler = jf_sigint_handler;
         assert(sigaction(SIGINT, &sa, NULL) == 0);
         // for the sake of multithreaded libcurl
         sa.sa_handler = SIG_IGN;
@@ -456,6 +468,13 @@ int main(int argc, char *argv[])
     ///////////////////////
 
 
+    // RESTORE PLAYLIST
+    if (g_options.persistent_playlist) {
+        jf_menu_playlist_resume();
+    }
+    ///////////////////
+
+
     ////////// MAIN LOOP //////////
     while (true) {
         switch (g_state.state) {
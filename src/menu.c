@@ -11,7 +11,6 @@
 #include <stdio.h>
 #include <errno.h>
 #include <assert.h>
-#include <time.h>
 
 
 ////////// COMMAND PARSER //////////
@@ -86,8 +85,38 @@ static jf_menu_stack s_menu_stack = (jf_menu_stack){ 0 };
 static jf_menu_item *s_context = NULL;
 
 // ITEM FLAG SET REQUESTS TRACKING
-static jf_reply *s_played_status_requests[JF_FLAG_CHANGE_REQUESTS_LEN];
-static struct timespec s_25msec = (struct timespec){ 0, 25 * 1000000 };
+// the pipeline is s_flag_width wide, s_flag_items[i] is the child the
+// request in s_flag_replies[i] is about
+static jf_reply **s_flag_replies = NULL;
+static size_t *s_flag_items = NULL;
+static size_t s_flag_width = 0;
+// since the last jf_menu_item_set_flag_await_all
+static size_t s_flag_queued = 0;
+static size_t s_flag_done = 0;
+static jf_flag_error *s_flag_errors = NULL;
+static size_t s_flag_errors_count = 0;
+static size_t s_flag_errors_size = 0;
+
+// STALE LISTING REVALIDATION
+static jf_reply *s_revalidation = NULL;
+static char *s_revalidation_stale = NULL;
+static size_t s_revalidation_stale_size = 0;
+static jf_request_type s_revalidation_type;
+
+// PAGED LISTINGS
+static char *s_paging_url = NULL; // NULL unless the listing on screen is paged
+static jf_request_type s_paging_type;
+static size_t s_paging_total = 0;
+static size_t s_paging_next = 0;
+// pages being fetched, in order, from s_paging_pages[s_paging_head] on
+static jf_reply **s_paging_pages = NULL;
+static size_t s_paging_pages_size = 0;
+static size_t s_paging_head = 0;
+static size_t s_paging_count = 0;
+// pages of listings left behind, freed once they're done
+static jf_reply **s_paging_orphans = NULL;
+static size_t s_paging_orphans_count = 0;
+static size_t s_paging_orphans_size = 0;
 
 // FILTERS STUFF
 static jf_filter_mask s_filters = JF_FILTER_NONE;
@@ -128,8 +157,13 @@ static inline jf_menu_item *jf_menu_stack_pop(void);
 // CAN'T FAIL.
 static inline const jf_menu_item *jf_menu_stack_peek(const size_t pos);
 
-static inline void jf_menu_set_flag_request_resolve(jf_reply *r);
-static inline char *jf_menu_set_flag_request_get_url(const jf_menu_item *item, const jf_flag_type flag_type);
+static void jf_menu_set_flag_request_resolve(const size_t i);
+static void jf_menu_set_flag_request_reap(void);
+static void jf_menu_set_flag_progress_print(void);
+static void jf_menu_set_flag_request_push(const size_t n,
+        const jf_flag_type flag_type,
+        const bool flag_status);
+static inline char *jf_menu_set_flag_request_get_url(const char *id, const jf_flag_type flag_type);
 
 static const char *jf_menu_filter_string(const jf_filter filter);
 static bool jf_menu_item_type_allows_filter(const jf_item_type type, const jf_filter filter);
@@ -139,9 +173,32 @@ static bool jf_menu_filters_query_try_append(const bool first_filter, const jf_f
 static void jf_menu_filters_apply(void);
 
 static jf_menu_item *jf_menu_child_get(size_t n);
+static jf_menu_listing_entry *jf_menu_listing_snapshot(size_t *count);
+static int jf_menu_listing_entry_cmp(const void *a, const void *b);
+static void jf_menu_listing_free(jf_menu_listing_entry *entries, const size_t count);
+static void jf_menu_listing_print_diff(const jf_menu_listing_entry *old,
+        const size_t old_count,
+        const jf_menu_listing_entry *new,
+        const size_t new_count);
+static void jf_menu_revalidation_clear(void);
+static bool jf_menu_revalidation_check(void);
+static bool jf_menu_item_type_is_paged(const jf_item_type type);
+static char *jf_menu_paging_get_url(const size_t start);
+static inline bool jf_menu_paging_is_active(void);
+static void jf_menu_paging_reap(void);
+static void jf_menu_paging_drop_pages(void);
+static void jf_menu_paging_clear(void);
+static jf_reply *jf_menu_paging_fetch(const size_t start, const jf_request_priority priority);
+static void jf_menu_paging_request(const jf_request_priority priority);
+static void jf_menu_paging_promote(void);
+static void jf_menu_paging_prefetch(void);
+static void jf_menu_paging_start(void);
+static void jf_menu_paging_ingest_head(void);
+static void jf_menu_paging_poll(void);
+static void jf_menu_paging_load_until(size_t n);
 static bool jf_menu_print_context(void);
 static bool jf_menu_ask_resume_yn(const jf_menu_item *item, const long long ticks);
-static void jf_menu_try_play(void);
+static void jf_menu_try_play(const size_t position);
 
 static char *jf_menu_item_get_remote_url(const jf_menu_item *item);
 //////////////////////////////////////
@@ -546,6 +603,7 @@ static jf_menu_item *jf_menu_child_get(size_t n)
     if (s_context == NULL) return NULL;
 
     if (JF_ITEM_TYPE_HAS_DYNAMIC_CHILDREN(s_context->type)) {
+        jf_menu_paging_load_until(n);
         return jf_disk_payload_get_item(n);
     } else {
         return n - 1 <= s_context->children_count ? s_context->children[n - 1]
@@ -554,18 +612,441 @@ static jf_menu_item *jf_menu_child_get(size_t n)
 }
 
 
+// Copies the ids and names of the current payload, in order.
+static jf_menu_listing_entry *jf_menu_listing_snapshot(size_t *count)
+{
+    jf_menu_listing_entry *entries;
+    jf_disk_item_view view;
+    size_t i;
+
+    *count = jf_disk_payload_item_count();
+    assert((entries = malloc((*count + 1) * sizeof(jf_menu_listing_entry))) != NULL);
+    for (i = 0; i < *count; i++) {
+        assert(jf_disk_payload_get_view(i + 1, &view));
+        strncpy(entries[i].id, view.id, JF_ID_LENGTH);
+        entries[i].id[JF_ID_LENGTH] = '\0';
+        assert((entries[i].name = strdup(view.name == NULL ? "" : view.name)) != NULL);
+        entries[i].n = i + 1;
+    }
+
+    return entries;
+}
+
+
+static int jf_menu_listing_entry_cmp(const void *a, const void *b)
+{
+    return strcmp(((const jf_menu_listing_entry *)a)->id,
+            ((const jf_menu_listing_entry *)b)->id);
+}
+
+
+static void jf_menu_listing_free(jf_menu_listing_entry *entries, const size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        free(entries[i].name);
+    }
+    free(entries);
+}
+
+
+// Prints which items were added to and removed from a listing, in listing
+// order.
+static void jf_menu_listing_print_diff(const jf_menu_listing_entry *old,
+        const size_t old_count,
+        const jf_menu_listing_entry *new,
+        const size_t new_count)
+{
+    jf_menu_listing_entry *old_sorted, *new_sorted;
+    size_t i, added = 0, removed = 0;
+
+    assert((old_sorted = malloc((old_count + 1) * sizeof(jf_menu_listing_entry))) != NULL);
+    memcpy(old_sorted, old, old_count * sizeof(jf_menu_listing_entry));
+    qsort(old_sorted, old_count, sizeof(jf_menu_listing_entry), jf_menu_listing_entry_cmp);
+    assert((new_sorted = malloc((new_count + 1) * sizeof(jf_menu_listing_entry))) != NULL);
+    memcpy(new_sorted, new, new_count * sizeof(jf_menu_listing_entry));
+    qsort(new_sorted, new_count, sizeof(jf_menu_listing_entry), jf_menu_listing_entry_cmp);
+
+    for (i = 0; i < new_count; i++) {
+        if (bsearch(new + i, old_sorted, old_count,
+                    sizeof(jf_menu_listing_entry), jf_menu_listing_entry_cmp) != NULL) {
+            continue;
+        }
+        if (added++ < JF_MENU_LISTING_DIFF_MAX_LINES) {
+            printf("+ %zu: %s\n", new[i].n, new[i].name);
+        }
+    }
+    if (added > JF_MENU_LISTING_DIFF_MAX_LINES) {
+        printf("+ ... and %zu more\n", added - JF_MENU_LISTING_DIFF_MAX_LINES);
+    }
+    for (i = 0; i < old_count; i++) {
+        if (bsearch(old + i, new_sorted, new_count,
+                    sizeof(jf_menu_listing_entry), jf_menu_listing_entry_cmp) != NULL) {
+            continue;
+        }
+        if (removed++ < JF_MENU_LISTING_DIFF_MAX_LINES) {
+            printf("- %s\n", old[i].name);
+        }
+    }
+    if (removed > JF_MENU_LISTING_DIFF_MAX_LINES) {
+        printf("- ... and %zu more\n", removed - JF_MENU_LISTING_DIFF_MAX_LINES);
+    }
+    if (added == 0 && removed == 0) {
+        printf("(items were reordered)\n");
+    }
+
+    free(old_sorted);
+    free(new_sorted);
+}
+
+
+static void jf_menu_revalidation_clear(void)
+{
+    if (s_revalidation != NULL) {
+        jf_reply_free(jf_net_await(s_revalidation));
+        s_revalidation = NULL;
+    }
+    free(s_revalidation_stale);
+    s_revalidation_stale = NULL;
+    s_revalidation_stale_size = 0;
+}
+
+
+// Waits for the revalidation of the listing on screen, if any. If it changed,
+// the new one is ingested without printing it.
+//
+// Returns:
+//  true if the items changed or moved, meaning the indexes the user typed
+//  their command against are no longer valid: the changes are printed and the
+//  command should be discarded.
+// CAN FATAL.
+static bool jf_menu_revalidation_check(void)
+{
+    jf_reply *reply;
+    jf_menu_listing_entry *old, *new;
+    size_t old_count, new_count, i;
+    bool changed = false;
+
+    if (s_revalidation == NULL) return false;
+
+    jf_net_await(s_revalidation);
+    if (JF_REPLY_PTR_HAS_ERROR(s_revalidation)) {
+        fprintf(stderr,
+                "Warning: could not check if the listing is up to date: %s.\n",
+                jf_reply_error_string(s_revalidation));
+        goto end;
+    }
+    if (s_revalidation->size == s_revalidation_stale_size
+            && memcmp(s_revalidation->payload,
+                s_revalidation_stale,
+                s_revalidation_stale_size) == 0) {
+        goto end;
+    }
+
+    old = jf_menu_listing_snapshot(&old_count);
+    reply = jf_net_sax_digest(s_revalidation->payload,
+            s_revalidation->size,
+            s_revalidation_type,
+            true,
+            false);
+    if (JF_REPLY_PTR_HAS_ERROR(reply)) {
+        fprintf(stderr,
+                "Warning: could not refresh the listing: %s.\n",
+                jf_reply_error_string(reply));
+        jf_thread_buffer_clear_error();
+        // go back to what is on screen
+        jf_reply_free(reply);
+        reply = jf_net_sax_digest(s_revalidation_stale,
+                s_revalidation_stale_size,
+                s_revalidation_type,
+                true,
+                false);
+        jf_reply_free(reply);
+        jf_menu_listing_free(old, old_count);
+        goto end;
+    }
+    jf_reply_free(reply);
+    // the other pages may have moved as well: get them again
+    if (s_paging_url != NULL) jf_menu_paging_start();
+    new = jf_menu_listing_snapshot(&new_count);
+
+    // details like the played status may change without moving anything
+    if (old_count != new_count) {
+        changed = true;
+    } else {
+        for (i = 0; i < new_count; i++) {
+            if (strcmp(old[i].id, new[i].id) != 0) {
+                changed = true;
+                break;
+            }
+        }
+    }
+    if (changed) {
+        printf("\nThe listing changed since it was last seen:\n");
+        jf_menu_listing_print_diff(old, old_count, new, new_count);
+        printf("Please enter your command again.\n");
+    }
+
+    jf_menu_listing_free(old, old_count);
+    jf_menu_listing_free(new, new_count);
+
+end:
+    jf_menu_revalidation_clear();
+    return changed;
+}
+
+
+static bool jf_menu_item_type_is_paged(const jf_item_type type)
+{
+    switch (type) {
+        case JF_ITEM_TYPE_COLLECTION:
+        case JF_ITEM_TYPE_FOLDER:
+        case JF_ITEM_TYPE_ALBUM:
+        case JF_ITEM_TYPE_SEASON:
+        case JF_ITEM_TYPE_COLLECTION_MUSIC:
+        case JF_ITEM_TYPE_COLLECTION_SERIES:
+        case JF_ITEM_TYPE_COLLECTION_MOVIES:
+        case JF_ITEM_TYPE_COLLECTION_MUSIC_VIDEOS:
+        case JF_ITEM_TYPE_PLAYLIST:
+        case JF_ITEM_TYPE_ARTIST:
+        case JF_ITEM_TYPE_SEARCH_RESULT:
+        case JF_ITEM_TYPE_MENU_FAVORITES:
+        case JF_ITEM_TYPE_MENU_CONTINUE:
+        case JF_ITEM_TYPE_MENU_NEXT_UP:
+            return true;
+        // these are either short or don't honour startindex
+        default:
+            return false;
+    }
+}
+
+
+static char *jf_menu_paging_get_url(const size_t start)
+{
+    char start_str[24], limit_str[24];
+
+    snprintf(start_str, sizeof(start_str), "%zu", start);
+    snprintf(limit_str, sizeof(limit_str), "%zu", g_options.page_size);
+    return jf_concat(5, s_paging_url, "&startindex=", start_str,
+            "&limit=", limit_str);
+}
+
+
+static inline bool jf_menu_paging_is_active(void)
+{
+    return s_paging_url != NULL
+        && (s_paging_count > 0 || s_paging_next < s_paging_total);
+}
+
+
+static void jf_menu_paging_reap(void)
+{
+    size_t i, kept = 0;
+
+    for (i = 0; i < s_paging_orphans_count; i++) {
+        if (JF_REPLY_PTR_IS_PENDING(s_paging_orphans[i])) {
+            s_paging_orphans[kept++] = s_paging_orphans[i];
+        } else {
+            jf_reply_free(s_paging_orphans[i]);
+        }
+    }
+    s_paging_orphans_count = kept;
+}
+
+
+// Gives up on the pages being fetched without waiting for them.
+static void jf_menu_paging_drop_pages(void)
+{
+    jf_reply *page;
+
+    jf_menu_paging_reap();
+    while (s_paging_count > 0) {
+        page = s_paging_pages[s_paging_head++];
+        s_paging_count--;
+        if (! JF_REPLY_PTR_IS_PENDING(page)) {
+            jf_reply_free(page);
+            continue;
+        }
+        jf_net_cancel(page);
+        if (s_paging_orphans_count == s_paging_orphans_size) {
+            s_paging_orphans_size = s_paging_orphans_size == 0 ?
+                JF_MENU_PREFETCH_PAGES : s_paging_orphans_size * 2;
+            assert((s_paging_orphans = realloc(s_paging_orphans,
+                        s_paging_orphans_size * sizeof(jf_reply *))) != NULL);
+        }
+        s_paging_orphans[s_paging_orphans_count++] = page;
+    }
+    s_paging_head = 0;
+}
+
+
+static void jf_menu_paging_clear(void)
+{
+    jf_menu_paging_drop_pages();
+    free(s_paging_url);
+    s_paging_url = NULL;
+    s_paging_total = 0;
+    s_paging_next = 0;
+}
+
+
+static jf_reply *jf_menu_paging_fetch(const size_t start, const jf_request_priority priority)
+{
+    jf_reply *page;
+    char *url;
+
+    url = jf_menu_paging_get_url(start);
+    page = jf_net_request_priority(url,
+            s_paging_type == JF_REQUEST_SAX_PROMISCUOUS ?
+                JF_REQUEST_ASYNC_SAX_PROMISCUOUS : JF_REQUEST_ASYNC_SAX,
+            JF_HTTP_GET,
+            NULL,
+            priority);
+    free(url);
+    return page;
+}
+
+
+// Starts fetching the next page.
+static void jf_menu_paging_request(const jf_request_priority priority)
+{
+
+    if (s_paging_head + s_paging_count == s_paging_pages_size) {
+        if (s_paging_head > 0) {
+            memmove(s_paging_pages,
+                    s_paging_pages + s_paging_head,
+                    s_paging_count * sizeof(jf_reply *));
+            s_paging_head = 0;
+        } else {
+            s_paging_pages_size = s_paging_pages_size == 0 ?
+                JF_MENU_PREFETCH_PAGES : s_paging_pages_size * 2;
+            assert((s_paging_pages = realloc(s_paging_pages,
+                        s_paging_pages_size * sizeof(jf_reply *))) != NULL);
+        }
+    }
+
+    s_paging_pages[s_paging_head + s_paging_count] = jf_menu_paging_fetch(s_paging_next, priority);
+    s_paging_count++;
+    s_paging_next += g_options.page_size;
+}
+
+
+// Tops up the window of pages being fetched.
+static void jf_menu_paging_prefetch(void)
+{
+    while (s_paging_count < JF_MENU_PREFETCH_PAGES
+            && s_paging_next < s_paging_total) {
+        jf_menu_paging_request(JF_REQUEST_PRIORITY_PREFETCH);
+    }
+}
+
+
+// Moves the window of pages being fetched up to interactive priority, for when
+// the user is about to wait on it: otherwise the head page could start after
+// the ones requested next, or get dropped while still queued. Those dropped
+// already are requested again.
+static void jf_menu_paging_promote(void)
+{
+    jf_reply **page;
+    size_t i;
+
+    for (i = 0; i < s_paging_count; i++) {
+        page = s_paging_pages + s_paging_head + i;
+        if (JF_REPLY_PTR_IS_PENDING(*page)) {
+            jf_net_promote(*page);
+        } else if ((*page)->state == JF_REPLY_ERROR_DROPPED) {
+            jf_reply_free(*page);
+            *page = jf_menu_paging_fetch(s_paging_next - (s_paging_count - i) * g_options.page_size,
+                    JF_REQUEST_PRIORITY_INTERACTIVE);
+        }
+    }
+}
+
+
+// Starts fetching the pages that follow the one just ingested, dropping any
+// older ones.
+static void jf_menu_paging_start(void)
+{
+    jf_menu_paging_drop_pages();
+    s_paging_total = jf_thread_buffer_total_record_count();
+    s_paging_next = g_options.page_size;
+    jf_menu_paging_prefetch();
+}
+
+
+// Waits for the oldest page being fetched and appends it to the payload
+// cache. Pages are parsed as they come down, each by a parser of its own, so
+// that only leaves splicing the items in. On failure, the listing is cut
+// short where it is.
+static void jf_menu_paging_ingest_head(void)
+{
+    jf_reply *page;
+
+    page = jf_net_await(s_paging_pages[s_paging_head++]);
+    s_paging_count--;
+
+    if (JF_REPLY_PTR_HAS_ERROR(page)) {
+        fprintf(stderr,
+                "Warning: could not load the items past %zu: %s.\n",
+                jf_disk_payload_item_count(),
+                jf_reply_error_string(page));
+        jf_reply_free(page);
+        jf_menu_paging_clear();
+        return;
+    }
+    jf_disk_payload_splice_scratch(page->items);
+    jf_reply_free(page);
+}
+
+
+// Ingests, in order, the pages that are already there, without waiting.
+static void jf_menu_paging_poll(void)
+{
+    jf_menu_paging_reap();
+    while (s_paging_count > 0
+            && ! JF_REPLY_PTR_IS_PENDING(s_paging_pages[s_paging_head])) {
+        jf_menu_paging_ingest_head();
+        jf_menu_paging_prefetch();
+    }
+}
+
+
+// Makes sure the payload cache holds at least the first n items of the
+// listing, or as many as there are. All the pages this takes are requested
+// at once, so that they come down over as many connections as there are
+// (think "*" on a big library over a slow link), then ingested in order as
+// they arrive.
+static void jf_menu_paging_load_until(size_t n)
+{
+    if (n > s_paging_total) n = s_paging_total;
+    jf_menu_paging_promote();
+    while (s_paging_next < n) {
+        jf_menu_paging_request(JF_REQUEST_PRIORITY_INTERACTIVE);
+    }
+    while (s_paging_count > 0 && jf_disk_payload_item_count() < n) {
+        jf_menu_paging_ingest_head();
+        jf_menu_paging_prefetch();
+    }
+}
+
+
 static bool jf_menu_print_context(void)
 {
     size_t i;
     jf_request_type request_type = JF_REQUEST_SAX;
     jf_reply *reply;
-    char *request_url;
+    char *request_url, *stale;
+    char *paged_url = NULL;
+    size_t stale_size;
 
     if (s_context == NULL) {
         fprintf(stderr, "Error: jf_menu_print_context: s_context == NULL. This is a bug.\n");
         return false;
     }
 
+    jf_menu_paging_clear();
+
     switch (s_context->type) {
         // DYNAMIC FOLDERS: fetch children, parser prints entries
         case JF_ITEM_TYPE_COLLECTION:
@@ -598,8 +1079,37 @@ static bool jf_menu_print_context(void)
             JF_DEBUG_PRINTF("%s URL: %s\n",
                     jf_item_type_get_name(s_context->type),
                     request_url);
-            reply = jf_net_request(request_url, request_type, JF_HTTP_GET, NULL);
+            jf_menu_revalidation_clear();
+            if (g_options.page_size > 0
+                    && jf_menu_item_type_is_paged(s_context->type)) {
+                assert((s_paging_url = strdup(request_url)) != NULL);
+                s_paging_type = request_type;
+                request_url = paged_url = jf_menu_paging_get_url(0);
+            }
+            if ((stale = jf_net_http_cache_get(request_url, &stale_size)) != NULL) {
+                // show what we've got and check it's still current meanwhile
+                reply = jf_net_sax_digest(stale, stale_size, request_type, false, false);
+                if (JF_REPLY_PTR_HAS_ERROR(reply)) {
+                    // just ask the server then
+                    free(stale);
+                    jf_reply_free(reply);
+                    jf_thread_buffer_clear_error();
+                    reply = jf_net_request(request_url, request_type, JF_HTTP_GET, NULL);
+                } else {
+                    s_revalidation = jf_net_request(request_url,
+                            JF_REQUEST_ASYNC_IN_MEMORY,
+                            JF_HTTP_GET,
+                            NULL);
+                    s_revalidation_stale = stale;
+                    s_revalidation_stale_size = stale_size;
+                    s_revalidation_type = request_type;
+                }
+            } else {
+                reply = jf_net_request(request_url, request_type, JF_HTTP_GET, NULL);
+            }
+            free(paged_url);
             if (JF_REPLY_PTR_HAS_ERROR(reply)) {
+                jf_menu_paging_clear();
                 jf_menu_item_free(s_context);
                 fprintf(stderr, "Error: %s.\n", jf_reply_error_string(reply));
                 jf_reply_free(reply);
@@ -607,6 +1117,13 @@ static bool jf_menu_print_context(void)
                 return false;
             }
             jf_reply_free(reply);
+            if (s_paging_url != NULL) {
+                jf_menu_paging_start();
+                if (jf_menu_paging_is_active()) {
+                    printf("(%zu more, loaded in the background)\n",
+                            s_paging_total - jf_disk_payload_item_count());
+                }
+            }
             jf_menu_stack_push(s_context);
             break;
         // PERSISTENT FOLDERS
@@ -763,11 +1280,11 @@ bool jf_menu_ask_resume(jf_menu_item *item)
 }
 
 
-static void jf_menu_try_play(void)
+static void jf_menu_try_play(const size_t position)
 {
     jf_menu_item *item;
 
-    if (jf_disk_playlist_item_count() == 0) return;
+    if (position == 0 || position > jf_disk_playlist_item_count()) return;
 
     g_mpv_ctx = jf_mpv_create();
 
@@ -779,8 +1296,8 @@ static void jf_menu_try_play(void)
     g_state.loop_state = JF_LOOP_STATE_IN_SYNC;
 
     // actually try and play
-    item = jf_disk_playlist_get_item(1);
-    g_state.playlist_position = 1;
+    item = jf_disk_playlist_get_item(position);
+    g_state.playlist_position = position;
     if (jf_playback_play_item(item) == false) return;
 #ifdef JF_DEBUG
     jf_menu_item_print(item);
@@ -796,6 +1313,7 @@ jf_item_type jf_menu_child_get_type(size_t n)
     if (s_context == NULL) return JF_ITEM_TYPE_NONE;
 
     if (JF_ITEM_TYPE_HAS_DYNAMIC_CHILDREN(s_context->type)) {
+        jf_menu_paging_load_until(n);
         return jf_disk_payload_get_type(n);
     } else {
         return n - 1 < s_context->children_count ?
@@ -804,21 +1322,41 @@ jf_item_type jf_menu_child_get_type(size_t n)
 }
 
 
-bool jf_menu_child_dispatch(size_t n)
+void jf_menu_child_get_types(const size_t first,
+        const size_t last,
+        jf_item_type *types)
 {
-    jf_menu_item *child = jf_menu_child_get(n);
+    size_t i;
+
+    if (s_context != NULL && JF_ITEM_TYPE_HAS_DYNAMIC_CHILDREN(s_context->type)) {
+        jf_menu_paging_load_until(last);
+        jf_disk_payload_get_types(first, last, types);
+        return;
+    }
+
+    for (i = first; i <= last; i++) {
+        *types++ = jf_menu_child_get_type(i);
+        if (i == last) break;
+    }
+}
 
-    if (child == NULL) return true;
 
-    switch (child->type) {
+bool jf_menu_child_dispatch(size_t n)
+{
+    jf_item_type child_type = jf_menu_child_get_type(n);
+
+    switch (child_type) {
+        case JF_ITEM_TYPE_NONE:
+            break;
         // ATOMS: add to playlist
+        // they only ever come from the payload cache, so copy the record over
+        // as is
         case JF_ITEM_TYPE_AUDIO:
         case JF_ITEM_TYPE_AUDIOBOOK:
         case JF_ITEM_TYPE_EPISODE:
         case JF_ITEM_TYPE_MOVIE:
         case JF_ITEM_TYPE_MUSIC_VIDEO:
-            jf_disk_playlist_add_item(child);
-            jf_menu_item_free(child);
+            jf_disk_playlist_splice(n, n);
             break;
         // FOLDERS: push on stack
         case JF_ITEM_TYPE_COLLECTION:
@@ -838,14 +1376,13 @@ bool jf_menu_child_dispatch(size_t n)
         case JF_ITEM_TYPE_ALBUM:
         case JF_ITEM_TYPE_SEASON:
         case JF_ITEM_TYPE_SERIES:
-            jf_menu_stack_push(child);
+            jf_menu_stack_push(jf_menu_child_get(n));
             break;
         default:
             fprintf(stderr,
                     "Error: jf_menu_child_dispatch unsupported menu item type (%d) for item %zu. This is a bug.\n",
-                    child->type,
+                    child_type,
                     n);
-            jf_menu_item_free(child);
             return false;
     }
 
@@ -853,11 +1390,41 @@ bool jf_menu_child_dispatch(size_t n)
 }
 
 
+bool jf_menu_child_dispatch_range(const size_t first, const size_t last)
+{
+    size_t n = first;
+    size_t spliced;
+
+    if (s_context == NULL || ! JF_ITEM_TYPE_HAS_DYNAMIC_CHILDREN(s_context->type)) {
+        for (n = first; n <= last; n++) {
+            if (! jf_menu_child_dispatch(n)) return false;
+        }
+        return true;
+    }
+
+    // runs of atoms go over in bulk, anything else one at a time
+    jf_menu_paging_load_until(last);
+    while (n <= last) {
+        if ((spliced = jf_disk_playlist_splice(n, last)) == 0) {
+            if (! jf_menu_child_dispatch(n)) return false;
+            spliced = 1;
+        }
+        n += spliced;
+    }
+    return true;
+}
+
+
 size_t jf_menu_child_count(void)
 {
     if (s_context == NULL) return 0;
 
     if (JF_ITEM_TYPE_HAS_DYNAMIC_CHILDREN(s_context->type)) {
+        // pages yet to be loaded count already, they're loaded when needed
+        if (jf_menu_paging_is_active()
+                && s_paging_total > jf_disk_payload_item_count()) {
+            return s_paging_total;
+        }
         return jf_disk_payload_item_count();
     } else {
         return s_context->children_count;
@@ -870,6 +1437,7 @@ void jf_menu_help(void) {
            "    | ( \"?\" | \"help\" )            (print this help message)\n"
            "    | \"h\"                         (go to \"home\" root menu)\n"
            "    | \"..\"                        (go to previous menu)\n"
+           "    | \"stats\"                     (print network statistics)\n"
            "    | \"f\" ( \"c\" | [pufrld]+ )     (filters: clear or played, unplayed, favorite, resumable, liked, disliked)\n"
            "    | \"m\" ( \"p\" | \"u\" ) Selector  (marks items played or unplayed)\n"
            "    | \"m\" ( \"f\" | \"uf\" ) Selector (marks items favorite or unfavorite)\n"
@@ -905,101 +1473,220 @@ void jf_menu_quit(void)
 }
 
 
+void jf_menu_stats(void)
+{
+    jf_net_stats_print();
+}
+
+
 ////////// PLAYED STATUS //////////
-static inline void jf_menu_set_flag_request_resolve(jf_reply *r)
-// TODO save the menu index contextually with the request so we can fetch item name
+// Awaits the request in slot i of the pipeline and frees the slot up, noting
+// the failure down if any.
+// CAN FATAL.
+static void jf_menu_set_flag_request_resolve(const size_t i)
 {
+    jf_reply *r = s_flag_replies[i];
+    jf_disk_item_view child;
+    jf_flag_error *e;
+
     jf_net_await(r);
     if (JF_REPLY_PTR_HAS_ERROR(r)) {
-        fprintf(stderr,
-                "Warning: played status of item could not be updated: %s.\n",
-                jf_reply_error_string(r));
+        if (s_flag_errors_count == s_flag_errors_size) {
+            s_flag_errors_size = s_flag_errors_size == 0 ? 16 : 2 * s_flag_errors_size;
+            assert((s_flag_errors = realloc(s_flag_errors,
+                            s_flag_errors_size * sizeof(jf_flag_error))) != NULL);
+        }
+        e = s_flag_errors + s_flag_errors_count++;
+        e->n = s_flag_items[i];
+        e->name = NULL;
+        if (jf_disk_payload_get_view(e->n, &child) && child.name != NULL) {
+            assert((e->name = strdup(child.name)) != NULL);
+        }
+        assert((e->error = strdup(jf_reply_error_string(r))) != NULL);
     }
     jf_reply_free(r);
+    s_flag_replies[i] = NULL;
+    s_flag_done++;
+}
+
+
+// Resolves the requests in the pipeline that are done already, without
+// blocking.
+static void jf_menu_set_flag_request_reap(void)
+{
+    size_t i;
+
+    for (i = 0; i < s_flag_width; i++) {
+        if (s_flag_replies[i] != NULL && ! JF_REPLY_PTR_IS_PENDING(s_flag_replies[i])) {
+            jf_menu_set_flag_request_resolve(i);
+        }
+    }
 }
 
 
-static inline char *jf_menu_set_flag_request_get_url(const jf_menu_item *item, const jf_flag_type flag_type)
+static void jf_menu_set_flag_progress_print(void)
+{
+    // not worth it for a handful of items
+    if (s_flag_queued <= s_flag_width) return;
+    printf("\rUpdating items: %zu/%zu", s_flag_done, s_flag_queued);
+    fflush(stdout);
+}
+
+
+static inline char *jf_menu_set_flag_request_get_url(const char *id, const jf_flag_type flag_type)
 {
     switch (flag_type) {
         case JF_FLAG_TYPE_PLAYED:
-            return jf_concat(4, "/users/", g_options.userid, "/playeditems/", item->id);
+            return jf_concat(4, "/users/", g_options.userid, "/playeditems/", id);
         case JF_FLAG_TYPE_FAVORITE:
-            return jf_concat(4, "/users/", g_options.userid, "/favoriteitems/", item->id);
+            return jf_concat(4, "/users/", g_options.userid, "/favoriteitems/", id);
     }
 
     return NULL;
 }
 
 
-// FIXME: of course this doesn't work fine on split files :))))))
-// we need to manually set each sub-child like we do in jf_playback_progress_update
-void jf_menu_child_set_flag(const size_t n, const jf_flag_type flag_type, const bool flag_status)
+// Sends the flag change for child n down the pipeline, waiting for a slot to
+// free up if it's full. No-op if n is out of bounds.
+// REQUIRES: the page holding child n is loaded.
+// CAN FATAL.
+static void jf_menu_set_flag_request_push(const size_t n,
+        const jf_flag_type flag_type,
+        const bool flag_status)
 {
-    jf_menu_item *child;
+    jf_disk_item_view child;
     char *url;
     size_t i;
 
-    if ((child = jf_menu_child_get(n)) == NULL) return;
+    if (! jf_disk_payload_get_view(n, &child)) return;
 
-    url = jf_menu_set_flag_request_get_url(child, flag_type);
-
-    // look for next free spot
-    for (i = 0; i < JF_FLAG_CHANGE_REQUESTS_LEN; i++) {
-        if (s_played_status_requests[i] == NULL) break;
+    if (s_flag_replies == NULL) {
+        s_flag_width = g_options.flag_requests > 0 ? g_options.flag_requests : 1;
+        assert((s_flag_replies = calloc(s_flag_width, sizeof(jf_reply *))) != NULL);
+        assert((s_flag_items = malloc(s_flag_width * sizeof(size_t))) != NULL);
     }
 
-    while (i >= JF_FLAG_CHANGE_REQUESTS_LEN) {
-        // the buffer is full
-        for (i = 0; i < JF_FLAG_CHANGE_REQUESTS_LEN; i++) {
-            if (! JF_REPLY_PTR_IS_PENDING(s_played_status_requests[i])) {
-                jf_menu_set_flag_request_resolve(s_played_status_requests[i]);
-                s_played_status_requests[i] = NULL;
-                break;
-            }
-        }
+    url = jf_menu_set_flag_request_get_url(child.id, flag_type);
 
-        if (i < JF_FLAG_CHANGE_REQUESTS_LEN && s_played_status_requests[i] == NULL) {
-            break;
-        }
-
-        // we couldn't free up a spot, so let's take a nap and try again
-        // a precise notification mechanism would be hugely overkill
-        // this subsystem is overengineered enough
-        nanosleep(&s_25msec, NULL);
-        // don't bother dealing with early wakeup
+    // look for a free slot, making room if it's full
+    jf_menu_set_flag_request_reap();
+    for (i = 0; i < s_flag_width; i++) {
+        if (s_flag_replies[i] == NULL) break;
     }
-            
-    s_played_status_requests[i] = jf_net_request(url,
+    if (i == s_flag_width) {
+        i = jf_net_await_any(s_flag_replies, s_flag_width);
+        jf_menu_set_flag_request_resolve(i);
+    }
+
+    // the user is waiting on the command
+    s_flag_replies[i] = jf_net_request_priority(url,
             JF_REQUEST_ASYNC_IN_MEMORY,
             flag_status == true ? JF_HTTP_POST : JF_HTTP_DELETE,
-            NULL);
+            NULL,
+            JF_REQUEST_PRIORITY_INTERACTIVE);
+    s_flag_items[i] = n;
+    s_flag_queued++;
+    jf_menu_set_flag_progress_print();
 
     free(url);
-    free(child);
+}
+
+
+// FIXME: of course this doesn't work fine on split files :))))))
+// we need to manually set each sub-child like we do in jf_playback_progress_update
+void jf_menu_child_set_flag(const size_t n, const jf_flag_type flag_type, const bool flag_status)
+{
+    // only items from the payload cache have a meaningful id
+    if (s_context == NULL
+            || ! JF_ITEM_TYPE_HAS_DYNAMIC_CHILDREN(s_context->type)) {
+        return;
+    }
+    jf_menu_paging_load_until(n);
+    jf_menu_set_flag_request_push(n, flag_type, flag_status);
+}
+
+
+void jf_menu_child_set_flag_range(size_t l,
+        size_t r,
+        const jf_flag_type flag_type,
+        const bool flag_status)
+{
+    size_t i;
+
+    if (s_context == NULL
+            || ! JF_ITEM_TYPE_HAS_DYNAMIC_CHILDREN(s_context->type)) {
+        return;
+    }
+    if (l > r) {
+        i = l;
+        l = r;
+        r = i;
+    }
+    // fetch all missing pages at once rather than as the ids are needed
+    jf_menu_paging_load_until(r);
+    for (i = l; i <= r; i++) {
+        jf_menu_set_flag_request_push(i, flag_type, flag_status);
+        if (i == r) break; // r may well be SIZE_MAX
+    }
 }
 
 
 void jf_menu_item_set_flag_detach(const jf_menu_item *item, const jf_flag_type flag_type, const bool flag_status)
 {
-    char *url = jf_menu_set_flag_request_get_url(item, flag_type);
+    char *url = jf_menu_set_flag_request_get_url(item->id, flag_type);
     
-    jf_net_request(url,
-            JF_REQUEST_ASYNC_DETACH,
+    // setting and unsetting the same flag supersede each other
+    jf_net_pending_update(url,
             flag_status == true ? JF_HTTP_POST : JF_HTTP_DELETE,
+            NULL,
             NULL);
+    free(url);
 }
 
 
 void jf_menu_item_set_flag_await_all(void)
 {
+    jf_flag_error *e;
     size_t i;
 
-    for (i = 0; i < JF_FLAG_CHANGE_REQUESTS_LEN; i++) {
-        if (s_played_status_requests[i] == NULL) continue;
-        jf_menu_set_flag_request_resolve(s_played_status_requests[i]);
-        s_played_status_requests[i] = NULL;
+    if (s_flag_replies == NULL) return;
+
+    jf_net_await_all(s_flag_replies, s_flag_width);
+    for (i = 0; i < s_flag_width; i++) {
+        if (s_flag_replies[i] == NULL) continue;
+        jf_menu_set_flag_request_resolve(i);
+    }
+    if (s_flag_queued > s_flag_width) {
+        jf_menu_set_flag_progress_print();
+        printf("\n");
+    }
+
+    if (s_flag_errors_count > 0) {
+        fprintf(stderr,
+                "Warning: %zu of %zu items could not be updated:\n",
+                s_flag_errors_count,
+                s_flag_queued);
+        for (i = 0; i < s_flag_errors_count; i++) {
+            e = s_flag_errors + i;
+            if (i < JF_FLAG_ERRORS_SHOWN) {
+                fprintf(stderr,
+                        "  %zu. %s: %s.\n",
+                        e->n,
+                        e->name != NULL ? e->name : "?",
+                        e->error);
+            }
+            free(e->name);
+            free(e->error);
+        }
+        if (s_flag_errors_count > JF_FLAG_ERRORS_SHOWN) {
+            fprintf(stderr,
+                    "  ... and %zu more.\n",
+                    s_flag_errors_count - JF_FLAG_ERRORS_SHOWN);
+        }
     }
+    s_flag_errors_count = 0;
+    s_flag_queued = 0;
+    s_flag_done = 0;
 }
 ///////////////////////////////////
 
@@ -1080,6 +1767,11 @@ void jf_menu_ui(void)
                     // read input and do first pass (validation)
                     line = jf_menu_linenoise("> ");
                     linenoiseHistoryAdd(line);
+                    if (jf_menu_revalidation_check()) {
+                        free(line);
+                        break;
+                    }
+                    jf_menu_paging_poll();
                     yy.input = line;
                     yyparse(&yy);
                     break;
@@ -1094,7 +1786,7 @@ void jf_menu_ui(void)
                 case JF_CMD_SUCCESS:
                     free(line);
                     yyrelease(&yy);
-                    jf_menu_try_play();
+                    jf_menu_try_play(1);
                     return;
                 case JF_CMD_FAIL_FOLDER:
                     fprintf(stderr, "Error: cannot open many folders or both folders and items with non-recursive command.\n");
@@ -1125,6 +1817,29 @@ void jf_menu_ui(void)
         }
     }
 }
+
+
+void jf_menu_playlist_resume(void)
+{
+    jf_growing_buffer question;
+    size_t count, position;
+    bool resume;
+
+    if ((count = jf_disk_playlist_journal_open(&position)) == 0) return;
+
+    question = jf_growing_buffer_new(0);
+    jf_growing_buffer_sprintf(question, 0,
+            "The playlist from last time is still there (%zu items, stopped at %zu: %s). Would you like to resume it?",
+            count,
+            position,
+            jf_disk_playlist_get_item_name(position));
+    resume = jf_menu_user_ask_yn(question->buf);
+    jf_growing_buffer_free(question);
+
+    if (resume) {
+        jf_menu_try_play(position);
+    }
+}
 /////////////////////////////////////////
 
 
@@ -1195,8 +1910,6 @@ size_t jf_menu_user_ask_selection(const char *prompt_preamble, const size_t l, c
 ////////// MISCELLANEOUS //////////
 void jf_menu_init(void)
 {
-    size_t i;
-
     // all linenoise setup
     linenoiseHistorySetMaxLen(16);
     
@@ -1207,11 +1920,6 @@ void jf_menu_init(void)
     assert((s_menu_stack.items = malloc(10 * sizeof(jf_menu_item *))) != NULL);
     s_menu_stack.size = 10;
     s_menu_stack.used = 0;
-
-    // init played status tracker
-    for (i = 0; i < JF_FLAG_CHANGE_REQUESTS_LEN; i++) {
-        s_played_status_requests[i] = NULL;
-    }
 }
 
 
@@ -1221,6 +1929,26 @@ void jf_menu_clear(void)
     while (s_menu_stack.used > 0) {
         jf_menu_item_free(jf_menu_stack_pop());
     }
+
+    // let go of paged listings
+    jf_menu_paging_clear();
+    jf_net_await_all(s_paging_orphans, s_paging_orphans_count);
+    jf_menu_paging_reap();
+    free(s_paging_pages);
+    s_paging_pages = NULL;
+    s_paging_pages_size = 0;
+    free(s_paging_orphans);
+    s_paging_orphans = NULL;
+    s_paging_orphans_size = 0;
+
+    // flag changes are all settled by the end of each command
+    free(s_flag_replies);
+    s_flag_replies = NULL;
+    free(s_flag_items);
+    s_flag_items = NULL;
+    free(s_flag_errors);
+    s_flag_errors = NULL;
+    s_flag_errors_size = 0;
 }
 
 
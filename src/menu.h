@@ -52,14 +52,33 @@ bool jf_menu_filters_add(const enum jf_filter filter);
 
 
 ////////// PLAYED STATUS & favoriteS //////////
-#define JF_FLAG_CHANGE_REQUESTS_LEN (JF_NET_ASYNC_THREADS * 4)
+// Flag changes of an "m" command go through a pipeline of at most
+// g_options.flag_requests requests in flight, refilled as soon as any of them
+// is done. Past that many items, a progress counter is shown. Failures are
+// summed up at the end, listing at most this many items.
+#define JF_FLAG_ERRORS_SHOWN 16
 
 typedef enum jf_flag_type {
     JF_FLAG_TYPE_PLAYED = 0,
     JF_FLAG_TYPE_FAVORITE = 1
 } jf_flag_type;
 
+typedef struct jf_flag_error {
+    size_t n;
+    char *name;
+    char *error;
+} jf_flag_error;
+
 void jf_menu_child_set_flag(const size_t n, const jf_flag_type flag_type, const bool flag_status);
+
+
+// Same as jf_menu_child_set_flag for each child from l to r included, in
+// either order.
+// CAN FATAL.
+void jf_menu_child_set_flag_range(size_t l,
+        size_t r,
+        const jf_flag_type flag_type,
+        const bool flag_status);
 void jf_menu_item_set_flag_detach(const jf_menu_item *item, const jf_flag_type flag_type, const bool flag_status);
 void jf_menu_item_set_flag_await_all(void);
 ///////////////////////////////////
@@ -75,17 +94,60 @@ typedef struct jf_menu_stack {
 
 
 ////////// USER INTERFACE LOOP //////////
+// Listings found in the HTTP cache are printed right away and revalidated in
+// the background. If, come the next command, it turns out they changed, at
+// most this many additions and removals each are printed.
+#define JF_MENU_LISTING_DIFF_MAX_LINES 10
+
+// Listings longer than g_options.page_size are fetched one page at a time:
+// the first is printed, the following ones are prefetched in the background
+// at most this many at a time and ingested when a command gets to them.
+#define JF_MENU_PREFETCH_PAGES 4
+
+
+typedef struct jf_menu_listing_entry {
+    char id[JF_ID_LENGTH + 1];
+    char *name;
+    size_t n;
+} jf_menu_listing_entry;
+
+
 jf_item_type jf_menu_child_get_type(size_t n);
+
+
+// Fills types[0 .. last - first] with the types of children first through last
+// of the current menu. Children out of bounds get JF_ITEM_TYPE_NONE.
+// REQUIRES: first <= last, types has room for last - first + 1 entries.
+// CAN'T FAIL.
+void jf_menu_child_get_types(const size_t first,
+        const size_t last,
+        jf_item_type *types);
 size_t jf_menu_child_count(void);
 bool jf_menu_child_dispatch(const size_t n);
 
+
+// Same as calling jf_menu_child_dispatch on children first through last in
+// ascending order, but consecutive atoms of a dynamic menu are appended to the
+// playlist in bulk.
+// REQUIRES: first <= last <= jf_menu_child_count() + 1.
+// CAN FATAL.
+bool jf_menu_child_dispatch_range(const size_t first, const size_t last);
+
 void jf_menu_help(void);
 
 void jf_menu_dotdot(void);
 void jf_menu_quit(void);
 void jf_menu_search(const char *s);
+void jf_menu_stats(void);
 
 void jf_menu_ui(void);
+
+
+// Restores the playlist saved by the persistent_playlist option, if any, and
+// offers to resume playback where it was left. The items come straight from
+// the journal, without any network request.
+// CAN FATAL.
+void jf_menu_playlist_resume(void);
 /////////////////////////////////////////
 
 
@@ -2,6 +2,7 @@
 #include "config.h"
 #include "shared.h"
 #include "json.h"
+#include "disk.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -9,10 +10,22 @@
 #include <signal.h>
 #include <pthread.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <curl/curl.h>
 
 
+// timings and sizes are read as curl_off_t, on versions of curl that have them
+#if JF_CURL_VERSION_GE(7,61)
+#define JF_NET_STATS_INFO(_name) CURLINFO_ ## _name ## _T
+#else
+#define JF_NET_STATS_INFO(_name) CURLINFO_ ## _name
+#endif
+
+
 ////////// GLOBAL VARIABLES //////////
 extern jf_options g_options;
 extern jf_global_state g_state;
@@ -25,6 +38,7 @@ static struct curl_slist *s_headers = NULL;
 static struct curl_slist *s_headers_POST = NULL;
 static char s_curl_errorbuffer[CURL_ERROR_SIZE + 1];
 static jf_thread_buffer s_tb;
+static jf_net_parser s_parsers[JF_NET_SAX_PARSERS];
 static pthread_mutex_t s_mut = PTHREAD_MUTEX_INITIALIZER;
 static CURLSH *s_curl_sh = NULL;
 static pthread_rwlock_t s_share_cookie_rw;
@@ -34,17 +48,155 @@ static pthread_rwlock_t s_share_ssl_rw;
 #if JF_CURL_VERSION_GE(7,61)
 static pthread_rwlock_t s_share_psl_rw;
 #endif
-pthread_t s_async_threads[JF_NET_ASYNC_THREADS];
-static jf_synced_queue *s_async_queue = NULL;
-static pthread_mutex_t s_async_mut;
-static pthread_cond_t s_async_cv;
+static CURLM *s_multi = NULL;
+static pthread_t s_async_thread;
+static jf_async_lane s_async_lanes[JF_REQUEST_PRIORITY_COUNT];
+static size_t s_async_in_flight = 0;
+static bool s_async_exiting = false;
+static pthread_mutex_t s_async_mut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_async_cv = PTHREAD_COND_INITIALIZER;
+// shareable requests queued or in flight, to attach identical ones to
+static jf_async_request **s_async_shareable = NULL;
+static size_t s_async_shareable_count = 0;
+static size_t s_async_shareable_size = 0;
+static jf_http_cache_entry **s_http_cache = NULL;
+static size_t s_http_cache_count = 0;
+static size_t s_http_cache_size = 0;
+// bytes taken up by all entries
+static size_t s_http_cache_used = 0;
+static size_t s_http_cache_clock = 0;
+static pthread_mutex_t s_http_cache_mut = PTHREAD_MUTEX_INITIALIZER;
+// the synchronous request in progress, as far as the SIGINT handler cares
+static volatile sig_atomic_t s_sync_running = 0;
+static volatile sig_atomic_t s_sync_cancelled = 0;
+static jf_net_stats_endpoint *s_net_stats = NULL;
+static size_t s_net_stats_count = 0;
+static size_t s_net_stats_size = 0;
+static pthread_mutex_t s_net_stats_mut = PTHREAD_MUTEX_INITIALIZER;
+// pending updates, oldest first
+static jf_pending_update **s_pending = NULL;
+static size_t s_pending_count = 0;
+static size_t s_pending_size = 0;
+static pthread_mutex_t s_pending_mut = PTHREAD_MUTEX_INITIALIZER;
+// the queue changed since it was last written to disk
+static bool s_pending_dirty = false;
+// taken before the pending lock, keeps saves from overtaking one another
+static pthread_mutex_t s_pending_save_mut = PTHREAD_MUTEX_INITIALIZER;
 //////////////////////////////////////
 
 
 ////////// STATIC FUNCTIONS //////////
 static void jf_net_init(void);
 
-static void jf_thread_buffer_wait_parsing_done(void);
+static void jf_thread_buffer_wait_pending(jf_thread_buffer *tb, const size_t pending);
+
+static inline size_t jf_thread_buffer_free_slots(const jf_thread_buffer *tb);
+
+// For a producer that must not block: true if a write of size bytes won't fit
+// in the ring yet, in which case the producer is marked as paused.
+static bool jf_thread_buffer_should_pause(jf_thread_buffer *tb, const size_t size);
+
+// Un-marks a paused producer once the parser has made some room.
+// Returns true if it was, i.e. its transfer should be resumed.
+static bool jf_thread_buffer_try_unpause(jf_thread_buffer *tb);
+
+static void jf_thread_buffer_wait_parsing_done(jf_thread_buffer *tb, jf_reply *reply);
+
+// Blocking: copies size bytes into the ring, waiting for room as needed.
+// Parser errors are filled into r.
+static size_t jf_thread_buffer_write(jf_thread_buffer *tb,
+        const char *payload,
+        const size_t real_size,
+        jf_reply *r);
+
+// Has the parser drop the document it was in the middle of, if any.
+static void jf_thread_buffer_reset(jf_thread_buffer *tb);
+
+static void jf_thread_buffer_drop_error(jf_thread_buffer *tb);
+
+// Feeds a whole JSON body to the parser and waits for it to be done.
+// Parser errors are filled into reply.
+static void jf_thread_buffer_feed(jf_thread_buffer *tb,
+        const char *body,
+        const size_t size,
+        jf_reply *reply);
+
+static size_t jf_http_cache_max_bytes(void);
+
+static char *jf_http_cache_key(const char *url);
+
+static size_t jf_http_cache_entry_cost(const jf_http_cache_entry *e);
+
+// NB call with the cache lock held.
+static void jf_http_cache_entry_unref(jf_http_cache_entry *e);
+
+// NB call with the cache lock held.
+static void jf_http_cache_remove(const size_t i);
+
+static jf_http_cache_entry *jf_http_cache_lookup(const char *key);
+
+// Takes ownership of all the arguments.
+static void jf_http_cache_store(char *key,
+        char *etag,
+        char *last_modified,
+        char *body,
+        const size_t size);
+
+static void jf_http_cache_load(void);
+
+static void jf_http_cache_save(void);
+
+static bool jf_net_stats_segment_is_id(const char *segment, const size_t len);
+
+// Returns the path of url, with ids replaced by "{id}", in a new string.
+// CAN FATAL.
+static char *jf_net_stats_endpoint_name(const char *url);
+
+static curl_off_t jf_net_stats_getinfo(CURL *handle,
+        const CURLINFO info,
+        const double scale);
+
+static size_t jf_net_stats_bucket(const curl_off_t us);
+
+static void jf_net_stats_record(CURL *handle, const CURLcode result);
+
+static int jf_net_stats_endpoint_cmp(const void *a, const void *b);
+
+static jf_net_stats_endpoint *jf_net_stats_snapshot(size_t *count);
+
+static void jf_net_stats_print_histogram(const char *label, const size_t *histogram);
+
+static void jf_net_stats_dump_histogram(FILE *file,
+        const char *key,
+        const size_t *histogram);
+
+static void jf_net_stats_dump(void);
+
+static void jf_http_cache_transfer_begin(jf_http_cache_transfer *t,
+        const char *url,
+        const jf_request_type request_type,
+        const jf_http_method method,
+        jf_reply *reply);
+
+static void jf_http_cache_transfer_store(jf_http_cache_transfer *t,
+        const jf_request_type request_type,
+        const jf_reply *reply);
+
+static jf_reply_state jf_http_cache_transfer_replay(jf_http_cache_transfer *t,
+        const jf_request_type request_type,
+        jf_reply *reply);
+
+static void jf_http_cache_transfer_end(jf_http_cache_transfer *t);
+
+static size_t jf_http_cache_header_callback(char *payload,
+        size_t size,
+        size_t nmemb,
+        void *userdata);
+
+static size_t jf_http_cache_sax_callback(char *payload,
+        size_t size,
+        size_t nmemb,
+        void *userdata);
 
 static size_t jf_reply_callback(char *payload,
         size_t size,
@@ -66,6 +218,20 @@ static size_t jf_check_update_header_callback(char *payload,
         size_t nmemb,
         void *userdata);
 
+static bool jf_reply_is_cancelled(jf_reply *r);
+
+static int jf_net_sync_xferinfo_callback(void *clientp,
+        curl_off_t dltotal,
+        curl_off_t dlnow,
+        curl_off_t ultotal,
+        curl_off_t ulnow);
+
+static int jf_net_async_xferinfo_callback(void *clientp,
+        curl_off_t dltotal,
+        curl_off_t dlnow,
+        curl_off_t ultotal,
+        curl_off_t ulnow);
+
 static CURL *jf_net_handle_init(void);
 
 static void jf_net_handle_before_perform(CURL *handle,
@@ -73,22 +239,99 @@ static void jf_net_handle_before_perform(CURL *handle,
         const jf_request_type request_type,
         const jf_http_method method,
         const char *payload,
-        const jf_reply *reply);
+        jf_reply *reply,
+        jf_http_cache_transfer *transfer);
 
-static void jf_net_handle_after_perform(CURL *handle,
+static jf_reply_state jf_net_handle_after_perform(CURL *handle,
         const CURLcode result,
         const jf_request_type request_type,
-        jf_reply *reply);
+        jf_reply *reply,
+        jf_http_cache_transfer *transfer);
+
+static jf_pending_update *jf_pending_update_new(const char *key,
+        const char *resource,
+        const jf_http_method method,
+        const char *payload);
+
+static void jf_pending_update_free(jf_pending_update *u);
+
+static void jf_net_pending_append(jf_pending_update *u);
+
+static void jf_net_pending_remove(const size_t i);
+
+static bool jf_net_pending_is_held(const jf_pending_update *u);
+
+static void jf_net_pending_load(void);
+
+static void jf_net_pending_save(void);
+
+static void jf_net_pending_start_due(void);
+
+static bool jf_net_pending_wait(void);
+
+static void jf_net_pending_done(jf_pending_update *u,
+        CURL *handle,
+        const jf_reply_state state);
 
 static jf_async_request *jf_async_request_new(const char *resource,
         const jf_request_type request_type,
         const jf_http_method method,
-        const char *payload);
+        const char *payload,
+        const jf_request_priority priority);
 
 // NB DOES NOT FREE a_r->reply!!!
 static void jf_async_request_free(jf_async_request *a_r);
 
-static void *jf_net_async_worker_thread(void *arg);
+static void jf_async_lane_init(jf_async_lane *lane,
+        const size_t max_queued,
+        const size_t max_in_flight);
+
+static jf_async_request *jf_async_lane_push(jf_async_lane *lane,
+        jf_async_request *a_r);
+
+static jf_async_request *jf_async_lane_pop(jf_async_lane *lane);
+
+// Takes the queued request for reply out of the lane, if it's there, keeping
+// the others in order.
+static jf_async_request *jf_async_lane_take(jf_async_lane *lane,
+        const jf_reply *reply);
+
+static void jf_net_async_fail(jf_async_request *a_r, const jf_reply_state state);
+
+static void jf_net_async_enqueue(jf_async_request *a_r);
+
+static jf_reply *jf_net_async_join(const char *resource);
+
+static void jf_net_async_track(jf_async_request *a_r);
+
+static void jf_net_async_untrack(const jf_async_request *a_r);
+
+static void jf_net_parser_wakeup(void);
+
+// NB call on the async loop thread.
+static jf_net_parser *jf_net_parser_acquire(void);
+
+// Waits for the parser to be done with whatever it was fed and gets it ready
+// for the next request.
+// NB call on the async loop thread.
+static void jf_net_parser_release(jf_net_parser *parser);
+
+// Resumes the transfers that were paused on a full ring which has since
+// drained enough.
+// NB call on the async loop thread.
+static void jf_net_parser_resume_paused(void);
+
+static bool jf_async_lane_is_ready(const jf_async_lane *lane);
+
+static jf_async_request *jf_net_async_pick(void);
+
+static void jf_net_async_wait(void);
+
+static void jf_net_async_done(CURLMsg *msg);
+
+static void jf_reply_signal_done(jf_reply *r, const jf_reply_state state);
+
+static void *jf_net_async_loop_thread(void *arg);
 
 static inline pthread_rwlock_t *
 jf_net_get_lock_for_data(curl_lock_data data);
@@ -112,17 +355,38 @@ jf_reply *jf_reply_new(void)
     r->payload = NULL;
     r->size = 0;
     r->state = JF_REPLY_PENDING;
+    r->done = false;
+    assert(pthread_mutex_init(&r->mut, NULL) == 0);
+    assert(pthread_cond_init(&r->cv, NULL) == 0);
+    r->waiter = NULL;
+    r->refcount = 1;
+    r->cancelled = false;
+    r->tb = NULL;
+    r->items = NULL;
     return r;
 }
 
 
 void jf_reply_free(jf_reply *r)
 {
+    bool last;
+
     if (r == NULL) return;
-    if (r->state == JF_REPLY_PENDING) return; // better a leak than a segfault
+    assert(pthread_mutex_lock(&r->mut) == 0);
+    if (! r->done) {
+        // better a leak than a segfault
+        assert(pthread_mutex_unlock(&r->mut) == 0);
+        return;
+    }
+    last = --r->refcount == 0;
+    assert(pthread_mutex_unlock(&r->mut) == 0);
+    if (! last) return;
     if (JF_REPLY_PTR_SHOULD_FREE_PAYLOAD(r)) {
         free(r->payload);
     }
+    jf_disk_scratch_free(r->items);
+    pthread_mutex_destroy(&r->mut);
+    pthread_cond_destroy(&r->cv);
     free(r);
 }
 
@@ -153,6 +417,10 @@ char *jf_reply_error_string(const jf_reply *r)
             return "\"location\" header from redirect was missing or not formatted as expected";
         case JF_REPLY_ERROR_EXIT_REQUEST:
             return "exit request";
+        case JF_REPLY_ERROR_DROPPED:
+            return "request dropped because too many were queued";
+        case JF_REPLY_ERROR_CANCELLED:
+            return "request cancelled";
         case JF_REPLY_ERROR_HTTP_400:
         case JF_REPLY_ERROR_NETWORK:
         case JF_REPLY_ERROR_HTTP_NOT_OK:
@@ -182,207 +450,1197 @@ static size_t jf_reply_callback(char *payload, size_t size, size_t nmemb, void *
 
 
 ////////// PARSER THREAD COMMUNICATION //////////
-static void jf_thread_buffer_wait_parsing_done(void)
+// Blocks until the parser has at most pending chunks left in the ring (or the
+// program is exiting).
+static void jf_thread_buffer_wait_pending(jf_thread_buffer *tb, const size_t pending)
 {
-    pthread_mutex_lock(&s_tb.mut);
-    while (true) {
-        switch (s_tb.state) {
-            case JF_THREAD_BUFFER_STATE_AWAITING_DATA:
-                pthread_cond_wait(&s_tb.cv_no_data, &s_tb.mut);
-                break;
-            case JF_THREAD_BUFFER_STATE_PENDING_DATA:
-                pthread_cond_wait(&s_tb.cv_has_data, &s_tb.mut);
-                break;
-            default:
-                pthread_mutex_unlock(&s_tb.mut);
-                return;
-        }
+    if (tb->tail - __atomic_load_n(&tb->head, __ATOMIC_ACQUIRE) <= pending) return;
+
+    pthread_mutex_lock(&tb->mut);
+    // the parser checks the flag after advancing head
+    __atomic_store_n(&tb->producer_sleeping, true, __ATOMIC_SEQ_CST);
+    while (tb->tail - __atomic_load_n(&tb->head, __ATOMIC_SEQ_CST) > pending
+            && ! JF_STATE_IS_EXITING(g_state.state)) {
+        pthread_cond_wait(&tb->cv_has_data, &tb->mut);
     }
+    __atomic_store_n(&tb->producer_sleeping, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&tb->mut);
 }
 
 
-size_t jf_thread_buffer_callback(char *payload, size_t size, size_t nmemb, void *userdata)
+static inline size_t jf_thread_buffer_free_slots(const jf_thread_buffer *tb)
+{
+    return JF_THREAD_BUFFER_SLOTS
+        - (tb->tail - __atomic_load_n(&tb->head, __ATOMIC_SEQ_CST));
+}
+
+
+static bool jf_thread_buffer_should_pause(jf_thread_buffer *tb, const size_t size)
+{
+    size_t needed = (size + JF_THREAD_BUFFER_DATA_SIZE - 3) / (JF_THREAD_BUFFER_DATA_SIZE - 2);
+
+    if (tb->producer_wakeup == NULL) return false;
+    // more than the whole ring could ever take: just block
+    if (needed > JF_THREAD_BUFFER_SLOTS) return false;
+    if (jf_thread_buffer_free_slots(tb) >= needed) return false;
+
+    // the parser checks the flag after advancing head, so look again after
+    // raising it
+    __atomic_store_n(&tb->producer_sleeping, true, __ATOMIC_SEQ_CST);
+    if (jf_thread_buffer_free_slots(tb) >= needed) {
+        __atomic_store_n(&tb->producer_sleeping, false, __ATOMIC_RELAXED);
+        return false;
+    }
+    tb->producer_paused = true;
+    return true;
+}
+
+
+static bool jf_thread_buffer_try_unpause(jf_thread_buffer *tb)
+{
+    if (! tb->producer_paused
+            || jf_thread_buffer_free_slots(tb) < JF_THREAD_BUFFER_SLOTS / 2) {
+        return false;
+    }
+    tb->producer_paused = false;
+    __atomic_store_n(&tb->producer_sleeping, false, __ATOMIC_RELAXED);
+    return true;
+}
+
+
+// Waits for the parser to be done with all the chunks fed to it. A parser
+// error is reported to reply, a document left halfway through is dropped.
+static void jf_thread_buffer_wait_parsing_done(jf_thread_buffer *tb, jf_reply *reply)
+{
+    jf_thread_buffer_wait_pending(tb, 0);
+    if (JF_STATE_IS_EXITING(g_state.state)) return;
+
+    switch (__atomic_load_n(&tb->state, __ATOMIC_ACQUIRE)) {
+        case JF_THREAD_BUFFER_STATE_PARSER_ERROR:
+            if (! JF_REPLY_PTR_HAS_ERROR(reply)) {
+                free(reply->payload);
+                assert((reply->payload = strdup(tb->error)) != NULL);
+                reply->state = JF_REPLY_ERROR_PARSER;
+            }
+            break;
+        case JF_THREAD_BUFFER_STATE_AWAITING_DATA:
+            jf_thread_buffer_reset(tb);
+            break;
+        default:
+            break;
+    }
+}
+
+
+static size_t jf_thread_buffer_write(jf_thread_buffer *tb,
+        const char *payload,
+        const size_t real_size,
+        jf_reply *r)
 {
-    size_t real_size = size * nmemb;
     size_t written_data = 0;
-    size_t chunk_size;
-    jf_reply *r = (jf_reply *)userdata;
+    size_t chunk_size, tail;
+    jf_thread_buffer_slot *slot;
 
-    pthread_mutex_lock(&s_tb.mut);
     while (written_data < real_size) {
-        // wait for parser
-        while (s_tb.state == JF_THREAD_BUFFER_STATE_PENDING_DATA
-                && ! JF_STATE_IS_EXITING(g_state.state)) {
-            pthread_cond_wait(&s_tb.cv_has_data, &s_tb.mut);
-        }
+        // wait for a free slot
+        jf_thread_buffer_wait_pending(tb, JF_THREAD_BUFFER_SLOTS - 1);
         // check errors
         if (JF_STATE_IS_EXITING(g_state.state)) return 0;
-        if (s_tb.state == JF_THREAD_BUFFER_STATE_PARSER_ERROR) {
-            r->payload = strndup(s_tb.data, s_tb.used);
+        if (__atomic_load_n(&tb->state, __ATOMIC_ACQUIRE) == JF_THREAD_BUFFER_STATE_PARSER_ERROR) {
+            assert((r->payload = strdup(tb->error)) != NULL);
             r->state = JF_REPLY_ERROR_PARSER;
             return 0;   
         }
         // send data
+        tail = tb->tail;
+        slot = tb->slots + tail % JF_THREAD_BUFFER_SLOTS;
         chunk_size = real_size - written_data < JF_THREAD_BUFFER_DATA_SIZE - 1 
             ? real_size - written_data 
             : JF_THREAD_BUFFER_DATA_SIZE - 2;
-        memcpy(s_tb.data, payload + written_data, chunk_size);
+        memcpy(slot->data, payload + written_data, chunk_size);
         written_data += chunk_size;
-        s_tb.data[chunk_size + 1] = '\0';
-        s_tb.used = chunk_size;
-        s_tb.state = JF_THREAD_BUFFER_STATE_PENDING_DATA;
-        pthread_cond_signal(&s_tb.cv_no_data);
+        slot->data[chunk_size] = '\0';
+        slot->used = chunk_size;
+        __atomic_store_n(&tb->tail, tail + 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&tb->parser_sleeping, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_lock(&tb->mut);
+            pthread_cond_signal(&tb->cv_no_data);
+            pthread_mutex_unlock(&tb->mut);
+        }
     }
-    pthread_mutex_unlock(&s_tb.mut);
 
     return written_data;
 }
 
 
+size_t jf_thread_buffer_callback(char *payload, size_t size, size_t nmemb, void *userdata)
+{
+    jf_reply *r = (jf_reply *)userdata;
+
+    if (jf_thread_buffer_should_pause(r->tb, size * nmemb)) {
+        return CURL_WRITEFUNC_PAUSE;
+    }
+    return jf_thread_buffer_write(r->tb, payload, size * nmemb, r);
+}
+
+
+static void jf_thread_buffer_feed(jf_thread_buffer *tb,
+        const char *body,
+        const size_t size,
+        jf_reply *reply)
+{
+    if (jf_thread_buffer_write(tb, body, size, reply) != size) {
+        // the callback filled in the error
+        return;
+    }
+    jf_thread_buffer_wait_parsing_done(tb, reply);
+}
+
+
 size_t jf_thread_buffer_item_count(void)
 {
     return s_tb.item_count;
 }
 
 
-void jf_thread_buffer_clear_error(void)
+size_t jf_thread_buffer_total_record_count(void)
 {
-    pthread_mutex_lock(&s_tb.mut);
-    s_tb.data[0] = '\0';
-    s_tb.used = 0;
-    s_tb.state = JF_THREAD_BUFFER_STATE_CLEAR;
-    pthread_mutex_unlock(&s_tb.mut);
+    return s_tb.total_record_count;
 }
-/////////////////////////////////////////////////
 
 
-////////// NETWORK UNIT //////////
-static void jf_net_init(void)
+static void jf_thread_buffer_reset(jf_thread_buffer *tb)
 {
-    char *tmp;
-    pthread_t sax_parser_thread;
-    int i;
-
-    assert(pthread_mutex_lock(&s_mut) == 0);
-    if (s_handle != NULL) {
-        pthread_mutex_unlock(&s_mut);
-        return;
+    jf_thread_buffer_wait_pending(tb, 0);
+    pthread_mutex_lock(&tb->mut);
+    // the parser can only be sleeping on the empty ring by now
+    if (tb->state == JF_THREAD_BUFFER_STATE_AWAITING_DATA) {
+        __atomic_store_n(&tb->state, JF_THREAD_BUFFER_STATE_RESET, __ATOMIC_RELEASE);
+        pthread_cond_signal(&tb->cv_no_data);
+        while (tb->state == JF_THREAD_BUFFER_STATE_RESET) {
+            pthread_cond_wait(&tb->cv_has_data, &tb->mut);
+        }
     }
+    pthread_mutex_unlock(&tb->mut);
+}
 
-    // TODO check libcurl version
-    
-    // global config stuff
-    assert(curl_global_init(CURL_GLOBAL_ALL | CURL_GLOBAL_SSL) == 0);
-    // security bypass
-    if (! g_options.ssl_verifyhost) {
-        curl_easy_setopt(s_handle, CURLOPT_SSL_VERIFYHOST, 0);
-    }
-    // headers
-    assert((s_headers = curl_slist_append(s_headers,
-                    "accept: application/json; charset=utf-8")) != NULL);
-    if (g_state.state == JF_STATE_STARTING_LOGIN
-            || g_state.state == JF_STATE_STARTING_FULL_CONFIG) {
-        // the only thing we will do is a POST for login
-        tmp = jf_concat(9,
-                "x-emby-authorization: Mediabrowser Client=\"", g_options.client,
-                "\", Device=\"", g_options.device, 
-                "\", DeviceId=\"", g_options.deviceid,
-                "\", Version=\"", g_options.version,
-                "\"");
-        assert((s_headers_POST = curl_slist_append(s_headers, tmp)) != NULL);
-    } else {
-        // main behaviour
-        tmp = jf_concat(2, "x-mediabrowser-token: ", g_options.token);
-        assert((s_headers = curl_slist_append(s_headers, tmp)) != NULL);
-    }
-    free(tmp);
-    assert((s_headers_POST = curl_slist_append(s_headers_POST == NULL ?
-                    s_headers : s_headers_POST,
-                    "content-type: application/json; charset=utf-8")) != NULL);
 
-    // setup sharing
-    assert((s_curl_sh = curl_share_init()) != NULL);
-    assert(pthread_rwlock_init(&s_share_cookie_rw, NULL) == 0);
-    JF_CURL_SHARE_ASSERT(curl_share_setopt(s_curl_sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_COOKIE));
-    assert(pthread_rwlock_init(&s_share_dns_rw, NULL) == 0);
-    JF_CURL_SHARE_ASSERT(curl_share_setopt(s_curl_sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS));
-    assert(pthread_rwlock_init(&s_share_ssl_rw, NULL) == 0);
-    JF_CURL_SHARE_ASSERT(curl_share_setopt(s_curl_sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION));
-    assert(pthread_rwlock_init(&s_share_connect_rw, NULL) == 0);
-    JF_CURL_SHARE_ASSERT(curl_share_setopt(s_curl_sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT));
-#if JF_CURL_VERSION_GE(7,61)
-    if (curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_PSL) {
-        assert(pthread_rwlock_init(&s_share_psl_rw, NULL) == 0);
-        JF_CURL_SHARE_ASSERT(curl_share_setopt(s_curl_sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_PSL));
-    }
-#endif
-    JF_CURL_SHARE_ASSERT(curl_share_setopt(s_curl_sh, CURLSHOPT_LOCKFUNC, jf_net_share_lock)); 
-    JF_CURL_SHARE_ASSERT(curl_share_setopt(s_curl_sh, CURLSHOPT_UNLOCKFUNC, jf_net_share_unlock));
+static void jf_thread_buffer_drop_error(jf_thread_buffer *tb)
+{
+    // the parser skips what's left of the document that failed
+    jf_thread_buffer_wait_pending(tb, 0);
+    pthread_mutex_lock(&tb->mut);
+    tb->error[0] = '\0';
+    __atomic_store_n(&tb->state, JF_THREAD_BUFFER_STATE_CLEAR, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&tb->mut);
+}
 
-    s_handle = jf_net_handle_init();
 
-    // sax parser thread
-    jf_thread_buffer_init(&s_tb);
-    assert(pthread_create(&sax_parser_thread, NULL, jf_json_sax_thread, (void *)&(s_tb)) != -1);
-    assert(pthread_detach(sax_parser_thread) == 0);
+void jf_thread_buffer_clear_error(void)
+{
+    jf_thread_buffer_drop_error(&s_tb);
+}
+/////////////////////////////////////////////////
 
-    // async networking
-    s_async_queue = jf_synced_queue_new(16);
-    assert(pthread_mutex_init(&s_async_mut, NULL) == 0);
-    assert(pthread_cond_init(&s_async_cv, NULL) == 0);
 
-    for (i = 0; i < JF_NET_ASYNC_THREADS; i++) {
-        assert(pthread_create(s_async_threads + i, NULL, jf_net_async_worker_thread, NULL) != -1);
-    }
+////////// HTTP CACHE //////////
+static size_t jf_http_cache_max_bytes(void)
+{
+    return g_options.http_cache_mb * 1024 * 1024;
+}
 
-    assert(pthread_mutex_unlock(&s_mut) == 0);
+
+static char *jf_http_cache_key(const char *url)
+{
+    return jf_concat(3, g_options.userid == NULL ? "" : g_options.userid, " ", url);
 }
 
 
-void jf_net_clear(void)
+char *jf_net_http_cache_get(const char *resource, size_t *size)
 {
-    int i;
+    jf_http_cache_entry *e;
+    char *url, *key, *body;
 
-    assert(pthread_mutex_lock(&s_mut) == 0);
+    if (g_options.http_cache_mb == 0 || resource == NULL) return NULL;
     if (s_handle == NULL) {
-        pthread_mutex_unlock(&s_mut);
-        return;
-    }
-
-    for (i = 0; i < JF_NET_ASYNC_THREADS; i++) {
-        jf_synced_queue_enqueue(s_async_queue,
-                jf_async_request_new(NULL, JF_REQUEST_EXIT, JF_HTTP_GET, NULL));
-    }
-    curl_easy_cleanup(s_handle);
-    for (i = 0; i < JF_NET_ASYNC_THREADS; i++) {
-        assert(pthread_join(s_async_threads[i], NULL) == 0);
+        // the cache may be persisted
+        jf_net_init();
     }
-    curl_share_cleanup(s_curl_sh);
-    curl_slist_free_all(s_headers_POST);
-    curl_global_cleanup();
 
-    assert(pthread_mutex_unlock(&s_mut) == 0);
+    url = jf_concat(2, g_options.server, resource);
+    key = jf_http_cache_key(url);
+    free(url);
+    e = jf_http_cache_lookup(key);
+    free(key);
+    if (e == NULL) return NULL;
+
+    assert((body = malloc(e->size + 1)) != NULL);
+    memcpy(body, e->body, e->size + 1);
+    *size = e->size;
+    assert(pthread_mutex_lock(&s_http_cache_mut) == 0);
+    jf_http_cache_entry_unref(e);
+    assert(pthread_mutex_unlock(&s_http_cache_mut) == 0);
+
+    return body;
 }
-//////////////////////////////////
 
 
-////////// NETWORKING //////////
-static CURL *jf_net_handle_init(void)
+static size_t jf_http_cache_entry_cost(const jf_http_cache_entry *e)
 {
-    CURL *handle;
+    return sizeof(jf_http_cache_entry)
+        + strlen(e->key) + 1
+        + (e->etag == NULL ? 0 : strlen(e->etag) + 1)
+        + (e->last_modified == NULL ? 0 : strlen(e->last_modified) + 1)
+        + e->size + 1;
+}
 
-    assert((handle = curl_easy_init()) != NULL);
 
-    // report errors
-    s_curl_errorbuffer[0] = '\0';
-    s_curl_errorbuffer[sizeof(s_curl_errorbuffer) - 1] = '\0';
-    JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, s_curl_errorbuffer));
+static void jf_http_cache_entry_unref(jf_http_cache_entry *e)
+{
+    if (e == NULL) return;
+    if (--e->refcount > 0) return;
+    free(e->key);
+    free(e->etag);
+    free(e->last_modified);
+    free(e->body);
+    free(e);
+}
 
-    // be a good neighbour
-    JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_SHARE, s_curl_sh));
-    JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L));
 
-    // ask for all supported kinds of compression
+static void jf_http_cache_remove(const size_t i)
+{
+    jf_http_cache_entry *e = s_http_cache[i];
+
+    s_http_cache_used -= jf_http_cache_entry_cost(e);
+    s_http_cache[i] = s_http_cache[--s_http_cache_count];
+    jf_http_cache_entry_unref(e);
+}
+
+
+// Returns a new reference to the entry for key, if any.
+static jf_http_cache_entry *jf_http_cache_lookup(const char *key)
+{
+    jf_http_cache_entry *e = NULL;
+    size_t i;
+
+    assert(pthread_mutex_lock(&s_http_cache_mut) == 0);
+    for (i = 0; i < s_http_cache_count; i++) {
+        if (strcmp(s_http_cache[i]->key, key) == 0) {
+            e = s_http_cache[i];
+            e->refcount++;
+            e->last_used = ++s_http_cache_clock;
+            break;
+        }
+    }
+    assert(pthread_mutex_unlock(&s_http_cache_mut) == 0);
+
+    return e;
+}
+
+
+static void jf_http_cache_store(char *key,
+        char *etag,
+        char *last_modified,
+        char *body,
+        const size_t size)
+{
+    jf_http_cache_entry *e;
+    size_t cost, i, lru;
+
+    assert((e = malloc(sizeof(jf_http_cache_entry))) != NULL);
+    e->key = key;
+    e->etag = etag;
+    e->last_modified = last_modified;
+    e->body = body;
+    e->size = size;
+    e->refcount = 1;
+    cost = jf_http_cache_entry_cost(e);
+
+    assert(pthread_mutex_lock(&s_http_cache_mut) == 0);
+    // replace an older copy
+    for (i = 0; i < s_http_cache_count; i++) {
+        if (strcmp(s_http_cache[i]->key, key) == 0) {
+            jf_http_cache_remove(i);
+            break;
+        }
+    }
+    if (cost > jf_http_cache_max_bytes()) {
+        jf_http_cache_entry_unref(e);
+        assert(pthread_mutex_unlock(&s_http_cache_mut) == 0);
+        return;
+    }
+    // make room evicting the least recently used entries
+    while (s_http_cache_used + cost > jf_http_cache_max_bytes()) {
+        lru = 0;
+        for (i = 1; i < s_http_cache_count; i++) {
+            if (s_http_cache[i]->last_used < s_http_cache[lru]->last_used) {
+                lru = i;
+            }
+        }
+        jf_http_cache_remove(lru);
+    }
+    if (s_http_cache_count == s_http_cache_size) {
+        s_http_cache_size = s_http_cache_size == 0 ? 64 : 2 * s_http_cache_size;
+        assert((s_http_cache = realloc(s_http_cache,
+                        s_http_cache_size * sizeof(jf_http_cache_entry *))) != NULL);
+    }
+    e->last_used = ++s_http_cache_clock;
+    s_http_cache[s_http_cache_count++] = e;
+    s_http_cache_used += cost;
+    assert(pthread_mutex_unlock(&s_http_cache_mut) == 0);
+}
+
+
+// The file is a magic line followed by one record per entry, least recently
+// used first: the lengths of key, etag, last_modified and body as four
+// size_t's, then the bytes themselves. A 0 length stands for a missing
+// validator.
+static void jf_http_cache_load(void)
+{
+    FILE *file;
+    char *path;
+    char magic[JF_STATIC_STRLEN(JF_NET_HTTP_CACHE_MAGIC)];
+    size_t lengths[4];
+    char *fields[4];
+    size_t i, read;
+
+    assert((path = jf_concat(2, g_state.config_dir, "/http_cache")) != NULL);
+    if ((file = fopen(path, "r")) == NULL) {
+        if (errno != ENOENT) {
+            fprintf(stderr,
+                    "Warning: could not open HTTP cache file (%s): %s.\n",
+                    path,
+                    strerror(errno));
+        }
+        free(path);
+        return;
+    }
+
+    if (fread(magic, sizeof(magic), 1, file) != 1
+            || memcmp(magic, JF_NET_HTTP_CACHE_MAGIC, sizeof(magic)) != 0) {
+        goto bad_exit;
+    }
+    while ((read = fread(lengths, sizeof(size_t), 4, file)) == 4) {
+        // checked one by one, so that no sum of them can wrap around
+        if (lengths[0] == 0
+                || lengths[0] > jf_http_cache_max_bytes()
+                || lengths[1] > JF_NET_HTTP_CACHE_VALIDATOR_MAX
+                || lengths[2] > JF_NET_HTTP_CACHE_VALIDATOR_MAX
+                || lengths[3] > jf_http_cache_max_bytes() - lengths[0]) {
+            goto bad_exit;
+        }
+        for (i = 0; i < 4; i++) {
+            if (lengths[i] == 0 && (i == 1 || i == 2)) {
+                fields[i] = NULL;
+                continue;
+            }
+            assert((fields[i] = malloc(lengths[i] + 1)) != NULL);
+            if (lengths[i] > 0 && fread(fields[i], lengths[i], 1, file) != 1) {
+                do {
+                    free(fields[i]);
+                } while (i-- > 0);
+                goto bad_exit;
+            }
+            fields[i][lengths[i]] = '\0';
+        }
+        jf_http_cache_store(fields[0], fields[1], fields[2], fields[3], lengths[3]);
+    }
+    if (read != 0 || ! feof(file)) goto bad_exit;
+
+    fclose(file);
+    free(path);
+    return;
+
+bad_exit:
+    fprintf(stderr,
+            "Warning: HTTP cache file (%s) is damaged, the rest of it will be ignored.\n",
+            path);
+    fclose(file);
+    free(path);
+}
+
+
+static int jf_http_cache_entry_cmp_lru(const void *a, const void *b)
+{
+    const jf_http_cache_entry *e = *(jf_http_cache_entry * const *)a;
+    const jf_http_cache_entry *f = *(jf_http_cache_entry * const *)b;
+
+    return e->last_used < f->last_used ? -1 : e->last_used > f->last_used;
+}
+
+
+static void jf_http_cache_save(void)
+{
+    FILE *file = NULL;
+    char *path, *tmp_path;
+    jf_http_cache_entry *e;
+    size_t lengths[4];
+    size_t i;
+    int fd;
+    bool failed;
+
+    assert((path = jf_concat(2, g_state.config_dir, "/http_cache")) != NULL);
+    assert((tmp_path = jf_concat(2, g_state.config_dir, "/http_cache.tmp")) != NULL);
+
+    if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) == -1
+            || (file = fdopen(fd, "w")) == NULL) {
+        fprintf(stderr,
+                "Warning: could not open temporary HTTP cache file (%s): %s.\n",
+                tmp_path,
+                strerror(errno));
+        if (fd != -1) close(fd);
+        goto end;
+    }
+
+    qsort(s_http_cache,
+            s_http_cache_count,
+            sizeof(jf_http_cache_entry *),
+            jf_http_cache_entry_cmp_lru);
+    fwrite(JF_NET_HTTP_CACHE_MAGIC, JF_STATIC_STRLEN(JF_NET_HTTP_CACHE_MAGIC), 1, file);
+    for (i = 0; i < s_http_cache_count; i++) {
+        e = s_http_cache[i];
+        lengths[0] = strlen(e->key);
+        lengths[1] = e->etag == NULL ? 0 : strlen(e->etag);
+        lengths[2] = e->last_modified == NULL ? 0 : strlen(e->last_modified);
+        lengths[3] = e->size;
+        fwrite(lengths, sizeof(size_t), 4, file);
+        fwrite(e->key, 1, lengths[0], file);
+        fwrite(e->etag, 1, lengths[1], file);
+        fwrite(e->last_modified, 1, lengths[2], file);
+        fwrite(e->body, 1, lengths[3], file);
+    }
+
+    failed = ferror(file) != 0;
+    if (fclose(file) != 0 || failed) {
+        fprintf(stderr,
+                "Warning: could not write HTTP cache file (%s): %s.\n",
+                tmp_path,
+                strerror(errno));
+        unlink(tmp_path);
+        goto end;
+    }
+    if (rename(tmp_path, path) != 0) {
+        fprintf(stderr,
+                "Warning: could not move temporary HTTP cache file to final location (%s): %s.\n",
+                path,
+                strerror(errno));
+        unlink(tmp_path);
+    }
+
+end:
+    free(path);
+    free(tmp_path);
+}
+
+
+static void jf_http_cache_transfer_begin(jf_http_cache_transfer *t,
+        const char *url,
+        const jf_request_type request_type,
+        const jf_http_method method,
+        jf_reply *reply)
+{
+    struct curl_slist *h;
+    char *tmp;
+
+    *t = (jf_http_cache_transfer){ .reply = reply };
+
+    if (method != JF_HTTP_GET || g_options.http_cache_mb == 0) return;
+    switch (request_type) {
+        case JF_REQUEST_IN_MEMORY:
+        case JF_REQUEST_ASYNC_IN_MEMORY:
+        case JF_REQUEST_SAX:
+        case JF_REQUEST_SAX_PROMISCUOUS:
+        case JF_REQUEST_ASYNC_SAX:
+        case JF_REQUEST_ASYNC_SAX_PROMISCUOUS:
+            break;
+        default:
+            return;
+    }
+
+    t->key = jf_http_cache_key(url);
+    if ((t->cached = jf_http_cache_lookup(t->key)) == NULL) return;
+    if (t->cached->etag == NULL && t->cached->last_modified == NULL) return;
+
+    // the usual headers plus the validators
+    for (h = s_headers; h != NULL; h = h->next) {
+        assert((t->headers = curl_slist_append(t->headers, h->data)) != NULL);
+    }
+    if (t->cached->etag != NULL) {
+        tmp = jf_concat(2, "if-none-match: ", t->cached->etag);
+        assert((t->headers = curl_slist_append(t->headers, tmp)) != NULL);
+        free(tmp);
+    }
+    if (t->cached->last_modified != NULL) {
+        tmp = jf_concat(2, "if-modified-since: ", t->cached->last_modified);
+        assert((t->headers = curl_slist_append(t->headers, tmp)) != NULL);
+        free(tmp);
+    }
+}
+
+
+// Stores the body of a 200 response, if it came with validators.
+// Listings (i.e. SAX requests) are stored regardless, so that the menu can
+// show them again right away while they're refreshed; for the same reason,
+// entries already there are always updated.
+static void jf_http_cache_transfer_store(jf_http_cache_transfer *t,
+        const jf_request_type request_type,
+        const jf_reply *reply)
+{
+    char *body;
+    size_t size;
+
+    if (t->key == NULL) return;
+
+    if (JF_REQUEST_TYPE_IS_SAX(request_type)) {
+        if (t->body_too_big || t->body == NULL) return;
+        body = t->body;
+        size = t->body_size;
+        t->body = NULL;
+    } else {
+        if (t->etag == NULL && t->last_modified == NULL && t->cached == NULL) return;
+        size = reply->size;
+        assert((body = malloc(size + 1)) != NULL);
+        if (size > 0) memcpy(body, reply->payload, size);
+        body[size] = '\0';
+    }
+
+    jf_http_cache_store(t->key, t->etag, t->last_modified, body, size);
+    t->key = NULL;
+    t->etag = NULL;
+    t->last_modified = NULL;
+}
+
+
+// Serves a 304 from the cached entry whose validators were sent and returns
+// the state the reply should be left in.
+static jf_reply_state jf_http_cache_transfer_replay(jf_http_cache_transfer *t,
+        const jf_request_type request_type,
+        jf_reply *reply)
+{
+    JF_DEBUG_PRINTF("jf_http_cache_transfer_replay: %s\n", t->key);
+
+    if (JF_REQUEST_TYPE_IS_SAX(request_type)) {
+        // NB for async requests this blocks the loop for as long as it takes
+        // to parse, but it's only ever a page or so
+        jf_thread_buffer_feed(reply->tb, t->cached->body, t->cached->size, reply);
+        if (JF_REPLY_PTR_HAS_ERROR(reply)) return reply->state;
+    } else {
+        free(reply->payload);
+        assert((reply->payload = malloc(t->cached->size + 1)) != NULL);
+        memcpy(reply->payload, t->cached->body, t->cached->size + 1);
+        reply->size = t->cached->size;
+    }
+    return JF_REPLY_SUCCESS;
+}
+
+
+static void jf_http_cache_transfer_end(jf_http_cache_transfer *t)
+{
+    free(t->key);
+    if (t->cached != NULL) {
+        assert(pthread_mutex_lock(&s_http_cache_mut) == 0);
+        jf_http_cache_entry_unref(t->cached);
+        assert(pthread_mutex_unlock(&s_http_cache_mut) == 0);
+    }
+    curl_slist_free_all(t->headers);
+    free(t->etag);
+    free(t->last_modified);
+    free(t->body);
+    *t = (jf_http_cache_transfer){ 0 };
+}
+
+
+static size_t jf_http_cache_header_callback(char *payload,
+        size_t size,
+        size_t nmemb,
+        void *userdata)
+{
+    size_t real_size = size * nmemb;
+    jf_http_cache_transfer *t = (jf_http_cache_transfer *)userdata;
+    char **field;
+    char *value, *end;
+
+    if (real_size >= JF_STATIC_STRLEN("HTTP/")
+            && strncmp(payload, "HTTP/", JF_STATIC_STRLEN("HTTP/")) == 0) {
+        // a new response (i.e. after a redirect): forget the previous one
+        free(t->etag);
+        free(t->last_modified);
+        t->etag = NULL;
+        t->last_modified = NULL;
+        return real_size;
+    } else if (real_size > JF_STATIC_STRLEN("etag:")
+            && strncasecmp(payload, "etag:", JF_STATIC_STRLEN("etag:")) == 0) {
+        field = &t->etag;
+        value = payload + JF_STATIC_STRLEN("etag:");
+    } else if (real_size > JF_STATIC_STRLEN("last-modified:")
+            && strncasecmp(payload, "last-modified:", JF_STATIC_STRLEN("last-modified:")) == 0) {
+        field = &t->last_modified;
+        value = payload + JF_STATIC_STRLEN("last-modified:");
+    } else {
+        return real_size;
+    }
+
+    end = payload + real_size;
+    while (value < end && (*value == ' ' || *value == '\t')) value++;
+    while (end > value && (end[-1] == '\r' || end[-1] == '\n'
+                || end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    free(*field);
+    *field = NULL;
+    // one the cache file would refuse isn't worth revalidating with
+    if (end > value && (size_t)(end - value) <= JF_NET_HTTP_CACHE_VALIDATOR_MAX) {
+        assert((*field = strndup(value, (size_t)(end - value))) != NULL);
+    }
+
+    return real_size;
+}
+
+
+// Feeds the parser and keeps a copy of the body to store.
+static size_t jf_http_cache_sax_callback(char *payload,
+        size_t size,
+        size_t nmemb,
+        void *userdata)
+{
+    size_t real_size = size * nmemb;
+    jf_http_cache_transfer *t = (jf_http_cache_transfer *)userdata;
+
+    // it will all come again once resumed
+    if (jf_thread_buffer_should_pause(t->reply->tb, real_size)) {
+        return CURL_WRITEFUNC_PAUSE;
+    }
+
+    if (! t->body_too_big) {
+        if (t->body_size + real_size > jf_http_cache_max_bytes()) {
+            t->body_too_big = true;
+            free(t->body);
+            t->body = NULL;
+        } else {
+            assert((t->body = realloc(t->body, t->body_size + real_size + 1)) != NULL);
+            memcpy(t->body + t->body_size, payload, real_size);
+            t->body_size += real_size;
+            t->body[t->body_size] = '\0';
+        }
+    }
+
+    return jf_thread_buffer_write(t->reply->tb, payload, real_size, t->reply);
+}
+////////////////////////////////
+
+
+////////// NETWORK STATS //////////
+static bool jf_net_stats_segment_is_id(const char *segment, const size_t len)
+{
+    size_t i, digits = 0, hex = 0, dashes = 0;
+
+    for (i = 0; i < len; i++) {
+        if (segment[i] >= '0' && segment[i] <= '9') {
+            digits++;
+        } else if ((segment[i] >= 'a' && segment[i] <= 'f')
+                || (segment[i] >= 'A' && segment[i] <= 'F')) {
+            hex++;
+        } else if (segment[i] == '-') {
+            dashes++;
+        } else {
+            return false;
+        }
+    }
+    if (len > 0 && digits == len) return true;
+    // Jellyfin ids, with or without the dashes
+    return (len == 32 && dashes == 0) || (len == 36 && dashes == 4);
+}
+
+
+static char *jf_net_stats_endpoint_name(const char *url)
+{
+    const char *path, *end, *p, *segment_end;
+    char *name, *n;
+    size_t length = 1;
+
+    // skip scheme and host
+    path = (path = strstr(url, "://")) != NULL ? path + 3 : url;
+    if ((path = strchr(path, '/')) == NULL) path = "/";
+    end = path + strcspn(path, "?#");
+
+    // first pass to size the name: "{id}" may well be longer than the
+    // segment it stands for
+    for (p = path; p < end; p = segment_end) {
+        p++; // the slash
+        segment_end = memchr(p, '/', (size_t)(end - p));
+        if (segment_end == NULL) segment_end = end;
+        length += 1 + (jf_net_stats_segment_is_id(p, (size_t)(segment_end - p)) ?
+                JF_STATIC_STRLEN("{id}") : (size_t)(segment_end - p));
+    }
+
+    assert((name = malloc(length)) != NULL);
+    n = name;
+    while (path < end) {
+        *n++ = *path++; // the slash
+        segment_end = memchr(path, '/', (size_t)(end - path));
+        if (segment_end == NULL) segment_end = end;
+        if (jf_net_stats_segment_is_id(path, (size_t)(segment_end - path))) {
+            memcpy(n, "{id}", 4);
+            n += 4;
+        } else {
+            memcpy(n, path, (size_t)(segment_end - path));
+            n += segment_end - path;
+        }
+        path = segment_end;
+    }
+    *n = '\0';
+    return name;
+}
+
+
+// scale converts what old versions of curl report as a double to the unit of
+// the _T variant.
+static curl_off_t jf_net_stats_getinfo(CURL *handle,
+        const CURLINFO info,
+        __attribute__((unused)) const double scale)
+{
+#if JF_CURL_VERSION_GE(7,61)
+    curl_off_t value;
+
+    JF_CURL_ASSERT(curl_easy_getinfo(handle, info, &value));
+    return value;
+#else
+    double value;
+
+    JF_CURL_ASSERT(curl_easy_getinfo(handle, info, &value));
+    return (curl_off_t)(value * scale);
+#endif
+}
+
+
+static size_t jf_net_stats_bucket(const curl_off_t us)
+{
+    curl_off_t ms = us / 1000;
+    size_t bucket;
+
+    if (ms < 1) return 0;
+    for (bucket = 1; ms >= 2 && bucket < JF_NET_STATS_BUCKETS - 1; bucket++) {
+        ms >>= 1;
+    }
+    return bucket;
+}
+
+
+static void jf_net_stats_record(CURL *handle, const CURLcode result)
+{
+    jf_net_stats_endpoint *e = NULL;
+    char *url = NULL;
+    char *name;
+    curl_off_t dns, connect, tls, pretransfer, starttransfer, total, bytes_down;
+    long num_connects, status_code;
+    size_t i;
+
+    JF_CURL_ASSERT(curl_easy_getinfo(handle, CURLINFO_EFFECTIVE_URL, &url));
+    if (url == NULL) return;
+    name = jf_net_stats_endpoint_name(url);
+
+    // curl reports points in time since the start of the transfer
+    dns = jf_net_stats_getinfo(handle, JF_NET_STATS_INFO(NAMELOOKUP_TIME), 1e6);
+    connect = jf_net_stats_getinfo(handle, JF_NET_STATS_INFO(CONNECT_TIME), 1e6);
+    tls = jf_net_stats_getinfo(handle, JF_NET_STATS_INFO(APPCONNECT_TIME), 1e6);
+    pretransfer = jf_net_stats_getinfo(handle, JF_NET_STATS_INFO(PRETRANSFER_TIME), 1e6);
+    starttransfer = jf_net_stats_getinfo(handle, JF_NET_STATS_INFO(STARTTRANSFER_TIME), 1e6);
+    total = jf_net_stats_getinfo(handle, JF_NET_STATS_INFO(TOTAL_TIME), 1e6);
+    bytes_down = jf_net_stats_getinfo(handle, JF_NET_STATS_INFO(SIZE_DOWNLOAD), 1);
+    JF_CURL_ASSERT(curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &num_connects));
+    JF_CURL_ASSERT(curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status_code));
+    // turn them into durations
+    tls = tls > connect ? tls - connect : 0;
+    connect = connect > dns ? connect - dns : 0;
+    starttransfer = starttransfer > pretransfer ? starttransfer - pretransfer : 0;
+
+    assert(pthread_mutex_lock(&s_net_stats_mut) == 0);
+    for (i = 0; i < s_net_stats_count; i++) {
+        if (strcmp(s_net_stats[i].name, name) == 0) {
+            e = s_net_stats + i;
+            free(name);
+            break;
+        }
+    }
+    if (e == NULL) {
+        if (s_net_stats_count == s_net_stats_size) {
+            s_net_stats_size = s_net_stats_size == 0 ? 16 : 2 * s_net_stats_size;
+            assert((s_net_stats = realloc(s_net_stats,
+                            s_net_stats_size * sizeof(jf_net_stats_endpoint))) != NULL);
+        }
+        e = s_net_stats + s_net_stats_count++;
+        *e = (jf_net_stats_endpoint){ 0 };
+        e->name = name;
+    }
+    e->count++;
+    if (result != CURLE_OK || status_code >= 400) e->errors++;
+    if (num_connects == 0) e->reused++;
+    e->bytes_down += bytes_down;
+    e->dns_us += dns;
+    e->connect_us += connect;
+    e->tls_us += tls;
+    e->wait_us += starttransfer;
+    e->total_us += total;
+    e->wait_histogram[jf_net_stats_bucket(starttransfer)]++;
+    e->total_histogram[jf_net_stats_bucket(total)]++;
+    assert(pthread_mutex_unlock(&s_net_stats_mut) == 0);
+}
+
+
+static int jf_net_stats_endpoint_cmp(const void *a, const void *b)
+{
+    const jf_net_stats_endpoint *ea = (const jf_net_stats_endpoint *)a;
+    const jf_net_stats_endpoint *eb = (const jf_net_stats_endpoint *)b;
+
+    return (ea->total_us < eb->total_us) - (ea->total_us > eb->total_us);
+}
+
+
+// Returns a copy of the stats sorted by total time, descending. Names are
+// shared with the originals, which live till exit.
+static jf_net_stats_endpoint *jf_net_stats_snapshot(size_t *count)
+{
+    jf_net_stats_endpoint *snapshot;
+
+    assert(pthread_mutex_lock(&s_net_stats_mut) == 0);
+    *count = s_net_stats_count;
+    assert((snapshot = malloc((*count + 1) * sizeof(jf_net_stats_endpoint))) != NULL);
+    if (*count > 0) {
+        memcpy(snapshot, s_net_stats, *count * sizeof(jf_net_stats_endpoint));
+    }
+    assert(pthread_mutex_unlock(&s_net_stats_mut) == 0);
+    qsort(snapshot, *count, sizeof(jf_net_stats_endpoint), jf_net_stats_endpoint_cmp);
+
+    return snapshot;
+}
+
+
+static void jf_net_stats_print_histogram(const char *label, const size_t *histogram)
+{
+    size_t i;
+
+    printf("  %s ms:", label);
+    for (i = 0; i < JF_NET_STATS_BUCKETS; i++) {
+        if (histogram[i] == 0) continue;
+        if (i == 0) {
+            printf(" <1: %zu", histogram[i]);
+        } else if (i == JF_NET_STATS_BUCKETS - 1) {
+            printf(" %lu+: %zu", 1UL << (i - 1), histogram[i]);
+        } else {
+            printf(" %lu-%lu: %zu", 1UL << (i - 1), 1UL << i, histogram[i]);
+        }
+    }
+    printf("\n");
+}
+
+
+void jf_net_stats_print(void)
+{
+    jf_net_stats_endpoint *stats, *e;
+    size_t count, i;
+
+    stats = jf_net_stats_snapshot(&count);
+    printf("\n===== Network statistics =====\n");
+    if (count == 0) {
+        printf("No requests yet.\n");
+    }
+    for (i = 0; i < count; i++) {
+        e = stats + i;
+        printf("%s\n", e->name);
+        printf("  requests %zu, failed %zu, on reused connections %zu, KiB down %.1f\n",
+                e->count,
+                e->errors,
+                e->reused,
+                (double)e->bytes_down / 1024);
+        printf("  average ms: name lookup %.1f, connect %.1f, TLS %.1f, wait %.1f, total %.1f\n",
+                (double)e->dns_us / 1000 / (double)e->count,
+                (double)e->connect_us / 1000 / (double)e->count,
+                (double)e->tls_us / 1000 / (double)e->count,
+                (double)e->wait_us / 1000 / (double)e->count,
+                (double)e->total_us / 1000 / (double)e->count);
+        jf_net_stats_print_histogram("wait", e->wait_histogram);
+        jf_net_stats_print_histogram("total", e->total_histogram);
+    }
+    free(stats);
+}
+
+
+static void jf_net_stats_dump_histogram(FILE *file,
+        const char *key,
+        const size_t *histogram)
+{
+    size_t i;
+
+    fprintf(file, ",\"%s\":[", key);
+    for (i = 0; i < JF_NET_STATS_BUCKETS; i++) {
+        fprintf(file, i == 0 ? "%zu" : ",%zu", histogram[i]);
+    }
+    fprintf(file, "]");
+}
+
+
+static void jf_net_stats_dump(void)
+{
+    FILE *file;
+    char *path;
+    jf_net_stats_endpoint *stats, *e;
+    const char *c;
+    size_t count, i;
+    bool failed;
+
+    assert((path = jf_concat(3, g_state.config_dir, "/", JF_NET_STATS_DUMP_FILE)) != NULL);
+    if ((file = fopen(path, "w")) == NULL) {
+        fprintf(stderr,
+                "Warning: could not write the network statistics to %s: %s.\n",
+                path,
+                strerror(errno));
+        free(path);
+        return;
+    }
+
+    stats = jf_net_stats_snapshot(&count);
+    fprintf(file, "{\"histogram_buckets_ms_log2\":%d,\"endpoints\":[", JF_NET_STATS_BUCKETS);
+    for (i = 0; i < count; i++) {
+        e = stats + i;
+        fprintf(file, i == 0 ? "\n{\"endpoint\":\"" : ",\n{\"endpoint\":\"");
+        for (c = e->name; *c != '\0'; c++) {
+            if (*c == '"' || *c == '\\') fputc('\\', file);
+            fputc(*c, file);
+        }
+        fprintf(file,
+                "\",\"count\":%zu,\"errors\":%zu,\"reused\":%zu,\"bytes_down\":%lld"
+                ",\"dns_us\":%lld,\"connect_us\":%lld,\"tls_us\":%lld,\"wait_us\":%lld,\"total_us\":%lld",
+                e->count,
+                e->errors,
+                e->reused,
+                e->bytes_down,
+                e->dns_us,
+                e->connect_us,
+                e->tls_us,
+                e->wait_us,
+                e->total_us);
+        jf_net_stats_dump_histogram(file, "wait_histogram", e->wait_histogram);
+        jf_net_stats_dump_histogram(file, "total_histogram", e->total_histogram);
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n]}\n");
+    free(stats);
+
+    failed = ferror(file) != 0;
+    if (fclose(file) != 0 || failed) {
+        fprintf(stderr,
+                "Warning: could not write the network statistics to %s.\n",
+                path);
+    }
+    free(path);
+}
+///////////////////////////////////
+
+
+////////// NETWORK UNIT //////////
+static void jf_net_init(void)
+{
+    char *tmp;
+    pthread_t sax_parser_thread;
+    size_t i;
+
+    assert(pthread_mutex_lock(&s_mut) == 0);
+    if (s_handle != NULL) {
+        pthread_mutex_unlock(&s_mut);
+        return;
+    }
+
+    // TODO check libcurl version
+    
+    // global config stuff
+    assert(curl_global_init(CURL_GLOBAL_ALL | CURL_GLOBAL_SSL) == 0);
+    // security bypass
+    if (! g_options.ssl_verifyhost) {
+        curl_easy_setopt(s_handle, CURLOPT_SSL_VERIFYHOST, 0);
+    }
+    // headers
+    assert((s_headers = curl_slist_append(s_headers,
+                    "accept: application/json; charset=utf-8")) != NULL);
+    if (g_state.state == JF_STATE_STARTING_LOGIN
+            || g_state.state == JF_STATE_STARTING_FULL_CONFIG) {
+        // the only thing we will do is a POST for login
+        tmp = jf_concat(9,
+                "x-emby-authorization: Mediabrowser Client=\"", g_options.client,
+                "\", Device=\"", g_options.device, 
+                "\", DeviceId=\"", g_options.deviceid,
+                "\", Version=\"", g_options.version,
+                "\"");
+        assert((s_headers_POST = curl_slist_append(s_headers, tmp)) != NULL);
+    } else {
+        // main behaviour
+        tmp = jf_concat(2, "x-mediabrowser-token: ", g_options.token);
+        assert((s_headers = curl_slist_append(s_headers, tmp)) != NULL);
+    }
+    free(tmp);
+    assert((s_headers_POST = curl_slist_append(s_headers_POST == NULL ?
+                    s_headers : s_headers_POST,
+                    "content-type: application/json; charset=utf-8")) != NULL);
+
+    // setup sharing
+    assert((s_curl_sh = curl_share_init()) != NULL);
+    assert(pthread_rwlock_init(&s_share_cookie_rw, NULL) == 0);
+    JF_CURL_SHARE_ASSERT(curl_share_setopt(s_curl_sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_COOKIE));
+    assert(pthread_rwlock_init(&s_share_dns_rw, NULL) == 0);
+    JF_CURL_SHARE_ASSERT(curl_share_setopt(s_curl_sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS));
+    assert(pthread_rwlock_init(&s_share_ssl_rw, NULL) == 0);
+    JF_CURL_SHARE_ASSERT(curl_share_setopt(s_curl_sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION));
+    assert(pthread_rwlock_init(&s_share_connect_rw, NULL) == 0);
+    JF_CURL_SHARE_ASSERT(curl_share_setopt(s_curl_sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT));
+#if JF_CURL_VERSION_GE(7,61)
+    if (curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_PSL) {
+        assert(pthread_rwlock_init(&s_share_psl_rw, NULL) == 0);
+        JF_CURL_SHARE_ASSERT(curl_share_setopt(s_curl_sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_PSL));
+    }
+#endif
+    JF_CURL_SHARE_ASSERT(curl_share_setopt(s_curl_sh, CURLSHOPT_LOCKFUNC, jf_net_share_lock)); 
+    JF_CURL_SHARE_ASSERT(curl_share_setopt(s_curl_sh, CURLSHOPT_UNLOCKFUNC, jf_net_share_unlock));
+
+    s_handle = jf_net_handle_init();
+
+    // sax parser thread
+    jf_thread_buffer_init(&s_tb);
+    assert(pthread_create(&sax_parser_thread, NULL, jf_json_sax_thread, (void *)&(s_tb)) != -1);
+    assert(pthread_detach(sax_parser_thread) == 0);
+    for (i = 0; i < JF_NET_SAX_PARSERS; i++) {
+        jf_thread_buffer_init(&s_parsers[i].tb);
+        s_parsers[i].tb.quiet = true;
+        s_parsers[i].tb.producer_wakeup = jf_net_parser_wakeup;
+        s_parsers[i].handle = NULL;
+        s_parsers[i].busy = false;
+        assert(pthread_create(&sax_parser_thread,
+                    NULL,
+                    jf_json_sax_thread,
+                    (void *)&(s_parsers[i].tb)) != -1);
+        assert(pthread_detach(sax_parser_thread) == 0);
+    }
+
+    // async networking
+    jf_async_lane_init(s_async_lanes + JF_REQUEST_PRIORITY_INTERACTIVE,
+            0,
+            JF_NET_MAX_HOST_CONNECTIONS);
+    jf_async_lane_init(s_async_lanes + JF_REQUEST_PRIORITY_PREFETCH,
+            JF_NET_PREFETCH_MAX_QUEUED,
+            JF_NET_PREFETCH_MAX_IN_FLIGHT);
+    jf_async_lane_init(s_async_lanes + JF_REQUEST_PRIORITY_BACKGROUND,
+            JF_NET_BACKGROUND_MAX_QUEUED,
+            JF_NET_BACKGROUND_MAX_IN_FLIGHT);
+    assert((s_multi = curl_multi_init()) != NULL);
+    JF_CURL_MULTI_ASSERT(curl_multi_setopt(s_multi,
+                CURLMOPT_MAX_HOST_CONNECTIONS,
+                (long)JF_NET_MAX_HOST_CONNECTIONS));
+    // updates left over from last time go out as soon as the loop starts
+    // (not while logging in, they'd lack the token)
+    if (g_state.config_dir != NULL
+            && g_state.state != JF_STATE_STARTING_LOGIN
+            && g_state.state != JF_STATE_STARTING_FULL_CONFIG) {
+        jf_net_pending_load();
+    }
+    assert(pthread_create(&s_async_thread, NULL, jf_net_async_loop_thread, NULL) != -1);
+
+    // http cache
+    if (g_options.http_cache_persist && g_state.config_dir != NULL) {
+        jf_http_cache_load();
+    }
+
+    assert(pthread_mutex_unlock(&s_mut) == 0);
+}
+
+
+void jf_net_clear(void)
+{
+    assert(pthread_mutex_lock(&s_mut) == 0);
+    if (s_handle == NULL) {
+        pthread_mutex_unlock(&s_mut);
+        return;
+    }
+
+    assert(pthread_mutex_lock(&s_async_mut) == 0);
+    s_async_exiting = true;
+    assert(pthread_cond_signal(&s_async_cv) == 0);
+    assert(pthread_mutex_unlock(&s_async_mut) == 0);
+#if JF_CURL_VERSION_GE(7,68)
+    JF_CURL_MULTI_ASSERT(curl_multi_wakeup(s_multi));
+#endif
+    curl_easy_cleanup(s_handle);
+    assert(pthread_join(s_async_thread, NULL) == 0);
+    curl_multi_cleanup(s_multi);
+    // the loop is gone, nothing changes the queue anymore
+    jf_net_pending_save();
+    while (s_pending_count > 0) {
+        jf_pending_update_free(s_pending[--s_pending_count]);
+    }
+    free(s_pending);
+    if (g_options.http_cache_persist && g_state.config_dir != NULL) {
+        jf_http_cache_save();
+    }
+    if (g_options.net_stats_dump && g_state.config_dir != NULL) {
+        jf_net_stats_dump();
+    }
+    curl_share_cleanup(s_curl_sh);
+    curl_slist_free_all(s_headers_POST);
+    curl_global_cleanup();
+
+    assert(pthread_mutex_unlock(&s_mut) == 0);
+}
+//////////////////////////////////
+
+
+////////// NETWORKING //////////
+static bool jf_reply_is_cancelled(jf_reply *r)
+{
+    bool cancelled;
+
+    assert(pthread_mutex_lock(&r->mut) == 0);
+    cancelled = r->cancelled;
+    assert(pthread_mutex_unlock(&r->mut) == 0);
+    return cancelled;
+}
+
+
+static int jf_net_sync_xferinfo_callback(__attribute__((unused)) void *clientp,
+        __attribute__((unused)) curl_off_t dltotal,
+        __attribute__((unused)) curl_off_t dlnow,
+        __attribute__((unused)) curl_off_t ultotal,
+        __attribute__((unused)) curl_off_t ulnow)
+{
+    // nonzero aborts the transfer
+    return s_sync_cancelled ? 1 : 0;
+}
+
+
+static int jf_net_async_xferinfo_callback(void *clientp,
+        __attribute__((unused)) curl_off_t dltotal,
+        __attribute__((unused)) curl_off_t dlnow,
+        __attribute__((unused)) curl_off_t ultotal,
+        __attribute__((unused)) curl_off_t ulnow)
+{
+    jf_reply *r = (jf_reply *)clientp;
+
+    return r != NULL && jf_reply_is_cancelled(r) ? 1 : 0;
+}
+
+
+static CURL *jf_net_handle_init(void)
+{
+    CURL *handle;
+
+    assert((handle = curl_easy_init()) != NULL);
+
+    // report errors
+    s_curl_errorbuffer[0] = '\0';
+    s_curl_errorbuffer[sizeof(s_curl_errorbuffer) - 1] = '\0';
+    JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, s_curl_errorbuffer));
+
+    // be a good neighbour
+    JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_SHARE, s_curl_sh));
+    JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L));
+
+    // ask for all supported kinds of compression
     JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, ""));
 
     // follow redirects and keep POST method if using it
@@ -398,7 +1656,8 @@ static void jf_net_handle_before_perform(CURL *handle,
         const jf_request_type request_type,
         const jf_http_method method,
         const char *payload,
-        const jf_reply *reply)
+        jf_reply *reply,
+        jf_http_cache_transfer *transfer)
 {
     char *url;
 
@@ -413,17 +1672,25 @@ static void jf_net_handle_before_perform(CURL *handle,
         JF_CURL_ASSERT(curl_easy_setopt(handle,
                     CURLOPT_URL,
                     "https://github.com/Aanok/jftui/releases/latest"));
+        jf_http_cache_transfer_begin(transfer, NULL, request_type, method, reply);
     } else {
         url = jf_concat(2, g_options.server, resource);
         JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_URL, url));
+        jf_http_cache_transfer_begin(transfer, url, request_type, method, reply);
         free(url);
     }
 
     // HTTP method and headers
+    // handles get reused, so undo a previous DELETE
+    if (method != JF_HTTP_DELETE) {
+        JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, NULL));
+    }
     switch (method) {
         case JF_HTTP_GET:
             JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_HTTPGET, 1));
-            JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_HTTPHEADER, s_headers));
+            JF_CURL_ASSERT(curl_easy_setopt(handle,
+                        CURLOPT_HTTPHEADER,
+                        transfer->headers != NULL ? transfer->headers : s_headers));
             break;
         case JF_HTTP_POST:
             // for ASYNC_DETACH we must assume the caller unwilling or unable
@@ -434,6 +1701,8 @@ static void jf_net_handle_before_perform(CURL *handle,
             JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_HTTPHEADER, s_headers_POST));
             break;
         case JF_HTTP_DELETE:
+            // drop the body of a previous POST, which may be long gone
+            JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_HTTPGET, 1));
             JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, "DELETE"));
             JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_HTTPHEADER, s_headers));
             break;
@@ -445,12 +1714,17 @@ static void jf_net_handle_before_perform(CURL *handle,
         case JF_REQUEST_ASYNC_IN_MEMORY:
             JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, jf_reply_callback));
             break;
+        case JF_REQUEST_SAX:
         case JF_REQUEST_SAX_PROMISCUOUS:
-            s_tb.promiscuous_context = true;
+            reply->tb = &s_tb;
+            s_tb.promiscuous_context = JF_REQUEST_TYPE_IS_PROMISCUOUS(request_type);
             JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, jf_thread_buffer_callback));
             break;
-        case JF_REQUEST_SAX:
-            s_tb.promiscuous_context = false;
+        case JF_REQUEST_ASYNC_SAX:
+        case JF_REQUEST_ASYNC_SAX_PROMISCUOUS:
+            // the async loop handed it a parser of its own
+            reply->tb->promiscuous_context = JF_REQUEST_TYPE_IS_PROMISCUOUS(request_type);
+            reply->tb->destination = reply->items = jf_disk_scratch_new();
             JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, jf_thread_buffer_callback));
             break;
         case JF_REQUEST_CHECK_UPDATE:
@@ -468,19 +1742,44 @@ static void jf_net_handle_before_perform(CURL *handle,
             return;
     }
     JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void *)reply));
+
+    // cancellation is checked on progress
+    JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 0L));
+    if (JF_REQUEST_TYPE_IS_ASYNC(request_type)) {
+        JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_XFERINFOFUNCTION, jf_net_async_xferinfo_callback));
+        JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_XFERINFODATA, (void *)reply));
+    } else {
+        JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_XFERINFOFUNCTION, jf_net_sync_xferinfo_callback));
+        JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_XFERINFODATA, NULL));
+    }
+
+    // cacheable: collect validators and, for SAX, a copy of the body
+    if (transfer->key != NULL) {
+        JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, jf_http_cache_header_callback));
+        JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_HEADERDATA, (void *)transfer));
+        if (JF_REQUEST_TYPE_IS_SAX(request_type)) {
+            JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, jf_http_cache_sax_callback));
+            JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void *)transfer));
+        }
+    }
 }
 
 
-static void jf_net_handle_after_perform(CURL *handle,
+// Returns the state the reply should be left in, which is up to the caller to
+// publish: nothing that looks at the reply may see it finished before then.
+static jf_reply_state jf_net_handle_after_perform(CURL *handle,
         const CURLcode result,
         const jf_request_type request_type,
-        jf_reply *reply)
+        jf_reply *reply,
+        jf_http_cache_transfer *transfer)
 {
     long status_code;
 
+    jf_net_stats_record(handle, result);
+
     if (request_type == JF_REQUEST_ASYNC_DETACH || reply == NULL) {
         jf_reply_free(reply);
-        return;
+        return JF_REPLY_PENDING;
     }
 
     if (request_type == JF_REQUEST_CHECK_UPDATE) {
@@ -489,102 +1788,610 @@ static void jf_net_handle_after_perform(CURL *handle,
         JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, NULL));
         JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_HEADERDATA, NULL));
     }
+    if (transfer->key != NULL) {
+        JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, NULL));
+        JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_HEADERDATA, NULL));
+    }
 
     // leave if we've already caught an error
-    if (JF_REPLY_PTR_HAS_ERROR(reply)) return;
+    if (JF_REPLY_PTR_HAS_ERROR(reply)) return reply->state;
+
+    // the parser may have been left halfway through the document
+    if (result != CURLE_OK && JF_REQUEST_TYPE_IS_SAX(request_type)) {
+        jf_thread_buffer_reset(reply->tb);
+    }
+
+    if (result == CURLE_ABORTED_BY_CALLBACK) {
+        free(reply->payload);
+        reply->payload = NULL;
+        return JF_REPLY_ERROR_CANCELLED;
+    }
 
     // copy info text and leave if curl caught an error
     if (result != CURLE_OK) {
         free(reply->payload);
         reply->payload = (char *)curl_easy_strerror(result);
-        reply->state = JF_REPLY_ERROR_NETWORK;
-        return;
+        return JF_REPLY_ERROR_NETWORK;
     }
 
-    if (request_type == JF_REQUEST_SAX_PROMISCUOUS || request_type == JF_REQUEST_SAX) {
-        jf_thread_buffer_wait_parsing_done();
+    if (JF_REQUEST_TYPE_IS_SAX(request_type)) {
+        jf_thread_buffer_wait_parsing_done(reply->tb, reply);
+        if (JF_REPLY_PTR_HAS_ERROR(reply)) return reply->state;
     }
 
     // check for http error
     JF_CURL_ASSERT(curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status_code));
+    if (status_code == 304 && transfer->cached != NULL) {
+        return jf_http_cache_transfer_replay(transfer, request_type, reply);
+    }
     switch (status_code) { 
         case 200:
+            jf_http_cache_transfer_store(transfer, request_type, reply);
+            return JF_REPLY_SUCCESS;
         case 204:
-            reply->state = JF_REPLY_SUCCESS;
-            break;
+            return JF_REPLY_SUCCESS;
         case 400:
-            reply->state = JF_REPLY_ERROR_HTTP_400;
-            break;
+            return JF_REPLY_ERROR_HTTP_400;
         case 401:
-            reply->state = JF_REPLY_ERROR_HTTP_401;
-            break;
+            return JF_REPLY_ERROR_HTTP_401;
         case 302:
             if (request_type == JF_REQUEST_CHECK_UPDATE) {
-                reply->state = reply->payload == NULL ?
+                return reply->payload == NULL ?
                     JF_REPLY_ERROR_BAD_LOCATION
                     : JF_REPLY_SUCCESS;
-                break;
             }
             // no break on else
         default:
             free(reply->payload);
             assert((reply->payload = malloc(34)) != NULL);
             snprintf(reply->payload, 34, "http request returned status %ld", status_code);
-            reply->state = JF_REPLY_ERROR_HTTP_NOT_OK;
+            return JF_REPLY_ERROR_HTTP_NOT_OK;
+    }
+}
+
+jf_reply *jf_net_request(const char *resource,
+        const jf_request_type request_type,
+        const jf_http_method method,
+        const char *payload)
+{
+    jf_request_priority priority;
+
+    switch (request_type) {
+        case JF_REQUEST_ASYNC_DETACH:
+            priority = JF_REQUEST_PRIORITY_BACKGROUND;
+            break;
+        case JF_REQUEST_CHECK_UPDATE:
+            priority = JF_REQUEST_PRIORITY_PREFETCH;
             break;
+        default:
+            priority = JF_REQUEST_PRIORITY_INTERACTIVE;
+            break;
+    }
+
+    return jf_net_request_priority(resource, request_type, method, payload, priority);
+}
+
+
+jf_reply *jf_net_request_priority(const char *resource,
+        const jf_request_type request_type,
+        const jf_http_method method,
+        const char *payload,
+        const jf_request_priority priority)
+{
+    jf_reply *reply;
+    jf_async_request *a_r;
+    jf_http_cache_transfer transfer;
+    CURLcode result;
+    
+    if (request_type == JF_REQUEST_EXIT) {
+        reply = jf_reply_new();
+        reply->state = JF_REPLY_ERROR_EXIT_REQUEST;
+        reply->done = true;
+        return reply;
+    }
+
+    if (s_handle == NULL) {
+        jf_net_init();
+    }
+
+    // piggyback on an identical GET if there's one pending
+    if ((request_type == JF_REQUEST_ASYNC_IN_MEMORY || request_type == JF_REQUEST_IN_MEMORY)
+            && method == JF_HTTP_GET
+            && (reply = jf_net_async_join(resource)) != NULL) {
+        return request_type == JF_REQUEST_IN_MEMORY ? jf_net_await(reply) : reply;
+    }
+
+    if (JF_REQUEST_TYPE_IS_ASYNC(request_type)) {
+        a_r = jf_async_request_new(resource,
+                request_type,
+                method,
+                payload,
+                priority);
+        reply = a_r->reply;
+        jf_net_async_enqueue(a_r);
+    } else {
+        reply = jf_reply_new();
+        jf_net_handle_before_perform(s_handle,
+                resource,
+                request_type,
+                method,
+                payload,
+                reply,
+                &transfer);
+        s_sync_cancelled = 0;
+        s_sync_running = 1;
+        result = curl_easy_perform(s_handle);
+        s_sync_running = 0;
+        reply->state = jf_net_handle_after_perform(s_handle,
+                result,
+                request_type,
+                reply,
+                &transfer);
+        reply->done = true;
+        jf_http_cache_transfer_end(&transfer);
+    }
+
+    return reply;
+}
+
+
+jf_reply *jf_net_sax_digest(const char *body,
+        const size_t size,
+        const jf_request_type request_type,
+        const bool quiet,
+        const bool append)
+{
+    jf_reply *reply;
+
+    assert(request_type == JF_REQUEST_SAX || request_type == JF_REQUEST_SAX_PROMISCUOUS);
+    if (s_handle == NULL) {
+        jf_net_init();
+    }
+
+    reply = jf_reply_new();
+    reply->tb = &s_tb;
+    s_tb.promiscuous_context = request_type == JF_REQUEST_SAX_PROMISCUOUS;
+    s_tb.quiet = quiet;
+    s_tb.append = append;
+    jf_thread_buffer_feed(&s_tb, body, size, reply);
+    s_tb.quiet = false;
+    s_tb.append = false;
+    if (! JF_REPLY_PTR_HAS_ERROR(reply)) {
+        reply->state = JF_REPLY_SUCCESS;
+    }
+    reply->done = true;
+
+    return reply;
+}
+///////////////////////////////////
+
+
+////////// PENDING UPDATES //////////
+static jf_pending_update *jf_pending_update_new(const char *key,
+        const char *resource,
+        const jf_http_method method,
+        const char *payload)
+{
+    jf_pending_update *u;
+
+    assert((u = malloc(sizeof(jf_pending_update))) != NULL);
+    assert((u->key = strdup(key)) != NULL);
+    assert((u->resource = strdup(resource)) != NULL);
+    u->method = method;
+    if (payload == NULL || method != JF_HTTP_POST) {
+        u->payload = NULL;
+    } else {
+        assert((u->payload = strdup(payload)) != NULL);
+    }
+    u->attempts = 0;
+    u->next_attempt = time(NULL);
+    u->in_flight = false;
+    u->superseded = false;
+    return u;
+}
+
+
+static void jf_pending_update_free(jf_pending_update *u)
+{
+    if (u == NULL) return;
+    free(u->key);
+    free(u->resource);
+    free(u->payload);
+    free(u);
+}
+
+
+// NB call with the pending lock held.
+static void jf_net_pending_append(jf_pending_update *u)
+{
+    if (s_pending_count == s_pending_size) {
+        s_pending_size = s_pending_size == 0 ? 16 : 2 * s_pending_size;
+        assert((s_pending = realloc(s_pending,
+                        s_pending_size * sizeof(jf_pending_update *))) != NULL);
+    }
+    s_pending[s_pending_count++] = u;
+}
+
+
+// Takes entry i out of the queue, keeping the others in order. Does not free
+// it.
+// NB call with the pending lock held.
+static void jf_net_pending_remove(const size_t i)
+{
+    memmove(s_pending + i,
+            s_pending + i + 1,
+            (s_pending_count - i - 1) * sizeof(jf_pending_update *));
+    s_pending_count--;
+}
+
+
+// Whether update u can't be started yet: it already is, or the update it
+// replaced is still on its way and must reach the server first.
+// NB call with the pending lock held.
+static bool jf_net_pending_is_held(const jf_pending_update *u)
+{
+    size_t i;
+
+    if (u->in_flight) return true;
+    for (i = 0; i < s_pending_count; i++) {
+        if (s_pending[i]->superseded && strcmp(s_pending[i]->key, u->key) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static void jf_net_pending_load(void)
+{
+    FILE *file;
+    char *path;
+    char magic[JF_STATIC_STRLEN(JF_NET_PENDING_MAGIC)];
+    // key, resource, payload (+1, 0 for none), method
+    size_t lengths[4];
+    char *fields[3];
+    size_t i, read;
+
+    assert((path = jf_concat(3, g_state.config_dir, "/", JF_NET_PENDING_FILE)) != NULL);
+    if ((file = fopen(path, "r")) == NULL) {
+        if (errno != ENOENT) {
+            fprintf(stderr,
+                    "Warning: could not open pending updates file (%s): %s.\n",
+                    path,
+                    strerror(errno));
+        }
+        free(path);
+        return;
+    }
+
+    if (fread(magic, sizeof(magic), 1, file) != 1
+            || memcmp(magic, JF_NET_PENDING_MAGIC, sizeof(magic)) != 0) {
+        goto bad_exit;
+    }
+    assert(pthread_mutex_lock(&s_pending_mut) == 0);
+    while ((read = fread(lengths, sizeof(size_t), 4, file)) == 4) {
+        if (lengths[0] == 0 || lengths[1] == 0 || lengths[3] > JF_HTTP_DELETE) {
+            assert(pthread_mutex_unlock(&s_pending_mut) == 0);
+            goto bad_exit;
+        }
+        lengths[2] = lengths[2] == 0 ? 0 : lengths[2] - 1;
+        for (i = 0; i < 3; i++) {
+            assert((fields[i] = malloc(lengths[i] + 1)) != NULL);
+            if (lengths[i] > 0 && fread(fields[i], lengths[i], 1, file) != 1) {
+                do {
+                    free(fields[i]);
+                } while (i-- > 0);
+                assert(pthread_mutex_unlock(&s_pending_mut) == 0);
+                goto bad_exit;
+            }
+            fields[i][lengths[i]] = '\0';
+        }
+        jf_net_pending_append(jf_pending_update_new(fields[0],
+                    fields[1],
+                    (jf_http_method)lengths[3],
+                    fields[2]));
+        for (i = 0; i < 3; i++) {
+            free(fields[i]);
+        }
+    }
+    assert(pthread_mutex_unlock(&s_pending_mut) == 0);
+    if (read != 0 || ! feof(file)) goto bad_exit;
+
+    fclose(file);
+    free(path);
+    return;
+
+bad_exit:
+    fprintf(stderr,
+            "Warning: pending updates file (%s) is damaged, the rest of it will be ignored.\n",
+            path);
+    fclose(file);
+    free(path);
+}
+
+
+// Writes the queue to disk if it changed, or removes the file if it's empty.
+// Superseded updates aren't in the queue anymore, the ones in flight still
+// are. The queue is only serialized under the pending lock: writing and
+// syncing the file happen without it, so that the async loop never waits on
+// the disk.
+// NB call without the pending lock held, and never on the async loop thread.
+static void jf_net_pending_save(void)
+{
+    FILE *file = NULL;
+    char *path, *tmp_path = NULL;
+    jf_growing_buffer buffer = NULL;
+    jf_pending_update *u;
+    size_t lengths[4];
+    size_t i;
+    int fd;
+    bool failed;
+
+    if (g_state.config_dir == NULL) return;
+
+    assert(pthread_mutex_lock(&s_pending_save_mut) == 0);
+    assert(pthread_mutex_lock(&s_pending_mut) == 0);
+    if (! s_pending_dirty) {
+        assert(pthread_mutex_unlock(&s_pending_mut) == 0);
+        assert(pthread_mutex_unlock(&s_pending_save_mut) == 0);
+        return;
+    }
+    if (s_pending_count > 0) {
+        buffer = jf_growing_buffer_new(0);
+        jf_growing_buffer_append(buffer,
+                JF_NET_PENDING_MAGIC,
+                JF_STATIC_STRLEN(JF_NET_PENDING_MAGIC));
+        for (i = 0; i < s_pending_count; i++) {
+            u = s_pending[i];
+            if (u->superseded) continue;
+            lengths[0] = strlen(u->key);
+            lengths[1] = strlen(u->resource);
+            lengths[2] = u->payload == NULL ? 0 : strlen(u->payload) + 1;
+            lengths[3] = (size_t)u->method;
+            jf_growing_buffer_append(buffer, lengths, sizeof(lengths));
+            jf_growing_buffer_append(buffer, u->key, lengths[0]);
+            jf_growing_buffer_append(buffer, u->resource, lengths[1]);
+            if (u->payload != NULL) {
+                jf_growing_buffer_append(buffer, u->payload, lengths[2] - 1);
+            }
+        }
+    }
+    s_pending_dirty = false;
+    assert(pthread_mutex_unlock(&s_pending_mut) == 0);
+
+    assert((path = jf_concat(3, g_state.config_dir, "/", JF_NET_PENDING_FILE)) != NULL);
+    if (buffer == NULL) {
+        if (unlink(path) != 0 && errno != ENOENT) {
+            fprintf(stderr,
+                    "Warning: could not remove pending updates file (%s): %s.\n",
+                    path,
+                    strerror(errno));
+        }
+        goto end;
+    }
+    assert((tmp_path = jf_concat(4, g_state.config_dir, "/", JF_NET_PENDING_FILE, ".tmp")) != NULL);
+
+    if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) == -1
+            || (file = fdopen(fd, "w")) == NULL) {
+        fprintf(stderr,
+                "Warning: could not open temporary pending updates file (%s): %s.\n",
+                tmp_path,
+                strerror(errno));
+        if (fd != -1) close(fd);
+        goto end;
+    }
+
+    fwrite(buffer->buf, 1, buffer->used, file);
+
+    // the whole point is to survive a crash or power loss
+    failed = ferror(file) != 0 || fflush(file) != 0 || fsync(fd) != 0;
+    if (fclose(file) != 0 || failed) {
+        fprintf(stderr,
+                "Warning: could not write pending updates file (%s): %s.\n",
+                tmp_path,
+                strerror(errno));
+        unlink(tmp_path);
+        goto end;
+    }
+    if (rename(tmp_path, path) != 0) {
+        fprintf(stderr,
+                "Warning: could not move temporary pending updates file to final location (%s): %s.\n",
+                path,
+                strerror(errno));
+        unlink(tmp_path);
+    }
+
+end:
+    assert(pthread_mutex_unlock(&s_pending_save_mut) == 0);
+    if (buffer != NULL) jf_growing_buffer_free(buffer);
+    free(path);
+    free(tmp_path);
+}
+
+
+void jf_net_pending_update(const char *resource,
+        const jf_http_method method,
+        const char *payload,
+        const char *key)
+{
+    jf_pending_update *u;
+    size_t i;
+
+    if (s_handle == NULL) {
+        jf_net_init();
+    }
+
+    if (key == NULL) key = resource;
+    u = jf_pending_update_new(key, resource, method, payload);
+
+    assert(pthread_mutex_lock(&s_pending_mut) == 0);
+    for (i = 0; i < s_pending_count; i++) {
+        if (s_pending[i]->superseded || strcmp(s_pending[i]->key, key) != 0) {
+            continue;
+        }
+        if (s_pending[i]->in_flight) {
+            // stays around to hold this one back until it's through
+            s_pending[i]->superseded = true;
+        } else {
+            jf_pending_update_free(s_pending[i]);
+            jf_net_pending_remove(i);
+        }
+        break;
     }
+    jf_net_pending_append(u);
+    s_pending_dirty = true;
+    assert(pthread_mutex_unlock(&s_pending_mut) == 0);
+    jf_net_pending_save();
+
+    // wake the loop up, it starts due updates itself
+    assert(pthread_mutex_lock(&s_async_mut) == 0);
+    assert(pthread_cond_signal(&s_async_cv) == 0);
+    assert(pthread_mutex_unlock(&s_async_mut) == 0);
+#if JF_CURL_VERSION_GE(7,68)
+    JF_CURL_MULTI_ASSERT(curl_multi_wakeup(s_multi));
+#endif
 }
 
 
-jf_reply *jf_net_request(const char *resource,
-        const jf_request_type request_type,
-        const jf_http_method method,
-        const char *payload)
+// Sends the updates due for an attempt down the background lane.
+// Only ever called by the async loop thread.
+static void jf_net_pending_start_due(void)
 {
-    jf_reply *reply;
     jf_async_request *a_r;
-    
-    if (request_type == JF_REQUEST_EXIT) {
-        reply = jf_reply_new();
-        reply->state = JF_REPLY_ERROR_EXIT_REQUEST;
-        return reply;
+    jf_pending_update *u;
+    time_t now = time(NULL);
+    size_t i = 0;
+
+    assert(pthread_mutex_lock(&s_pending_mut) == 0);
+    while (i < s_pending_count) {
+        u = s_pending[i];
+        if (jf_net_pending_is_held(u) || u->next_attempt > now) {
+            i++;
+            continue;
+        }
+        a_r = jf_async_request_new(u->resource,
+                JF_REQUEST_ASYNC_IN_MEMORY,
+                u->method,
+                u->payload,
+                JF_REQUEST_PRIORITY_BACKGROUND);
+        a_r->update = u;
+        u->in_flight = true;
+        // the async lock is taken after the pending one in the loop's wait
+        assert(pthread_mutex_unlock(&s_pending_mut) == 0);
+        jf_net_async_enqueue(a_r);
+        assert(pthread_mutex_lock(&s_pending_mut) == 0);
+        // the queue may have changed meanwhile: start over
+        i = 0;
     }
+    assert(pthread_mutex_unlock(&s_pending_mut) == 0);
+}
 
-    if (s_handle == NULL) {
-        jf_net_init();
+
+// Sleeps on the async condition variable until signalled or until the next
+// pending update is due.
+//
+// Returns:
+//  true if a pending update is due, false otherwise.
+// NB call with the async lock held.
+static bool jf_net_pending_wait(void)
+{
+    struct timespec deadline = { 0 };
+    size_t i;
+    int result;
+
+    assert(pthread_mutex_lock(&s_pending_mut) == 0);
+    for (i = 0; i < s_pending_count; i++) {
+        if (jf_net_pending_is_held(s_pending[i])) continue;
+        if (deadline.tv_sec == 0 || s_pending[i]->next_attempt < deadline.tv_sec) {
+            deadline.tv_sec = s_pending[i]->next_attempt;
+        }
     }
+    assert(pthread_mutex_unlock(&s_pending_mut) == 0);
 
-    if (JF_REQUEST_TYPE_IS_ASYNC(request_type)) {
-        a_r = jf_async_request_new(resource,
-                request_type,
-                method,
-                payload);
-        reply = a_r->reply;
-        jf_synced_queue_enqueue(s_async_queue, a_r);
-    } else {
-        reply = jf_reply_new();
-        jf_net_handle_before_perform(s_handle,
-                resource,
-                request_type,
-                method,
-                payload,
-                reply);
-        jf_net_handle_after_perform(s_handle,
-                curl_easy_perform(s_handle),
-                request_type,
-                reply);
+    if (deadline.tv_sec == 0) {
+        assert(pthread_cond_wait(&s_async_cv, &s_async_mut) == 0);
+        return false;
     }
+    if (deadline.tv_sec <= time(NULL)) return true;
+    result = pthread_cond_timedwait(&s_async_cv, &s_async_mut, &deadline);
+    assert(result == 0 || result == ETIMEDOUT);
+    return result == ETIMEDOUT;
+}
 
-    return reply;
+
+// Settles an attempt at update u: handle is the one it went through, NULL if
+// it never made it to the network.
+// NB call without the async lock held.
+static void jf_net_pending_done(jf_pending_update *u,
+        CURL *handle,
+        const jf_reply_state state)
+{
+    long status_code = 0;
+    time_t delay;
+    bool retry;
+    size_t i;
+
+    if (handle != NULL) {
+        JF_CURL_ASSERT(curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status_code));
+    }
+    switch (state) {
+        case JF_REPLY_ERROR_NETWORK:
+        case JF_REPLY_ERROR_DROPPED:
+        case JF_REPLY_ERROR_EXIT_REQUEST:
+        case JF_REPLY_ERROR_CANCELLED:
+            retry = true;
+            break;
+        case JF_REPLY_ERROR_HTTP_NOT_OK:
+            retry = status_code == 408 || status_code == 429 || status_code >= 500;
+            break;
+        default:
+            // through, or refused for good
+            retry = false;
+            break;
+    }
+
+    assert(pthread_mutex_lock(&s_pending_mut) == 0);
+    u->in_flight = false;
+    if (u->superseded) {
+        // whatever replaced it may go now
+        for (i = 0; i < s_pending_count; i++) {
+            if (s_pending[i] == u) {
+                jf_net_pending_remove(i);
+                break;
+            }
+        }
+        jf_pending_update_free(u);
+    } else if (retry && ++u->attempts < JF_NET_PENDING_MAX_ATTEMPTS) {
+        delay = JF_NET_PENDING_BACKOFF_MIN;
+        for (i = 1; i < u->attempts && delay < JF_NET_PENDING_BACKOFF_MAX; i++) {
+            delay *= 2;
+        }
+        u->next_attempt = time(NULL)
+            + (delay < JF_NET_PENDING_BACKOFF_MAX ? delay : JF_NET_PENDING_BACKOFF_MAX);
+    } else {
+        for (i = 0; i < s_pending_count; i++) {
+            if (s_pending[i] == u) {
+                jf_net_pending_remove(i);
+                break;
+            }
+        }
+        jf_pending_update_free(u);
+        // written out by the next enqueue or on exit: the loop thread must not
+        // wait on the disk, and at worst an update that went through is sent
+        // again after a crash
+        s_pending_dirty = true;
+    }
+    assert(pthread_mutex_unlock(&s_pending_mut) == 0);
 }
-///////////////////////////////////
+/////////////////////////////////////
 
 
 ////////// ASYNC NETWORKING //////////
 static jf_async_request *jf_async_request_new(const char *resource,
         const jf_request_type request_type,
         const jf_http_method method,
-        const char *payload)
+        const char *payload,
+        const jf_request_priority priority)
 {
     jf_async_request *a_r;
     static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
@@ -599,6 +2406,10 @@ static jf_async_request *jf_async_request_new(const char *resource,
     }
     a_r->type = request_type;
     a_r->method = method;
+    a_r->priority = priority;
+    a_r->transfer = (jf_http_cache_transfer){ 0 };
+    a_r->update = NULL;
+    a_r->parser = NULL;
     switch (method) {
         case JF_HTTP_GET:
         case JF_HTTP_DELETE:
@@ -623,6 +2434,7 @@ static jf_async_request *jf_async_request_new(const char *resource,
 static void jf_async_request_free(jf_async_request *a_r)
 {
     if (a_r == NULL) return;
+    jf_http_cache_transfer_end(&a_r->transfer);
     free(a_r->resource);
     free(a_r->payload);
     free(a_r);
@@ -642,12 +2454,388 @@ static size_t jf_detach_callback(__attribute__((unused)) char *payload,
 }
 
 
-static void *jf_net_async_worker_thread(__attribute__((unused)) void *arg)
+static void jf_async_lane_init(jf_async_lane *lane,
+        const size_t max_queued,
+        const size_t max_in_flight)
 {
-    CURL *handle;
+    lane->capacity = max_queued > 0 ? max_queued : 16;
+    assert((lane->requests = malloc(lane->capacity * sizeof(jf_async_request *))) != NULL);
+    lane->head = 0;
+    lane->count = 0;
+    lane->max_queued = max_queued;
+    lane->in_flight = 0;
+    lane->max_in_flight = max_in_flight;
+    lane->skipped = 0;
+}
+
+
+// Returns the request that had to be dropped to make room, if any.
+static jf_async_request *jf_async_lane_push(jf_async_lane *lane,
+        jf_async_request *a_r)
+{
+    jf_async_request *dropped = NULL;
+    size_t i;
+
+    if (lane->count == lane->capacity) {
+        if (lane->max_queued > 0) {
+            dropped = jf_async_lane_pop(lane);
+        } else {
+            // unroll the ring into a bigger one
+            jf_async_request **requests;
+            assert((requests = malloc(2 * lane->capacity * sizeof(jf_async_request *))) != NULL);
+            for (i = 0; i < lane->count; i++) {
+                requests[i] = lane->requests[(lane->head + i) % lane->capacity];
+            }
+            free(lane->requests);
+            lane->requests = requests;
+            lane->capacity *= 2;
+            lane->head = 0;
+        }
+    }
+    lane->requests[(lane->head + lane->count) % lane->capacity] = a_r;
+    lane->count++;
+
+    return dropped;
+}
+
+
+static jf_async_request *jf_async_lane_pop(jf_async_lane *lane)
+{
+    jf_async_request *a_r;
+
+    if (lane->count == 0) return NULL;
+    a_r = lane->requests[lane->head];
+    lane->head = (lane->head + 1) % lane->capacity;
+    lane->count--;
+    return a_r;
+}
+
+
+static jf_async_request *jf_async_lane_take(jf_async_lane *lane,
+        const jf_reply *reply)
+{
+    jf_async_request *a_r;
+    size_t i;
+
+    for (i = 0; i < lane->count; i++) {
+        a_r = lane->requests[(lane->head + i) % lane->capacity];
+        if (a_r->reply != reply) continue;
+        // close the gap
+        for (; i + 1 < lane->count; i++) {
+            lane->requests[(lane->head + i) % lane->capacity] =
+                lane->requests[(lane->head + i + 1) % lane->capacity];
+        }
+        lane->count--;
+        return a_r;
+    }
+    return NULL;
+}
+
+
+// Finishes off a request that never made it to the network.
+static void jf_net_async_fail(jf_async_request *a_r, const jf_reply_state state)
+{
+    if (JF_ASYNC_REQUEST_PTR_IS_SHAREABLE(a_r)) {
+        assert(pthread_mutex_lock(&s_async_mut) == 0);
+        jf_net_async_untrack(a_r);
+        assert(pthread_mutex_unlock(&s_async_mut) == 0);
+    }
+    if (a_r->update != NULL) {
+        // nobody waits on these
+        jf_net_pending_done(a_r->update, NULL, state);
+        jf_reply_signal_done(a_r->reply, state);
+        jf_reply_free(a_r->reply);
+    } else if (a_r->reply != NULL) {
+        jf_reply_signal_done(a_r->reply, state);
+    }
+    jf_async_request_free(a_r);
+}
+
+
+static void jf_net_async_enqueue(jf_async_request *a_r)
+{
+    jf_async_request *dropped;
+
+    assert(pthread_mutex_lock(&s_async_mut) == 0);
+    if (JF_ASYNC_REQUEST_PTR_IS_SHAREABLE(a_r)) {
+        jf_net_async_track(a_r);
+    }
+    dropped = jf_async_lane_push(s_async_lanes + a_r->priority, a_r);
+    assert(pthread_cond_signal(&s_async_cv) == 0);
+    assert(pthread_mutex_unlock(&s_async_mut) == 0);
+#if JF_CURL_VERSION_GE(7,68)
+    // in case the loop is busy polling the transfers
+    JF_CURL_MULTI_ASSERT(curl_multi_wakeup(s_multi));
+#endif
+
+    if (dropped != NULL) {
+        jf_net_async_fail(dropped, JF_REPLY_ERROR_DROPPED);
+    }
+}
+
+
+// Returns a new reference to the reply of a pending shareable request for
+// resource, if any.
+static jf_reply *jf_net_async_join(const char *resource)
+{
+    jf_reply *reply = NULL;
+    size_t i;
+
+    if (resource == NULL) return NULL;
+
+    assert(pthread_mutex_lock(&s_async_mut) == 0);
+    for (i = 0; i < s_async_shareable_count; i++) {
+        if (strcmp(s_async_shareable[i]->resource, resource) == 0) {
+            reply = s_async_shareable[i]->reply;
+            // it's not done before being untracked, so it's safe to add to
+            assert(pthread_mutex_lock(&reply->mut) == 0);
+            if (reply->cancelled) {
+                // bound to fail: start afresh
+                assert(pthread_mutex_unlock(&reply->mut) == 0);
+                reply = NULL;
+                continue;
+            }
+            reply->refcount++;
+            assert(pthread_mutex_unlock(&reply->mut) == 0);
+            break;
+        }
+    }
+    assert(pthread_mutex_unlock(&s_async_mut) == 0);
+
+    return reply;
+}
+
+
+// NB call with the async lock held.
+static void jf_net_async_track(jf_async_request *a_r)
+{
+    if (s_async_shareable_count == s_async_shareable_size) {
+        s_async_shareable_size = s_async_shareable_size == 0 ? 16 : 2 * s_async_shareable_size;
+        assert((s_async_shareable = realloc(s_async_shareable,
+                        s_async_shareable_size * sizeof(jf_async_request *))) != NULL);
+    }
+    s_async_shareable[s_async_shareable_count++] = a_r;
+}
+
+
+// NB call with the async lock held.
+static void jf_net_async_untrack(const jf_async_request *a_r)
+{
+    size_t i;
+
+    for (i = 0; i < s_async_shareable_count; i++) {
+        if (s_async_shareable[i] == a_r) {
+            s_async_shareable[i] = s_async_shareable[--s_async_shareable_count];
+            return;
+        }
+    }
+}
+
+
+// Lets the async loop know that a ring it paused a transfer on has room.
+static void jf_net_parser_wakeup(void)
+{
+#if JF_CURL_VERSION_GE(7,68)
+    JF_CURL_MULTI_ASSERT(curl_multi_wakeup(s_multi));
+#endif
+    // otherwise the loop doesn't sleep for long anyway
+}
+
+
+static jf_net_parser *jf_net_parser_acquire(void)
+{
+    size_t i;
+
+    for (i = 0; i < JF_NET_SAX_PARSERS; i++) {
+        if (! s_parsers[i].busy) {
+            s_parsers[i].busy = true;
+            return s_parsers + i;
+        }
+    }
+    return NULL;
+}
+
+
+static void jf_net_parser_release(jf_net_parser *parser)
+{
+    jf_thread_buffer *tb = &parser->tb;
+
+    // a transfer cut short may have been left paused
+    tb->producer_paused = false;
+    __atomic_store_n(&tb->producer_sleeping, false, __ATOMIC_SEQ_CST);
+    jf_thread_buffer_wait_pending(tb, 0);
+    switch (__atomic_load_n(&tb->state, __ATOMIC_ACQUIRE)) {
+        case JF_THREAD_BUFFER_STATE_PARSER_ERROR:
+            jf_thread_buffer_drop_error(tb);
+            break;
+        case JF_THREAD_BUFFER_STATE_AWAITING_DATA:
+            jf_thread_buffer_reset(tb);
+            break;
+        default:
+            break;
+    }
+    // the reply keeps the items
+    tb->destination = NULL;
+    parser->handle = NULL;
+    parser->busy = false;
+}
+
+
+static void jf_net_parser_resume_paused(void)
+{
+    size_t i;
+
+    for (i = 0; i < JF_NET_SAX_PARSERS; i++) {
+        if (s_parsers[i].handle != NULL
+                && jf_thread_buffer_try_unpause(&s_parsers[i].tb)) {
+            JF_CURL_ASSERT(curl_easy_pause(s_parsers[i].handle, CURLPAUSE_CONT));
+        }
+    }
+}
+
+
+static bool jf_async_lane_is_ready(const jf_async_lane *lane)
+{
+    size_t i;
+
+    if (lane->count == 0 || lane->in_flight >= lane->max_in_flight) return false;
+    if (! JF_REQUEST_TYPE_IS_SAX(lane->requests[lane->head]->type)) return true;
+    // lanes are FIFO: a listing holds up the ones behind it till it gets a
+    // parser
+    for (i = 0; i < JF_NET_SAX_PARSERS; i++) {
+        if (! s_parsers[i].busy) return true;
+    }
+    return false;
+}
+
+
+// Takes the next request to start, if there is a free connection for it.
+// The highest priority lane with queued requests and room in flight wins,
+// unless a lower one has been passed over too many times.
+// NB call with the async lock held.
+static jf_async_request *jf_net_async_pick(void)
+{
+    jf_async_lane *lane;
+    jf_async_request *a_r;
+    size_t chosen = JF_REQUEST_PRIORITY_COUNT;
+    size_t i;
+
+    if (s_async_in_flight >= JF_NET_MAX_HOST_CONNECTIONS) return NULL;
+
+    for (i = 0; i < JF_REQUEST_PRIORITY_COUNT; i++) {
+        lane = s_async_lanes + i;
+        if (! jf_async_lane_is_ready(lane)) continue;
+        if (chosen == JF_REQUEST_PRIORITY_COUNT
+                || lane->skipped >= JF_NET_STARVATION_LIMIT) {
+            chosen = i;
+        }
+    }
+    if (chosen == JF_REQUEST_PRIORITY_COUNT) return NULL;
+
+    for (i = 0; i < JF_REQUEST_PRIORITY_COUNT; i++) {
+        lane = s_async_lanes + i;
+        if (i == chosen) {
+            lane->skipped = 0;
+        } else if (jf_async_lane_is_ready(lane)) {
+            lane->skipped++;
+        }
+    }
+
+    lane = s_async_lanes + chosen;
+    lane->in_flight++;
+    s_async_in_flight++;
+    a_r = jf_async_lane_pop(lane);
+    if (JF_REQUEST_TYPE_IS_SAX(a_r->type)) {
+        assert((a_r->parser = jf_net_parser_acquire()) != NULL);
+        a_r->reply->tb = &a_r->parser->tb;
+    }
+    return a_r;
+}
+
+
+// Waits for activity on the running transfers or for a new request.
+static void jf_net_async_wait(void)
+{
+#if JF_CURL_VERSION_GE(7,68)
+    JF_CURL_MULTI_ASSERT(curl_multi_poll(s_multi, NULL, 0, JF_NET_ASYNC_POLL_MS, NULL));
+#else
+    JF_CURL_MULTI_ASSERT(curl_multi_wait(s_multi, NULL, 0, JF_NET_ASYNC_WAIT_MS, NULL));
+#endif
+}
+
+
+static void jf_net_async_done(CURLMsg *msg)
+{
+    CURL *handle = msg->easy_handle;
+    CURLcode result = msg->data.result;
+    char *private;
     jf_async_request *request;
+    jf_reply_state state;
+
+    JF_CURL_ASSERT(curl_easy_getinfo(handle, CURLINFO_PRIVATE, &private));
+    request = (jf_async_request *)private;
+    JF_CURL_MULTI_ASSERT(curl_multi_remove_handle(s_multi, handle));
+
+    // once untracked, nobody else can join: only then is it safe to complete
+    assert(pthread_mutex_lock(&s_async_mut) == 0);
+    s_async_lanes[request->priority].in_flight--;
+    s_async_in_flight--;
+    if (JF_ASYNC_REQUEST_PTR_IS_SHAREABLE(request)) {
+        jf_net_async_untrack(request);
+    }
+    assert(pthread_mutex_unlock(&s_async_mut) == 0);
+
+    state = jf_net_handle_after_perform(handle,
+            result,
+            request->type,
+            request->reply,
+            &request->transfer);
+    if (request->parser != NULL) {
+        jf_net_parser_release(request->parser);
+    }
+    if (request->update != NULL) {
+        jf_net_pending_done(request->update, handle, state);
+        jf_reply_signal_done(request->reply, state);
+        jf_reply_free(request->reply);
+    } else if (request->type != JF_REQUEST_ASYNC_DETACH) {
+        jf_reply_signal_done(request->reply, state);
+    }
+    jf_async_request_free(request);
+}
+
+
+// Publishes the final state of the reply. Whoever sees it done may free it,
+// so it must not be touched after this returns, nor before the lock is let go.
+static void jf_reply_signal_done(jf_reply *r, const jf_reply_state state)
+{
+    assert(pthread_mutex_lock(&r->mut) == 0);
+    r->state = state;
+    __atomic_store_n(&r->done, true, __ATOMIC_RELEASE);
+    // a shared reply may have many waiters
+    assert(pthread_cond_broadcast(&r->cv) == 0);
+    if (r->waiter != NULL) {
+        assert(pthread_mutex_lock(&r->waiter->mut) == 0);
+        r->waiter->signaled = true;
+        assert(pthread_cond_signal(&r->waiter->cv) == 0);
+        assert(pthread_mutex_unlock(&r->waiter->mut) == 0);
+    }
+    assert(pthread_mutex_unlock(&r->mut) == 0);
+}
+
 
-    handle = jf_net_handle_init();
+// A single thread drives all async requests through the curl multi interface.
+// Easy handles are kept around once done to reuse for later requests.
+static void *jf_net_async_loop_thread(__attribute__((unused)) void *arg)
+{
+    CURL *idle_handles[JF_NET_MAX_HOST_CONNECTIONS];
+    size_t idle_count = 0;
+    jf_async_request *picked[JF_NET_MAX_HOST_CONNECTIONS];
+    size_t picked_count, in_flight, done_count, i;
+    CURL *handle;
+    CURLMsg *msg;
+    jf_async_request *request;
+    int running, msgs_left;
+    bool exiting;
 
     // block signals we handle in main thread
     {
@@ -660,25 +2848,94 @@ static void *jf_net_async_worker_thread(__attribute__((unused)) void *arg)
     }
 
     while (true) {
-        request = (jf_async_request *)jf_synced_queue_dequeue(s_async_queue);
-        if (request->type == JF_REQUEST_EXIT) {
-            jf_async_request_free(request);
-            curl_easy_cleanup(handle);
-            pthread_exit(NULL);
+        // updates due for another attempt join the background lane
+        jf_net_pending_start_due();
+
+        // pick up new requests as connections free up, only sleeping on the
+        // lanes if there's nothing else to do (or until the next update is
+        // due)
+        // on exit, stop taking new requests but see the running ones through
+        picked_count = 0;
+        assert(pthread_mutex_lock(&s_async_mut) == 0);
+        while (true) {
+            if (! (exiting = s_async_exiting)) {
+                while ((request = jf_net_async_pick()) != NULL) {
+                    picked[picked_count++] = request;
+                }
+            }
+            if (picked_count > 0 || s_async_in_flight > 0 || exiting) break;
+            if (jf_net_pending_wait()) break;
+        }
+        in_flight = s_async_in_flight;
+        assert(pthread_mutex_unlock(&s_async_mut) == 0);
+
+        if (in_flight == 0) {
+            if (exiting) break;
+            continue;
+        }
+
+        for (i = 0; i < picked_count; i++) {
+            // no point in starting what's been given up on
+            if (picked[i]->reply != NULL && jf_reply_is_cancelled(picked[i]->reply)) {
+                if (picked[i]->parser != NULL) {
+                    jf_net_parser_release(picked[i]->parser);
+                }
+                assert(pthread_mutex_lock(&s_async_mut) == 0);
+                s_async_lanes[picked[i]->priority].in_flight--;
+                s_async_in_flight--;
+                assert(pthread_mutex_unlock(&s_async_mut) == 0);
+                jf_net_async_fail(picked[i], JF_REPLY_ERROR_CANCELLED);
+                continue;
+            }
+            handle = idle_count > 0 ? idle_handles[--idle_count] : jf_net_handle_init();
+            if (picked[i]->parser != NULL) {
+                picked[i]->parser->handle = handle;
+            }
+            jf_net_handle_before_perform(handle,
+                    picked[i]->resource,
+                    picked[i]->type,
+                    picked[i]->method,
+                    picked[i]->payload,
+                    picked[i]->reply,
+                    &picked[i]->transfer);
+            JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_PRIVATE, (void *)picked[i]));
+            JF_CURL_MULTI_ASSERT(curl_multi_add_handle(s_multi, handle));
+        }
+
+        jf_net_parser_resume_paused();
+        JF_CURL_MULTI_ASSERT(curl_multi_perform(s_multi, &running));
+        done_count = 0;
+        while ((msg = curl_multi_info_read(s_multi, &msgs_left)) != NULL) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            handle = msg->easy_handle;
+            jf_net_async_done(msg);
+            done_count++;
+            if (idle_count < JF_NET_MAX_HOST_CONNECTIONS) {
+                idle_handles[idle_count++] = handle;
+            } else {
+                curl_easy_cleanup(handle);
+            }
+        }
+        // freed connections may let queued requests through right away
+        if (done_count == 0) {
+            jf_net_async_wait();
+        }
+    }
+
+    // whatever is still queued won't ever go anywhere
+    for (i = 0; i < JF_REQUEST_PRIORITY_COUNT; i++) {
+        while (true) {
+            assert(pthread_mutex_lock(&s_async_mut) == 0);
+            request = jf_async_lane_pop(s_async_lanes + i);
+            assert(pthread_mutex_unlock(&s_async_mut) == 0);
+            if (request == NULL) break;
+            jf_net_async_fail(request, JF_REPLY_ERROR_EXIT_REQUEST);
         }
-        jf_net_handle_before_perform(handle,
-                request->resource,
-                request->type,
-                request->method,
-                request->payload,
-                request->reply);
-        jf_net_handle_after_perform(handle,
-                curl_easy_perform(handle),
-                request->type,
-                request->reply);
-        jf_async_request_free(request);
-        assert(pthread_cond_broadcast(&s_async_cv) == 0);
     }
+    while (idle_count > 0) {
+        curl_easy_cleanup(idle_handles[--idle_count]);
+    }
+    return NULL;
 }
 
 
@@ -743,13 +3000,121 @@ static void jf_net_share_unlock(__attribute__((unused)) CURL *handle,
 jf_reply *jf_net_await(jf_reply *reply)
 {
     assert(reply != NULL);
-    pthread_mutex_lock(&s_async_mut);
-    while (reply->state == JF_REPLY_PENDING) {
-        pthread_cond_wait(&s_async_cv, &s_async_mut);
+    assert(pthread_mutex_lock(&reply->mut) == 0);
+    while (! reply->done) {
+        assert(pthread_cond_wait(&reply->cv, &reply->mut) == 0);
     }
-    pthread_mutex_unlock(&s_async_mut);
+    assert(pthread_mutex_unlock(&reply->mut) == 0);
     return reply;
 }
+
+
+size_t jf_net_await_any(jf_reply **replies, const size_t count)
+{
+    jf_reply_waiter waiter = { .signaled = false };
+    size_t i, registered;
+    bool done = false;
+
+    assert(pthread_mutex_init(&waiter.mut, NULL) == 0);
+    assert(pthread_cond_init(&waiter.cv, NULL) == 0);
+
+    // register with every pending reply, unless one is already done
+    // NB never hold the waiter lock while taking a reply's: the event loop
+    // takes them in the opposite order
+    for (registered = 0; registered < count && ! done; registered++) {
+        if (replies[registered] == NULL) continue;
+        assert(pthread_mutex_lock(&replies[registered]->mut) == 0);
+        if (JF_REPLY_PTR_IS_PENDING(replies[registered])) {
+            replies[registered]->waiter = &waiter;
+        } else {
+            done = true;
+        }
+        assert(pthread_mutex_unlock(&replies[registered]->mut) == 0);
+    }
+
+    if (! done) {
+        assert(pthread_mutex_lock(&waiter.mut) == 0);
+        while (! waiter.signaled) {
+            assert(pthread_cond_wait(&waiter.cv, &waiter.mut) == 0);
+        }
+        assert(pthread_mutex_unlock(&waiter.mut) == 0);
+    }
+
+    // unregister, and after that nobody will touch the waiter again
+    for (i = 0; i < registered; i++) {
+        if (replies[i] == NULL) continue;
+        assert(pthread_mutex_lock(&replies[i]->mut) == 0);
+        replies[i]->waiter = NULL;
+        assert(pthread_mutex_unlock(&replies[i]->mut) == 0);
+    }
+    pthread_mutex_destroy(&waiter.mut);
+    pthread_cond_destroy(&waiter.cv);
+
+    for (i = 0; i < count; i++) {
+        if (replies[i] != NULL && ! JF_REPLY_PTR_IS_PENDING(replies[i])) break;
+    }
+    assert(i < count);
+    return i;
+}
+
+
+void jf_net_await_all(jf_reply **replies, const size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (replies[i] != NULL) {
+            jf_net_await(replies[i]);
+        }
+    }
+}
+
+
+void jf_net_cancel(jf_reply *r)
+{
+    if (r == NULL) return;
+
+    assert(pthread_mutex_lock(&r->mut) == 0);
+    if (! r->done && r->refcount == 1) {
+        r->cancelled = true;
+    }
+    assert(pthread_mutex_unlock(&r->mut) == 0);
+}
+
+
+void jf_net_promote(jf_reply *r)
+{
+    jf_async_request *a_r = NULL;
+    size_t i;
+
+    if (r == NULL) return;
+
+    assert(pthread_mutex_lock(&s_async_mut) == 0);
+    for (i = JF_REQUEST_PRIORITY_INTERACTIVE + 1; i < JF_REQUEST_PRIORITY_COUNT && a_r == NULL; i++) {
+        a_r = jf_async_lane_take(s_async_lanes + i, r);
+    }
+    if (a_r != NULL) {
+        // not started yet, so no lane counts it in flight
+        a_r->priority = JF_REQUEST_PRIORITY_INTERACTIVE;
+        // the INTERACTIVE lane is unbounded: nothing gets dropped
+        jf_async_lane_push(s_async_lanes + JF_REQUEST_PRIORITY_INTERACTIVE, a_r);
+        assert(pthread_cond_signal(&s_async_cv) == 0);
+    }
+    assert(pthread_mutex_unlock(&s_async_mut) == 0);
+#if JF_CURL_VERSION_GE(7,68)
+    if (a_r != NULL) {
+        JF_CURL_MULTI_ASSERT(curl_multi_wakeup(s_multi));
+    }
+#endif
+}
+
+
+bool jf_net_cancel_sync(void)
+{
+    if (s_sync_running == 0) return false;
+    s_sync_cancelled = 1;
+    return true;
+}
 //////////////////////////////////////
 
 
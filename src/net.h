@@ -4,6 +4,10 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "shared.h"
 
 
 ////////// CODE MACROS //////////
@@ -30,11 +34,56 @@ do {                                                                        \
     }                                                                       \
 } while (false)
 
+#define JF_CURL_MULTI_ASSERT(_s)                                            \
+do {                                                                        \
+    CURLMcode _c = _s;                                                      \
+    if (_c != CURLM_OK) {                                                   \
+        fprintf(stderr, "%s:%d: " #_s " failed.\n", __FILE__, __LINE__);    \
+        fprintf(stderr, "FATAL: libcurl error: %s.\n",                      \
+                curl_multi_strerror(_c));                                   \
+        jf_exit(JF_EXIT_FAILURE);                                           \
+    }                                                                       \
+} while (false)
 /////////////////////////////////
 
 
 ////////// CONSTANTS /////////
-#define JF_NET_ASYNC_THREADS 3
+// all async requests share a single curl multi handle: this caps the
+// connections it may open to the server, further requests wait their turn
+#define JF_NET_MAX_HOST_CONNECTIONS 8
+// how many requests the bounded priority lanes may hold before dropping the
+// oldest one, and how many of the connections above they may take up
+#define JF_NET_PREFETCH_MAX_QUEUED 64
+#define JF_NET_PREFETCH_MAX_IN_FLIGHT (JF_NET_MAX_HOST_CONNECTIONS / 2)
+#define JF_NET_BACKGROUND_MAX_QUEUED 256
+#define JF_NET_BACKGROUND_MAX_IN_FLIGHT (JF_NET_MAX_HOST_CONNECTIONS / 4)
+// a lane passed over this many times in favour of higher priority ones gets
+// the next free connection
+#define JF_NET_STARVATION_LIMIT 16
+// parser threads for async SAX requests, on top of the one for synchronous
+// ones: async listings beyond these wait for one to free up
+#define JF_NET_SAX_PARSERS 4
+// without curl_multi_wakeup, how often the event loop looks for new requests
+// while transfers are running
+#define JF_NET_ASYNC_WAIT_MS 50
+// with curl_multi_wakeup, new requests and paused transfers that may go on wake
+// the event loop at once: it only looks on its own this often, to start pending
+// updates that came due while transfers are running
+#define JF_NET_ASYNC_POLL_MS 1000
+// first line of the file the HTTP cache persists to
+#define JF_NET_HTTP_CACHE_MAGIC "jftui http cache 1\n"
+// longest ETag or Last-Modified the HTTP cache file is trusted with
+#define JF_NET_HTTP_CACHE_VALIDATOR_MAX 4096
+// name of the file in the config dir pending updates persist to, and its
+// first line
+#define JF_NET_PENDING_FILE "pending_updates"
+#define JF_NET_PENDING_MAGIC "jftui pending updates 1\n"
+// a failed update is retried after a delay, in seconds, that doubles from the
+// first up to the second with each attempt, until it's given up on after the
+// third
+#define JF_NET_PENDING_BACKOFF_MIN 2
+#define JF_NET_PENDING_BACKOFF_MAX 600
+#define JF_NET_PENDING_MAX_ATTEMPTS 24
 //////////////////////////////
 
 ////////// JF_REPLY //////////
@@ -51,6 +100,8 @@ typedef enum __attribute__((__packed__)) jf_reply_state {
     JF_REPLY_ERROR_BAD_LOCATION = -7,
     JF_REPLY_ERROR_EXIT_REQUEST = -8,
     JF_REPLY_ERROR_NETWORK = -9,
+    JF_REPLY_ERROR_DROPPED = -10,
+    JF_REPLY_ERROR_CANCELLED = -11,
 
     JF_REPLY_ERROR_HTTP_400 = -32,
     JF_REPLY_ERROR_HTTP_NOT_OK = -33,
@@ -58,14 +109,42 @@ typedef enum __attribute__((__packed__)) jf_reply_state {
 } jf_reply_state;
 
 
+// Lets jf_net_await_any sleep until any one of many replies is done.
+typedef struct jf_reply_waiter {
+    pthread_mutex_t mut;
+    pthread_cond_t cv;
+    bool signaled;
+} jf_reply_waiter;
+
+
+// Each reply carries its own completion signal, so that awaiting it only ever
+// wakes up its own waiter.
+// `mut` guards `waiter`, `refcount` and `cancelled`; `cv` is signaled once
+// `state` is no longer pending.
+// Identical GETs in flight at the same time share one reply: every caller of
+// jf_net_request holds a reference and must still jf_reply_free it, the
+// payload is only freed along with the last reference. Thus the payload must
+// be treated as read-only.
 typedef struct jf_reply {
     char *payload;
     size_t size;
     jf_reply_state state;
+    // set last, under mut, once state is final: async replies may see their
+    // state change while still in flight
+    bool done;
+    pthread_mutex_t mut;
+    pthread_cond_t cv;
+    jf_reply_waiter *waiter;
+    size_t refcount;
+    bool cancelled;
+    // SAX requests only: the parser the response is fed to
+    struct jf_thread_buffer *tb;
+    // async SAX requests only: the items parsed, to splice into the payload
+    struct jf_file_cache *items;
 } jf_reply;
 
 
-#define JF_REPLY_PTR_IS_PENDING(_p) ((_p)->state == 0)
+#define JF_REPLY_PTR_IS_PENDING(_p) (! __atomic_load_n(&(_p)->done, __ATOMIC_ACQUIRE))
 #define JF_REPLY_PTR_HAS_ERROR(_p)  ((_p)->state < 0)
 #define JF_REPLY_PTR_SHOULD_FREE_PAYLOAD(_p) ((_p)->state == 1 || (_p)->state <= -32)
 
@@ -76,9 +155,95 @@ char *jf_reply_error_string(const jf_reply *r);
 //////////////////////////////
 
 
+////////// HTTP CACHE //////////
+// GET responses that came with an ETag or Last-Modified header are kept in a
+// cache bounded by the http_cache_mb option, keyed by user and URL. The next
+// identical request is sent along with If-None-Match/If-Modified-Since and,
+// on a 304, the cached body is replayed as if it had been downloaded again.
+typedef struct jf_http_cache_entry {
+    char *key;
+    char *etag;
+    char *last_modified;
+    char *body;
+    size_t size;
+    // one for the cache itself, one per transfer revalidating the entry
+    size_t refcount;
+    size_t last_used;
+} jf_http_cache_entry;
+
+
+// Returns a copy of the body cached for a GET of resource (the same as for
+// jf_net_request), regardless of whether it is still fresh, or NULL if there
+// is none. The copy is \0-terminated and size is set to its length.
+// CAN FATAL.
+char *jf_net_http_cache_get(const char *resource, size_t *size);
+
+
+// State of a request as far as the cache is concerned, from before to after
+// its transfer. key is NULL if the request is not cacheable.
+typedef struct jf_http_cache_transfer {
+    char *key;
+    jf_http_cache_entry *cached;
+    struct curl_slist *headers;
+    char *etag;
+    char *last_modified;
+    // SAX requests only: copy of what was fed to the parser, to store
+    char *body;
+    size_t body_size;
+    bool body_too_big;
+    jf_reply *reply;
+} jf_http_cache_transfer;
+////////////////////////////////
+
+
+////////// NETWORK STATS //////////
+// The timings curl reports for every transfer are aggregated per endpoint,
+// that is the path of the URL with ids and numbers replaced by "{id}".
+// Histograms count transfers by milliseconds taken, in powers of two: bucket 0
+// is under 1 ms, bucket i from 2^(i-1) up to 2^i ms and the last one is
+// everything beyond.
+#define JF_NET_STATS_BUCKETS 18
+// name of the file in the config dir the stats are written to at exit
+#define JF_NET_STATS_DUMP_FILE "net_stats.json"
+
+
+typedef struct jf_net_stats_endpoint {
+    char *name;
+    size_t count;
+    // transport errors and HTTP statuses >= 400
+    size_t errors;
+    // transfers that didn't have to open a connection
+    size_t reused;
+    long long bytes_down;
+    // sums over all transfers, in microseconds: name lookup, connection, TLS
+    // handshake, wait from the request being sent to the first byte of the
+    // response (i.e. the server's own time plus a round trip) and total
+    long long dns_us;
+    long long connect_us;
+    long long tls_us;
+    long long wait_us;
+    long long total_us;
+    size_t wait_histogram[JF_NET_STATS_BUCKETS];
+    size_t total_histogram[JF_NET_STATS_BUCKETS];
+} jf_net_stats_endpoint;
+
+
+// Prints the network statistics gathered so far, endpoints that took the
+// most time first.
+// CAN FATAL.
+void jf_net_stats_print(void);
+///////////////////////////////////
+
+
 ////////// PARSER THREAD COMMUNICATION //////////
 size_t jf_thread_buffer_item_count(void);
 void jf_thread_buffer_clear_error(void);
+
+
+// Returns the TotalRecordCount of the last query result parsed, or 0 if it
+// had none.
+// CAN'T FAIL.
+size_t jf_thread_buffer_total_record_count(void);
 /////////////////////////////////////////////////
 
 
@@ -96,11 +261,20 @@ typedef enum jf_request_type {
     JF_REQUEST_ASYNC_IN_MEMORY = -1,
     JF_REQUEST_ASYNC_DETACH = -2,
     JF_REQUEST_CHECK_UPDATE = -3,
+    JF_REQUEST_ASYNC_SAX = -4,
+    JF_REQUEST_ASYNC_SAX_PROMISCUOUS = -5,
 
     JF_REQUEST_EXIT = -100
 } jf_request_type;
 
 #define JF_REQUEST_TYPE_IS_ASYNC(_t) ((_t) < 0)
+#define JF_REQUEST_TYPE_IS_SAX(_t)              \
+    ((_t) == JF_REQUEST_SAX                     \
+     || (_t) == JF_REQUEST_SAX_PROMISCUOUS      \
+     || (_t) == JF_REQUEST_ASYNC_SAX            \
+     || (_t) == JF_REQUEST_ASYNC_SAX_PROMISCUOUS)
+#define JF_REQUEST_TYPE_IS_PROMISCUOUS(_t)      \
+    ((_t) == JF_REQUEST_SAX_PROMISCUOUS || (_t) == JF_REQUEST_ASYNC_SAX_PROMISCUOUS)
 
 
 typedef enum jf_http_method {
@@ -110,6 +284,22 @@ typedef enum jf_http_method {
 } jf_http_method;
 
 
+// Async requests are queued in one lane per priority. Higher priorities are
+// served first, but each lane gets its turn eventually.
+//  - INTERACTIVE: the user is waiting on it. Never dropped.
+//  - PREFETCH: might come in handy soon.
+//  - BACKGROUND: telemetry like progress updates and flag changes.
+// Lower priority lanes are bounded: once full, the oldest request in them is
+// dropped and its reply fails with JF_REPLY_ERROR_DROPPED.
+typedef enum jf_request_priority {
+    JF_REQUEST_PRIORITY_INTERACTIVE = 0,
+    JF_REQUEST_PRIORITY_PREFETCH = 1,
+    JF_REQUEST_PRIORITY_BACKGROUND = 2
+} jf_request_priority;
+
+#define JF_REQUEST_PRIORITY_COUNT 3
+
+
 // Executes a network request to the Jellyfin server. The response may be
 // entirely put in a single jf_reply in memory or passed step by step to the
 // JSON parser thread with constant memory usage. In the latter case, the
@@ -137,7 +327,12 @@ typedef enum jf_http_method {
 //      - JF_REQUEST_ASYNC_DETACH will likewise work asynchronously; however,
 //          the function will immediately return NULL and all response data
 //          will be discarded on arrival. Use for requests whose outcome you
-//          don't care about, like watch state updates.
+//          really don't care about: watch state updates should rather go
+//          through jf_net_pending_update.
+//      - JF_REQUEST_ASYNC_SAX and JF_REQUEST_ASYNC_SAX_PROMISCUOUS will work
+//          asynchronously as well, with the response passed to a parser
+//          thread of its own and digested quietly into a scratch cache
+//          instead of the payload (see jf_disk_payload_splice_scratch);
 //      - JF_REQUEST_CHECK_UPDATE functions like JF_REQUEST_ASYNC_IN_MEMORY,
 //          except the resource parameter is ignored and internally set to the
 //          one required for the optional update check against github.com
@@ -151,22 +346,96 @@ typedef enum jf_http_method {
 //      for POST (may be NULL for an empty body).
 //
 // Returns:
-//  A jf_reply which either:
+//  A jf_reply (possibly shared with other callers if an identical async GET
+//  was already pending, see jf_reply) which either:
 //  - marks an error (authentication, network, parser's, internal), check with
 //      the JF_REPLY_PTR_HAS_ERROR macro and get an error string with
 //      jf_reply_error_string;
 //  - contains the body of the response for a JF_REQUEST_[ASYNC_]IN_MEMORY and
 //      JF_REQUEST_CHECK_UPDATE.
 //  - contains an empty body for JF_REQUEST_SAX_*;
+//  - contains an empty body and the items parsed, in its items field, for
+//      JF_REQUEST_ASYNC_SAX_*;
 //  - is NULL for JF_REQUEST_ASYNC_DETACH.
 // CAN FATAL.
 jf_reply *jf_net_request(const char *resource,
         jf_request_type request_type,
         const jf_http_method method,
         const char *payload);
+
+
+// Same as jf_net_request, with an explicit priority for async requests.
+// jf_net_request uses JF_REQUEST_PRIORITY_BACKGROUND for
+// JF_REQUEST_ASYNC_DETACH, JF_REQUEST_PRIORITY_PREFETCH for
+// JF_REQUEST_CHECK_UPDATE and JF_REQUEST_PRIORITY_INTERACTIVE otherwise.
+// Enqueueing never blocks. Synchronous requests ignore the priority.
+// CAN FATAL.
+jf_reply *jf_net_request_priority(const char *resource,
+        jf_request_type request_type,
+        const jf_http_method method,
+        const char *payload,
+        const jf_request_priority priority);
+
+
+// Feeds body to the JSON parser as if it were the response to a
+// JF_REQUEST_SAX or JF_REQUEST_SAX_PROMISCUOUS request_type, without any
+// network activity, and waits for parsing to be done. If quiet, items are
+// ingested but not printed. If append, they're added to those already in the
+// payload cache (e.g. as the next page of the same listing) instead of
+// replacing them.
+//
+// Returns:
+//  A jf_reply marking success or a parser error, as for jf_net_request.
+// CAN FATAL.
+jf_reply *jf_net_sax_digest(const char *body,
+        const size_t size,
+        const jf_request_type request_type,
+        const bool quiet,
+        const bool append);
 ////////////////////////////////
 
 
+////////// PENDING UPDATES //////////
+// Requests that change state on the server, like playback progress and
+// watched flags, are written ahead to a queue persisted in the config dir.
+// The async loop sends them in the background, retrying those that fail for
+// transient reasons (network errors, 408, 429, 5xx) with exponential backoff,
+// and drops them once they're through or refused for good. Whatever is left
+// at exit is sent on the next startup.
+typedef struct jf_pending_update {
+    char *key;
+    char *resource;
+    jf_http_method method;
+    char *payload;
+    size_t attempts;
+    time_t next_attempt;
+    // a request for it is queued or in flight
+    bool in_flight;
+    // replaced by a later update while in flight: kept in the queue, never to
+    // be sent again, until it's through, and the later one only goes then so
+    // that the two reach the server in order
+    bool superseded;
+} jf_pending_update;
+
+
+// Queues an update for the server. An update with the same key that is still
+// pending is superseded by this one and never sent (or resent), and this one
+// goes to the back of the queue.
+//
+// Parameters:
+//  resource, method, payload:
+//      The same as for jf_net_request.
+//  key:
+//      What updates coalesce on. If NULL, the resource itself is used, so
+//      that e.g. a POST and a DELETE to the same URL cancel out.
+// CAN FATAL.
+void jf_net_pending_update(const char *resource,
+        const jf_http_method method,
+        const char *payload,
+        const char *key);
+/////////////////////////////////////
+
+
 ////////// ASYNC NETWORKING //////////
 typedef struct jf_async_request {
     jf_reply *reply;
@@ -174,11 +443,90 @@ typedef struct jf_async_request {
     jf_request_type type;
     jf_http_method method;
     char *payload;
+    jf_request_priority priority;
+    jf_http_cache_transfer transfer;
     size_t id;
+    // the pending update this request is an attempt at, if any
+    jf_pending_update *update;
+    // async SAX requests only: the parser it's got, once started
+    struct jf_net_parser *parser;
 } jf_async_request;
 
+// requests whose replies may be shared by identical ones
+#define JF_ASYNC_REQUEST_PTR_IS_SHAREABLE(_p) \
+    ((_p)->type == JF_REQUEST_ASYNC_IN_MEMORY && (_p)->method == JF_HTTP_GET)
+
+
+// A FIFO of requests of the same priority, growing as needed unless
+// max_queued is not 0. Only ever accessed under the async lock.
+typedef struct jf_async_lane {
+    jf_async_request **requests;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    size_t max_queued;
+    size_t in_flight;
+    size_t max_in_flight;
+    size_t skipped;
+} jf_async_lane;
+
+
+// One parser thread along with its ring, for async SAX requests. Parsers are
+// handed out to requests as they start and taken back as they're done, all on
+// the async loop thread.
+typedef struct jf_net_parser {
+    jf_thread_buffer tb;
+    // the transfer feeding it, NULL while free
+    CURL *handle;
+    bool busy;
+} jf_net_parser;
+
 
 jf_reply *jf_net_await(jf_reply *r);
+
+
+// Blocks until at least one of the replies is no longer pending. NULL entries
+// are skipped.
+//
+// Returns:
+//  the index of the first reply in the array that is done.
+// REQUIRES: at least one entry is not NULL; no other jf_net_await_any is
+//  waiting on the same replies.
+// CAN FATAL.
+size_t jf_net_await_any(jf_reply **replies, const size_t count);
+
+
+// Blocks until none of the replies is pending anymore. NULL entries are
+// skipped.
+// CAN FATAL.
+void jf_net_await_all(jf_reply **replies, const size_t count);
+
+
+// Asks for a pending async request to be given up on: if it's still queued,
+// it never starts, else its transfer is aborted as soon as curl checks in on
+// its progress. Either way, the reply fails with JF_REPLY_ERROR_CANCELLED and
+// must still be awaited and freed as usual.
+// No-op if the reply is done already or shared with other callers, who may
+// still want it.
+// CAN FATAL.
+void jf_net_cancel(jf_reply *r);
+
+
+// Moves a queued async request up to the INTERACTIVE lane, behind whatever is
+// queued there already, for when the user ends up waiting on something that
+// was only prefetched. Once promoted, it can't be dropped anymore.
+// No-op if the request has started (or is done) already.
+// CAN FATAL.
+void jf_net_promote(jf_reply *r);
+
+
+// Aborts the synchronous request in progress, if any: its reply fails with
+// JF_REPLY_ERROR_CANCELLED. Async-signal-safe, meant for the SIGINT handler.
+//
+// Returns:
+//  true if there was a synchronous request in progress, false otherwise.
+// CAN'T FAIL.
+bool jf_net_cancel_sync(void);
 //////////////////////////////////////
 
 
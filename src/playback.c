@@ -61,14 +61,14 @@ static void jf_post_session_update(const char *id,
         int64_t playback_ticks,
         const char *update_url)
 {
-    char *progress_post;
+    char *progress_post, *key;
 
     progress_post = jf_json_generate_progress_post(id, playback_ticks);
-    jf_net_request(update_url,
-            JF_REQUEST_ASYNC_DETACH,
-            JF_HTTP_POST,
-            progress_post);
+    // only the latest update of each kind per item is worth sending
+    assert((key = jf_concat(3, update_url, " ", id)) != NULL);
+    jf_net_pending_update(update_url, JF_HTTP_POST, progress_post, key);
     free(progress_post);
+    free(key);
 }
 
 
@@ -391,6 +391,7 @@ bool jf_playback_play_item(jf_menu_item *item)
                             item->name,
                             jf_reply_error_string(replies[1]));
                     jf_reply_free(replies[1]);
+                    jf_net_cancel(replies[0]);
                     jf_reply_free(jf_net_await(replies[0]));
                     jf_playback_end();
                     return false;
@@ -405,7 +406,9 @@ bool jf_playback_play_item(jf_menu_item *item)
                     jf_playback_end();
                     return false;
                 }
-                jf_json_parse_video(item, replies[0]->payload, replies[1]->payload);
+                jf_json_parse_video(item,
+                        replies[0]->payload, replies[0]->size,
+                        replies[1]->payload, replies[1]->size);
                 jf_reply_free(replies[0]);
                 jf_reply_free(replies[1]);
                 if (jf_playback_populate_video_ticks(item) == false
@@ -426,6 +429,8 @@ bool jf_playback_play_item(jf_menu_item *item)
             return false;
     }
 
+    jf_disk_playlist_save_position(g_state.playlist_position);
+
     return true;
 }
 
@@ -434,7 +439,7 @@ static inline bool jf_playback_populate_video_ticks(jf_menu_item *item)
 {
     jf_reply **replies;
     jf_growing_buffer part_url = jf_growing_buffer_new(0);
-    size_t i;
+    size_t i, j;
 
     if (item == NULL) return true;
     if (item->type != JF_ITEM_TYPE_EPISODE
@@ -467,18 +472,18 @@ static inline bool jf_playback_populate_video_ticks(jf_menu_item *item)
     jf_growing_buffer_free(part_url);
 
     for (i = 1; i < item->children_count; i++) {
-        jf_net_await(replies[i - 1]);
-        if (JF_REPLY_PTR_HAS_ERROR(replies[i - 1])) {
+        if (JF_REPLY_PTR_HAS_ERROR(jf_net_await(replies[i - 1]))) {
             fprintf(stderr,
                     "Error: could not fetch resume information for part %zu of item %s: %s.\n",
                     i + 1,
                     item->name,
                     jf_reply_error_string(replies[i - 1]));
-            for (i = 1; i < item->children_count; i++) {
-                if (replies[i - 1] != NULL) {
-                    jf_net_await(replies[i - 1]);
-                    jf_reply_free(replies[i - 1]);
-                }
+            // the ones before were freed already, the ones after are moot
+            for (j = i + 1; j < item->children_count; j++) {
+                jf_net_cancel(replies[j - 1]);
+            }
+            for (j = i; j < item->children_count; j++) {
+                jf_reply_free(jf_net_await(replies[j - 1]));
             }
             free(replies);
             return false;
@@ -190,10 +190,20 @@ void jf_menu_item_print(const jf_menu_item *item)
 ////////// THREAD BUFFER //////////
 void jf_thread_buffer_init(jf_thread_buffer *tb)
 {
-    tb->used = 0;
+    tb->head = 0;
+    tb->tail = 0;
+    tb->parser_sleeping = false;
+    tb->producer_sleeping = false;
+    tb->producer_paused = false;
+    tb->producer_wakeup = NULL;
+    tb->error[0] = '\0';
     tb->promiscuous_context = false;
+    tb->quiet = false;
+    tb->append = false;
+    tb->destination = NULL;
     tb->state = JF_THREAD_BUFFER_STATE_CLEAR;
     tb->item_count = 0;
+    tb->total_record_count = 0;
     assert(pthread_mutex_init(&tb->mut, NULL) == 0);
     assert(pthread_cond_init(&tb->cv_no_data, NULL) == 0);
     assert(pthread_cond_init(&tb->cv_has_data, NULL) == 0);
@@ -348,6 +358,7 @@ void *jf_synced_queue_dequeue(jf_synced_queue *q)
 
     return payload;
 }
+
 //////////////////////////////////
 
 
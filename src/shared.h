@@ -65,6 +65,9 @@ do {                                \
 ////////// CONSTANTS //////////
 #define JF_VERSION "0.7.5"
 #define JF_THREAD_BUFFER_DATA_SIZE (CURL_MAX_WRITE_SIZE +1)
+// chunks of a response that may be waiting on the parser at once
+#define JF_THREAD_BUFFER_SLOTS 8
+#define JF_THREAD_BUFFER_ERROR_SIZE 1024
 #define JF_ID_LENGTH 32
 ///////////////////////////////
 
@@ -229,19 +232,57 @@ void jf_growing_buffer_free(jf_growing_buffer buffer);
 ////////// THREAD_BUFFER //////////
 typedef enum jf_thread_buffer_state {
     JF_THREAD_BUFFER_STATE_CLEAR = 0,
+    // halfway through a document
     JF_THREAD_BUFFER_STATE_AWAITING_DATA = 1,
-    JF_THREAD_BUFFER_STATE_PENDING_DATA = 2,
     JF_THREAD_BUFFER_STATE_PARSER_ERROR = 3,
-    JF_THREAD_BUFFER_STATE_PARSER_DEAD = 4
+    JF_THREAD_BUFFER_STATE_PARSER_DEAD = 4,
+    // the transfer was cut short: drop the partial document
+    JF_THREAD_BUFFER_STATE_RESET = 5
 } jf_thread_buffer_state;
 
 
-typedef struct jf_thread_buffer {
+typedef struct jf_thread_buffer_slot {
     char data[JF_THREAD_BUFFER_DATA_SIZE];
     size_t used;
+} jf_thread_buffer_slot;
+
+
+// Chunks of a response go from the network (the producer) to the parser
+// thread through a single-producer single-consumer ring of slots, so that
+// the next chunks can be received while the parser is busy with the earlier
+// ones. Each side only ever advances its own index, with atomic stores the
+// other side loads, and takes no lock as long as the ring is neither full nor
+// empty. The mutex is only for sleeping on a full (cv_has_data) or empty
+// (cv_no_data) ring, after raising the matching flag, and for resets.
+// state is written by the parser after each chunk, before it advances head.
+struct jf_file_cache;
+
+
+typedef struct jf_thread_buffer {
+    jf_thread_buffer_slot slots[JF_THREAD_BUFFER_SLOTS];
+    // next slot to parse, only written by the parser
+    size_t head;
+    // next slot to fill, only written by the producer
+    size_t tail;
+    bool parser_sleeping;
+    bool producer_sleeping;
+    // a producer that must not sleep (the async loop) has its writes paused
+    // while the ring is full instead: producer_paused is only touched by it,
+    // producer_wakeup is called by the parser when it frees a slot
+    bool producer_paused;
+    void (*producer_wakeup)(void);
+    char error[JF_THREAD_BUFFER_ERROR_SIZE];
     bool promiscuous_context;
+    // parse without printing the items
+    bool quiet;
+    // add the items to those already in the payload instead of replacing them
+    bool append;
+    // where items go: NULL for the payload cache
+    struct jf_file_cache *destination;
     jf_thread_buffer_state state;
     size_t item_count;
+    // TotalRecordCount of the last query result parsed, 0 if none
+    size_t total_record_count;
     pthread_mutex_t mut;
     pthread_cond_t cv_no_data;
     pthread_cond_t cv_has_data;